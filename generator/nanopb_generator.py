@@ -124,6 +124,18 @@ datatypes = {
     (FieldD.TYPE_UINT64, nanopb_pb2.IS_64):   ('uint64_t','UINT64', 10,  8),
 }
 
+# Wire type used for each pb type in the fast decoding table and in the
+# specialized encoding/decoding functions.
+wiretypes = {
+    'BOOL': 'VARINT', 'INT32': 'VARINT', 'UINT32': 'VARINT', 'SINT32': 'VARINT',
+    'INT64': 'VARINT', 'UINT64': 'VARINT', 'SINT64': 'VARINT',
+    'ENUM': 'VARINT', 'UENUM': 'VARINT',
+    'FIXED32': '32BIT', 'SFIXED32': '32BIT', 'FLOAT': '32BIT',
+    'FIXED64': '64BIT', 'SFIXED64': '64BIT', 'DOUBLE': '64BIT',
+    'STRING': 'STRING', 'BYTES': 'STRING', 'FIXED_LENGTH_BYTES': 'STRING',
+    'MESSAGE': 'STRING',
+}
+
 reserved_keywords = [
     "NULL", "alignas", "alignof", "and", "and_eq", "asm", "assert", "auto",
     "bitand", "bitor", "bool", "break", "case", "catch", "char", "class",
@@ -699,6 +711,47 @@ class Field(ProtoElement):
         if desc.type == FieldD.TYPE_BYTES and self.max_size is None:
             self.can_be_static = False
 
+        # Lazy submessages are stored as a view of the encoded data, and
+        # decoded later with pb_decode_lazy().
+        self.is_lazy = field_options.lazy
+        if self.is_lazy and desc.type != FieldD.TYPE_MESSAGE:
+            raise Exception("Field '%s' is defined as lazy, but only "
+                            "submessage fields can be lazy." % self.name)
+
+        # View fields reference the input buffer, so their data size is
+        # always fixed, regardless of max_size.
+        self.is_view = (field_options.type == nanopb_pb2.FT_VIEW) or self.is_lazy
+        if self.is_view:
+            kind = 'lazy' if self.is_lazy else 'FT_VIEW'
+            if desc.type not in (FieldD.TYPE_STRING, FieldD.TYPE_BYTES) and not self.is_lazy:
+                raise Exception("Field '%s' is defined as FT_VIEW, but only "
+                                "string and bytes fields can be views." % self.name)
+
+            if self.rules == 'REPEATED' and self.max_count is None:
+                raise Exception("Field '%s' is defined as %s, but "
+                                "max_count is not given." % (self.name, kind))
+
+            if self.default is not None:
+                raise Exception("Field '%s' is defined as %s, which does "
+                                "not support default values." % (self.name, kind))
+
+            field_options.type = nanopb_pb2.FT_STATIC
+            self.can_be_static = True
+
+        # Streaming fields are decoded one element at a time into a buffer
+        # that follows the callback structure.
+        self.is_streaming = field_options.streaming
+        if self.is_streaming:
+            if desc.type != FieldD.TYPE_MESSAGE or self.rules != 'REPEATED':
+                raise Exception("Field '%s' is defined as streaming, but only "
+                                "repeated submessage fields can be streamed." % self.name)
+
+            if self.is_lazy:
+                raise Exception("Field '%s' cannot be both lazy and streaming." % self.name)
+
+            field_options.type = nanopb_pb2.FT_CALLBACK
+            self.callback_datatype = 'pb_stream_callback_t'
+
         # Decide how the field data will be allocated
         if field_options.type == nanopb_pb2.FT_DEFAULT:
             if self.can_be_static:
@@ -740,6 +793,15 @@ class Field(ProtoElement):
             if self.default is not None:
                 self.default = self.ctype + self.default
             self.enc_size = None # Needs to be filled in when enum values are known
+        elif self.is_view:
+            self.pbtype = 'VIEW'
+            self.ctype = 'pb_view_t'
+            if self.is_lazy:
+                self.submsgname = names_from_type_name(desc.type_name)
+            if self.max_size is not None:
+                self.enc_size = varint_max_size(self.max_size) + self.max_size
+                if desc.type == FieldD.TYPE_STRING:
+                    self.enc_size -= 1 # max_size includes null terminator
         elif desc.type == FieldD.TYPE_STRING:
             self.pbtype = 'STRING'
             self.ctype = 'char'
@@ -777,6 +839,9 @@ class Field(ProtoElement):
             # outside oneofs. This can be used for repeated fields and oneofs.
             if field_options.submsg_callback and self.allocation == 'STATIC':
                 self.pbtype = 'MSG_W_CB'
+
+            if self.is_streaming:
+                self.pbtype = 'MSG_STREAM'
         else:
             raise NotImplementedError(desc.type)
 
@@ -819,6 +884,10 @@ class Field(ProtoElement):
                 result += '    %s *%s;' % (type_name, var_name)
         elif self.allocation == 'CALLBACK':
             result += '    %s %s;' % (self.callback_datatype, var_name)
+
+            if self.pbtype == 'MSG_STREAM':
+                # Element buffer must directly follow the callback
+                result += '\n    %s %s_item;' % (type_name, var_name)
         else:
             if self.pbtype == 'MSG_W_CB' and self.rules in ['OPTIONAL', 'REPEATED']:
                 result += '    pb_callback_t cb_' + var_name + ';\n'
@@ -846,7 +915,7 @@ class Field(ProtoElement):
 
     def get_dependencies(self):
         '''Get list of type names used by this field.'''
-        if self.allocation == 'STATIC':
+        if self.allocation == 'STATIC' or self.pbtype == 'MSG_STREAM':
             return [str(self.ctype)]
         elif self.allocation == 'POINTER' and self.rules == 'FIXARRAY':
             return [str(self.ctype)]
@@ -862,7 +931,7 @@ class Field(ProtoElement):
         inner_init = None
         if self.initializer is not None:
             inner_init = self.initializer
-        elif self.pbtype in ['MESSAGE', 'MSG_W_CB']:
+        elif self.pbtype in ['MESSAGE', 'MSG_W_CB', 'MSG_STREAM']:
             if null_init:
                 inner_init = Globals.naming_style.define_name('%s_init_zero' % self.ctype)
             else:
@@ -874,6 +943,8 @@ class Field(ProtoElement):
                 inner_init = '{0, {0}}'
             elif self.pbtype == 'FIXED_LENGTH_BYTES':
                 inner_init = '{0}'
+            elif self.pbtype == 'VIEW':
+                inner_init = '{NULL, 0}'
             elif self.pbtype in ('ENUM', 'UENUM'):
                 inner_init = '_%s_MIN' % Globals.naming_style.define_name(self.ctype)
             else:
@@ -941,6 +1012,8 @@ class Field(ProtoElement):
         elif self.allocation == 'CALLBACK':
             if self.pbtype == 'EXTENSION':
                 outer_init = 'NULL'
+            elif self.pbtype == 'MSG_STREAM':
+                outer_init = '{{NULL}, NULL}, ' + inner_init
             elif self.callback_datatype == 'pb_callback_t':
                 outer_init = '{{NULL}, NULL}'
             elif self.initializer is not None:
@@ -989,6 +1062,262 @@ class Field(ProtoElement):
                                                      name + ',',
                                                      self.tag)
 
+    def fast_decode_wiretype(self):
+        '''Return the wire type name used in the fast decoding table, or
+        None if this field cannot be decoded through the table.'''
+        if (self.allocation != 'STATIC' or self.tag >= 16 or
+            self.rules not in ('REQUIRED', 'OPTIONAL', 'SINGULAR')):
+            return None
+
+        wiretype = wiretypes.get(self.pbtype)
+        if wiretype == 'STRING':
+            return None
+        return wiretype
+
+    def specialized_supported(self):
+        '''Return True if this field can be handled by the specialized
+        encoding and decoding functions.'''
+        if self.allocation != 'STATIC' or self.pbtype not in wiretypes:
+            return False
+        if self.rules not in ('REQUIRED', 'OPTIONAL', 'SINGULAR', 'REPEATED', 'ONEOF'):
+            return False
+        if self.pbtype == 'MESSAGE' and self.rules == 'SINGULAR':
+            # Would need a recursive check for the default value
+            return False
+        return True
+
+    def specialized_member(self):
+        '''Return C expression for the field data inside msg.'''
+        name = Globals.naming_style.var_name(self.name)
+        if self.rules == 'ONEOF' and not self.anonymous:
+            return 'msg->%s.%s' % (Globals.naming_style.var_name(self.union_name), name)
+        return 'msg->%s' % name
+
+    def specialized_ctypes(self):
+        '''Return the C type of the field and the signed type that the
+        generic decoder uses to check for overflows.'''
+        if isinstance(self.ctype, Names):
+            ctype = Globals.naming_style.type_name(self.ctype)
+        else:
+            ctype = self.ctype
+        if self.pbtype in ('INT32', 'INT64', 'ENUM') and ctype.startswith('uint'):
+            # Enums with int_size option are stored in unsigned types
+            return ctype, ctype[1:]
+        return ctype, ctype
+
+    def specialized_decode(self, dest, src, fail, specialized, init = True):
+        '''Return lines of C code that decode a single value of this field
+        from stream src into dest. Overflow errors are reported on stream,
+        read errors return with the statement fail.'''
+        ctype, stype = self.specialized_ctypes()
+        err = 'PB_RETURN_ERROR(stream, "%s");'
+        pbtype = self.pbtype
+        check_size = (self.data_item_size != 8 or isinstance(self.ctype, Names))
+
+        if pbtype == 'BOOL':
+            return ['if (!pb_decode_bool(%s, &%s))' % (src, dest), '    ' + fail]
+        elif pbtype in ('UINT32', 'UINT64', 'UENUM'):
+            result = ['{',
+                      '    pb_uint64_t value;',
+                      '    if (!pb_decode_varint(%s, &value))' % src,
+                      '        ' + fail,
+                      '    %s = (%s)value;' % (dest, ctype)]
+            if check_size:
+                result += ['    if ((pb_uint64_t)%s != value)' % dest,
+                           '        ' + err % 'integer too large']
+            return result + ['}']
+        elif pbtype in ('SINT32', 'SINT64'):
+            result = ['{',
+                      '    pb_int64_t value;',
+                      '    if (!pb_decode_svarint(%s, &value))' % src,
+                      '        ' + fail,
+                      '    %s = (%s)value;' % (dest, ctype)]
+            if check_size:
+                result += ['    if ((pb_int64_t)%s != value)' % dest,
+                           '        ' + err % 'integer too large']
+            return result + ['}']
+        elif pbtype in ('INT32', 'INT64', 'ENUM'):
+            if not check_size:
+                return ['{',
+                        '    pb_uint64_t value;',
+                        '    if (!pb_decode_varint(%s, &value))' % src,
+                        '        ' + fail,
+                        '    %s = (%s)value;' % (dest, ctype),
+                        '}']
+            # Values of 32-bit and smaller fields are sign extended from
+            # 32 bits, same as in pb_decode.c.
+            result = ['{',
+                      '    pb_uint64_t value;',
+                      '    pb_int64_t svalue;',
+                      '    if (!pb_decode_varint(%s, &value))' % src,
+                      '        ' + fail,
+                      '    svalue = (int32_t)value;',
+                      '    %s = (%s)svalue;' % (dest, ctype)]
+            if stype != ctype:
+                result += ['    if ((pb_int64_t)(%s)%s != svalue)' % (stype, dest)]
+            else:
+                result += ['    if ((pb_int64_t)%s != svalue)' % dest]
+            return result + ['        ' + err % 'integer too large', '}']
+        elif pbtype in ('FIXED32', 'SFIXED32', 'FLOAT'):
+            return ['if (!pb_decode_fixed32(%s, &%s))' % (src, dest), '    ' + fail]
+        elif pbtype in ('FIXED64', 'SFIXED64'):
+            return ['if (!pb_decode_fixed64(%s, &%s))' % (src, dest), '    ' + fail]
+        elif pbtype == 'DOUBLE':
+            return ['#ifdef PB_CONVERT_DOUBLE_FLOAT',
+                    'if (sizeof(%s) == sizeof(float))' % dest,
+                    '{',
+                    '    if (!pb_decode_double_as_float(%s, (float*)&%s))' % (src, dest),
+                    '        ' + fail,
+                    '}',
+                    'else',
+                    '#endif',
+                    'if (!pb_decode_fixed64(%s, &%s))' % (src, dest),
+                    '    ' + fail]
+        elif pbtype == 'STRING':
+            return ['{',
+                    '    uint32_t size;',
+                    '    if (!pb_decode_varint32(%s, &size))' % src,
+                    '        ' + fail,
+                    '    if (size >= %du)' % self.max_size,
+                    '        ' + err % 'string overflow',
+                    "    %s[size] = '\\0';" % dest,
+                    '    if (!pb_read(%s, (pb_byte_t*)%s, (size_t)size))' % (src, dest),
+                    '        ' + fail,
+                    '#ifdef PB_VALIDATE_UTF8',
+                    '    if (!pb_validate_utf8(%s))' % dest,
+                    '        ' + err % 'invalid utf8',
+                    '#endif',
+                    '}']
+        elif pbtype == 'BYTES':
+            return ['{',
+                    '    uint32_t size;',
+                    '    if (!pb_decode_varint32(%s, &size))' % src,
+                    '        ' + fail,
+                    '    if (size > %du)' % self.max_size,
+                    '        ' + err % 'bytes overflow',
+                    '    %s.size = (pb_size_t)size;' % dest,
+                    '    if (!pb_read(%s, %s.bytes, (size_t)size))' % (src, dest),
+                    '        ' + fail,
+                    '}']
+        elif pbtype == 'FIXED_LENGTH_BYTES':
+            return ['{',
+                    '    uint32_t size;',
+                    '    if (!pb_decode_varint32(%s, &size))' % src,
+                    '        ' + fail,
+                    '    if (size == 0)',
+                    '        memset(%s, 0, %d);' % (dest, self.max_size),
+                    '    else if (size != %du)' % self.max_size,
+                    '        ' + err % 'incorrect fixed length bytes size',
+                    '    else if (!pb_read(%s, %s, %d))' % (src, dest, self.max_size),
+                    '        ' + fail,
+                    '}']
+        elif pbtype == 'MESSAGE':
+            submsg = specialized.get(str(self.ctype))
+            msgdesc = '&%s_msg' % Globals.naming_style.type_name(self.ctype)
+            if submsg is not None:
+                encode, decode, decode_fields = submsg.specialized_names()
+                call_init = '%s(&substream, &%s)' % (decode, dest)
+                call_noinit = '%s(&substream, &%s)' % (decode_fields, dest)
+            else:
+                call_init = 'pb_decode(&substream, %s, &%s)' % (msgdesc, dest)
+                call_noinit = 'pb_decode_ex(&substream, %s, &%s, PB_DECODE_NOINIT)' % (msgdesc, dest)
+
+            if init is True:
+                call = call_init
+            elif init is False:
+                call = call_noinit
+            else:
+                # Runtime condition, used for oneofs
+                call = '(%s) ? %s : %s' % (init, call_init, call_noinit)
+
+            return ['{',
+                    '    pb_istream_t substream;',
+                    '    bool status;',
+                    '    if (!pb_make_string_substream(%s, &substream))' % src,
+                    '        ' + fail,
+                    '    status = %s;' % call,
+                    '    if (!pb_close_string_substream(%s, &substream) || !status)' % src,
+                    '        ' + fail,
+                    '}']
+
+        raise NotImplementedError(pbtype)
+
+    def specialized_encode(self, src, dest, fail, specialized):
+        '''Return lines of C code that encode a single value of this field,
+        without the tag, from src to stream dest.'''
+        ctype, stype = self.specialized_ctypes()
+        pbtype = self.pbtype
+
+        if pbtype == 'BOOL':
+            call = 'pb_encode_varint(%s, %s ? 1 : 0)' % (dest, src)
+        elif pbtype in ('UINT32', 'UINT64', 'UENUM'):
+            call = 'pb_encode_varint(%s, (pb_uint64_t)%s)' % (dest, src)
+        elif pbtype in ('SINT32', 'SINT64'):
+            call = 'pb_encode_svarint(%s, (pb_int64_t)%s)' % (dest, src)
+        elif pbtype == 'INT64':
+            call = 'pb_encode_varint(%s, (pb_uint64_t)(pb_int64_t)%s)' % (dest, src)
+        elif pbtype in ('INT32', 'ENUM'):
+            if stype != ctype:
+                src = '(%s)%s' % (stype, src)
+            call = 'encode_int32_varint(%s, %s)' % (dest, src)
+        elif pbtype in ('FIXED32', 'SFIXED32', 'FLOAT'):
+            call = 'pb_encode_fixed32(%s, &%s)' % (dest, src)
+        elif pbtype in ('FIXED64', 'SFIXED64'):
+            call = 'pb_encode_fixed64(%s, &%s)' % (dest, src)
+        elif pbtype == 'DOUBLE':
+            return ['#ifdef PB_CONVERT_DOUBLE_FLOAT',
+                    'if (sizeof(%s) == sizeof(float))' % src,
+                    '{',
+                    '    if (!pb_encode_float_as_double(%s, *(const float*)&%s))' % (dest, src),
+                    '        ' + fail,
+                    '}',
+                    'else',
+                    '#endif',
+                    'if (!pb_encode_fixed64(%s, &%s))' % (dest, src),
+                    '    ' + fail]
+        elif pbtype == 'STRING':
+            return ['{',
+                    '    size_t size = 0;',
+                    "    while (size < %d && %s[size] != '\\0')" % (self.max_size - 1, src),
+                    '        size++;',
+                    "    if (%s[size] != '\\0')" % src,
+                    '        PB_RETURN_ERROR(stream, "unterminated string");',
+                    '#ifdef PB_VALIDATE_UTF8',
+                    '    if (!pb_validate_utf8(%s))' % src,
+                    '        PB_RETURN_ERROR(stream, "invalid utf8");',
+                    '#endif',
+                    '    if (!pb_encode_string(%s, (const pb_byte_t*)%s, size))' % (dest, src),
+                    '        ' + fail,
+                    '}']
+        elif pbtype == 'BYTES':
+            return ['if (%s.size > %d)' % (src, self.max_size),
+                    '    PB_RETURN_ERROR(stream, "bytes size exceeded");',
+                    'if (!pb_encode_string(%s, %s.bytes, (size_t)%s.size))' % (dest, src, src),
+                    '    ' + fail]
+        elif pbtype == 'FIXED_LENGTH_BYTES':
+            call = 'pb_encode_string(%s, %s, %d)' % (dest, src, self.max_size)
+        elif pbtype == 'MESSAGE':
+            submsg = specialized.get(str(self.ctype))
+            if submsg is None:
+                call = 'pb_encode_submessage(%s, &%s_msg, &%s)' % (
+                    dest, Globals.naming_style.type_name(self.ctype), src)
+            else:
+                # Same as pb_encode_submessage(), the size is computed
+                # with a separate pass before the actual encoding.
+                encode = submsg.specialized_names()[0]
+                return ['{',
+                        '    pb_ostream_t sizestream = PB_OSTREAM_SIZING;',
+                        '    if (!%s(&sizestream, &%s))' % (encode, src),
+                        '        PB_RETURN_ERROR(stream, PB_GET_ERROR(&sizestream));',
+                        '    if (!pb_encode_varint(%s, (pb_uint64_t)sizestream.bytes_written) ||' % dest,
+                        '        !%s(%s, &%s))' % (encode, dest, src),
+                        '        ' + fail,
+                        '}']
+        else:
+            raise NotImplementedError(pbtype)
+
+        return ['if (!%s)' % call, '    ' + fail]
+
     def data_size(self, dependencies):
         '''Return estimated size of this field in the C struct.
         This is used to try to automatically pick right descriptor size.
@@ -998,10 +1327,10 @@ class Field(ProtoElement):
         if self.allocation == 'POINTER' or self.pbtype == 'EXTENSION':
             size = 8
             alignment = 8
-        elif self.allocation == 'CALLBACK':
+        elif (self.allocation == 'CALLBACK' and self.pbtype != 'MSG_STREAM') or self.pbtype == 'VIEW':
             size = 16
             alignment = 8
-        elif self.pbtype in ['MESSAGE', 'MSG_W_CB']:
+        elif self.pbtype in ['MESSAGE', 'MSG_W_CB', 'MSG_STREAM']:
             alignment = 8
             if str(self.submsgname) in dependencies:
                 other_dependencies = dict(x for x in dependencies.items() if x[0] != str(self.struct_name))
@@ -1010,7 +1339,7 @@ class Field(ProtoElement):
                 size = 256 # Message is in other file, this is reasonable guess for most cases
                 sys.stderr.write('Could not determine size for submessage %s, using default %d\n' % (self.submsgname, size))
 
-            if self.pbtype == 'MSG_W_CB':
+            if self.pbtype in ['MSG_W_CB', 'MSG_STREAM']:
                 size += 16
         elif self.pbtype in ['STRING', 'FIXED_LENGTH_BYTES']:
             size = self.max_size
@@ -1046,7 +1375,7 @@ class Field(ProtoElement):
         if not self.can_be_static:
             return None
 
-        if self.pbtype in ['MESSAGE', 'MSG_W_CB']:
+        if self.pbtype in ['MESSAGE', 'MSG_W_CB', 'MSG_STREAM']:
             encsize = None
             if str(self.submsgname) in dependencies:
                 submsg = dependencies[str(self.submsgname)]
@@ -1083,6 +1412,10 @@ class Field(ProtoElement):
                 # prefix size, though.
                 encsize += 5
 
+        elif self.pbtype == 'VIEW' and self.enc_size is None:
+            # Length of the referenced data is not limited
+            return None
+
         elif self.pbtype in ['ENUM', 'UENUM']:
             if str(self.ctype) in dependencies:
                 enumtype = dependencies[str(self.ctype)]
@@ -1116,7 +1449,8 @@ class Field(ProtoElement):
         return self.allocation == 'CALLBACK'
 
     def requires_custom_field_callback(self):
-        return self.allocation == 'CALLBACK' and self.callback_datatype != 'pb_callback_t'
+        return (self.allocation == 'CALLBACK' and self.pbtype != 'MSG_STREAM' and
+                self.callback_datatype != 'pb_callback_t')
 
 class ExtensionRange(Field):
     def __init__(self, struct_name, range_start, field_options):
@@ -1140,6 +1474,7 @@ class ExtensionRange(Field):
         self.fixed_count = False
         self.callback_datatype = 'pb_extension_t*'
         self.initializer = None
+        self.is_lazy = False
 
     def requires_custom_field_callback(self):
         return False
@@ -1342,6 +1677,9 @@ class Message(ProtoElement):
         self.math_include_required = False
         self.packed = message_options.packed_struct
         self.descriptorsize = message_options.descriptorsize
+        self.tag_lookup = message_options.tag_lookup
+        self.fast_decode = message_options.fast_decode
+        self.decode_mask = list(message_options.decode_mask)
 
         if message_options.msgid:
             self.msgid = message_options.msgid
@@ -1358,6 +1696,8 @@ class Message(ProtoElement):
                     self.callback_function = "%s_callback" % self.name
                     break
 
+        self.specialize = message_options.specialize and self.specialized_supported()
+
     def load_fields(self, desc, message_options):
         '''Load field list from DescriptorProto'''
 
@@ -1548,20 +1888,27 @@ class Message(ProtoElement):
         else:
             result += '#define %s_DEFAULT NULL\n' % Globals.naming_style.define_name(self.name)
 
+        if self.default_image_supported(dependencies):
+            result += '#define %s_DEFAULT_IMAGE &%s_default_image\n' % (
+                Globals.naming_style.define_name(self.name),
+                Globals.naming_style.type_name(self.name))
+        else:
+            result += '#define %s_DEFAULT_IMAGE NULL\n' % Globals.naming_style.define_name(self.name)
+
         for field in sorted_fields:
-            if field.pbtype in ['MESSAGE', 'MSG_W_CB']:
+            if field.pbtype in ['MESSAGE', 'MSG_W_CB', 'MSG_STREAM'] or field.is_lazy:
                 if field.rules == 'ONEOF':
                     result += "#define %s_%s_%s_MSGTYPE %s\n" % (
                         Globals.naming_style.type_name(self.name),
                         Globals.naming_style.var_name(field.union_name),
                         Globals.naming_style.var_name(field.name),
-                        Globals.naming_style.type_name(field.ctype)
+                        Globals.naming_style.type_name(field.submsgname)
                     )
                 else:
                     result += "#define %s_%s_MSGTYPE %s\n" % (
                         Globals.naming_style.type_name(self.name),
                         Globals.naming_style.var_name(field.name),
-                        Globals.naming_style.type_name(field.ctype)
+                        Globals.naming_style.type_name(field.submsgname)
                     )
 
         return result
@@ -1617,10 +1964,404 @@ class Message(ProtoElement):
         if width == 1:
           width = 'AUTO'
 
-        result = 'PB_BIND(%s, %s, %s)\n' % (
-            Globals.naming_style.define_name(self.name),
-            Globals.naming_style.type_name(self.name),
-            width)
+        tags = sorted(field.tag for field in self.all_fields()
+                      if not isinstance(field, ExtensionRange))
+        structname = Globals.naming_style.type_name(self.name)
+
+        lookup_count = None
+        if self.tag_lookup and tags and tags[-1] < 4 * len(tags) + 64:
+            # Table is indexed directly by tag number, so it is only
+            # generated when the tag numbers are reasonably dense.
+            lookup_count = tags[-1] + 1
+
+        fast_fields = {}
+        if self.fast_decode:
+            fast_fields = dict((field.tag, field) for field in self.fields
+                               if not isinstance(field, (OneOf, ExtensionRange))
+                               and field.fast_decode_wiretype() is not None)
+
+        result = ''
+        if self.default_image_supported(dependencies):
+            # Used instead of setting each field to default with PB_DEFAULT_IMAGES
+            result += '#ifdef PB_DEFAULT_IMAGES\n'
+            result += 'static const %s %s_default_image = %s;\n' % (
+                structname, structname,
+                Globals.naming_style.define_name('%s_init_default' % self.name))
+            result += '#endif\n'
+
+        if lookup_count and fast_fields:
+            result += 'PB_BIND_LOOKUP_FAST(%s, %s, %s, %d, %d)\n' % (
+                Globals.naming_style.define_name(self.name),
+                structname, width, lookup_count, max(fast_fields) + 1)
+        elif lookup_count:
+            result += 'PB_BIND_LOOKUP(%s, %s, %s, %d)\n' % (
+                Globals.naming_style.define_name(self.name),
+                structname, width, lookup_count)
+        elif fast_fields:
+            result += 'PB_BIND_FAST(%s, %s, %s, %d)\n' % (
+                Globals.naming_style.define_name(self.name),
+                structname, width, max(fast_fields) + 1)
+        else:
+            result += 'PB_BIND(%s, %s, %s)\n' % (
+                Globals.naming_style.define_name(self.name),
+                structname, width)
+
+        if lookup_count:
+            result += '#ifdef PB_TAG_LOOKUP\n'
+            result += 'const pb_field_lookup_t %s_field_lookup[%d] = {\n' % (
+                structname, lookup_count)
+            entries = []
+            for tag in range(lookup_count):
+                if tag in tags:
+                    entries.append('    PB_FIELD_LOOKUP(%s, %d)' % (
+                        structname, tag))
+                else:
+                    entries.append('    PB_FIELD_LOOKUP_NONE')
+            result += ',\n'.join(entries)
+            result += '\n};\n'
+            result += '#endif\n'
+
+        if fast_fields:
+            count = max(fast_fields) + 1
+            result += '#ifdef PB_FAST_DECODE\n'
+            result += 'const pb_fast_field_t %s_fast_table[%d] = {\n' % (
+                structname, count)
+            entries = []
+            for tag in range(count):
+                if tag in fast_fields:
+                    field = fast_fields[tag]
+                    entries.append('    PB_FAST_FIELD(%s, %s, %s, %s, %d, %s)' % (
+                        structname, field.rules, field.pbtype,
+                        Globals.naming_style.var_name(field.name), tag,
+                        field.fast_decode_wiretype()))
+                else:
+                    entries.append('    PB_FAST_FIELD_NONE')
+            result += ',\n'.join(entries)
+            result += '\n};\n'
+            result += '#endif\n'
+
+        return result
+
+    def default_image_supported(self, dependencies):
+        '''Check if the structure initialized with MyMessage_init_default is
+        the same that pb_decode() would produce by setting each field to its
+        default, so that it can be copied as a whole. Callback fields are
+        never overwritten by the decoder, so they prevent this.'''
+        if not self.fields or self.desc is None:
+            # Empty messages and extension wrappers have no initializer
+            return False
+
+        for field in self.all_fields():
+            if field.has_callbacks() or field.pbtype == 'MSG_W_CB' or field.initializer is not None:
+                return False
+            if field.math_include_required:
+                # INFINITY and NAN are not available in C89, and lose the sign of NaN
+                return False
+            if field.allocation != 'STATIC':
+                continue
+            if field.rules in ('REPEATED', 'FIXARRAY', 'ONEOF'):
+                # Array and union contents are not initialized by the decoder
+                continue
+
+            if field.rules == 'OPTIONAL' and field.default_has:
+                return False
+            elif field.pbtype == 'MESSAGE':
+                submsg = dependencies.get(str(field.submsgname))
+                if submsg is None or not submsg.default_image_supported(dependencies):
+                    return False
+            elif field.pbtype in ('ENUM', 'UENUM') and field.default is None:
+                # The initializer uses the smallest value, the decoder the first one
+                enumtype = dependencies.get(str(field.ctype))
+                if not isinstance(enumtype, Enum) or not enumtype.values:
+                    return False
+                if enumtype.values[0][1] != min(v for n, v in enumtype.values):
+                    return False
+
+        return True
+
+    def decode_mask_definition(self, paths, name, dependencies, storage = ''):
+        '''Return the definition of a pb_field_mask_t constant that selects
+        the fields listed in paths. Paths through submessage fields generate
+        nested masks, which are defined before the mask that refers to them.'''
+        whole = set()
+        nested = {}
+        for path in paths:
+            fieldname, _, subpath = path.partition('.')
+            matches = [f for f in self.all_fields()
+                       if f.name == fieldname and not isinstance(f, ExtensionRange)]
+            if not matches:
+                raise Exception("decode_mask of message '%s' refers to unknown field '%s'." % (
+                                self.name, fieldname))
+
+            field = matches[0]
+            if not subpath:
+                whole.add(field.tag)
+            elif (field.pbtype != 'MESSAGE' or field.allocation != 'STATIC'
+                  or field.rules in ('REPEATED', 'ONEOF')):
+                raise Exception("decode_mask path '%s' of message '%s' continues past field '%s', "
+                                "but only static non-repeated submessage fields can have nested "
+                                "masks." % (path, self.name, fieldname))
+            else:
+                nested.setdefault(field.tag, []).append(subpath)
+
+        # Masks for submessages are indexed in the same order as submsg_info
+        sorted_fields = sorted(self.all_fields(), key = lambda x: x.tag)
+        submsg_fields = [f for f in sorted_fields if f.pbtype in ('MESSAGE', 'MSG_W_CB', 'MSG_STREAM')]
+
+        result = ''
+        submasks = []
+        for field in submsg_fields:
+            if field.tag in nested and field.tag not in whole:
+                subname = '%s_%s' % (name, Globals.naming_style.var_name(field.name))
+                submsg = dependencies[str(field.submsgname)]
+                result += submsg.decode_mask_definition(nested[field.tag], subname, dependencies, 'static ')
+                submasks.append('&' + subname)
+            else:
+                submasks.append('NULL')
+
+        words = [0] * (max(f.tag for f in sorted_fields) // 32 + 1)
+        for tag in whole.union(nested):
+            words[tag >> 5] |= 1 << (tag & 31)
+
+        result += 'static const uint32_t %s_tags[%d] = {%s};\n' % (
+            name, len(words), ', '.join('0x%08xU' % w for w in words))
+
+        if [m for m in submasks if m != 'NULL']:
+            result += 'static const pb_field_mask_t * const %s_submsgs[%d] = {%s};\n' % (
+                name, len(submasks), ', '.join(submasks))
+            result += '%sconst pb_field_mask_t %s = {%s_tags, %s_submsgs};\n' % (
+                storage, name, name, name)
+        else:
+            result += '%sconst pb_field_mask_t %s = {%s_tags, NULL};\n' % (
+                storage, name, name)
+
+        return result
+
+    def specialized_supported(self):
+        '''Check if specialized encoding and decoding functions can be
+        generated for this message. Unsupported fields cause a warning.'''
+        for field in self.all_fields():
+            if not field.specialized_supported():
+                sys.stderr.write('Warning: Field %s.%s is not supported by the specialize option, '
+                                 'no specialized functions will be generated.\n' % (self.name, field.name))
+                return False
+
+        if self.count_required_fields() > 32:
+            sys.stderr.write('Warning: Message %s has too many required fields for the specialize option, '
+                             'no specialized functions will be generated.\n' % self.name)
+            return False
+
+        return True
+
+    def specialized_names(self):
+        '''Return the names of the encode, decode and static decode_fields
+        functions generated with the specialize option.'''
+        return (Globals.naming_style.func_name('%s_encode' % self.name),
+                Globals.naming_style.func_name('%s_decode' % self.name),
+                Globals.naming_style.func_name('%s_decode_fields' % self.name))
+
+    def specialized_declaration(self):
+        '''Return prototypes of the specialized functions for the header file.'''
+        structname = Globals.naming_style.type_name(self.name)
+        encode, decode, decode_fields = self.specialized_names()
+        result = 'bool %s(pb_ostream_t *stream, const %s *msg);\n' % (encode, structname)
+        result += 'bool %s(pb_istream_t *stream, %s *msg);\n' % (decode, structname)
+        return result
+
+    def specialized_presence(self, field, has_defaults):
+        '''Return C condition for encoding a non-repeated field, or None if
+        the field is always encoded. Matches the checks in pb_encode.c.'''
+        member = field.specialized_member()
+        if field.rules == 'OPTIONAL':
+            return 'msg->has_%s' % Globals.naming_style.var_name(field.name)
+        elif field.rules == 'ONEOF':
+            return 'msg->which_%s == %d' % (Globals.naming_style.var_name(field.union_name), field.tag)
+        elif field.rules == 'SINGULAR' and not has_defaults:
+            if field.pbtype == 'STRING':
+                return "%s[0] != '\\0'" % member
+            elif field.pbtype == 'BYTES':
+                return '%s.size != 0' % member
+            elif field.pbtype in ('FLOAT', 'DOUBLE'):
+                # Negative zero must be encoded also
+                return 'has_nonzero_bytes(&%s, sizeof(%s))' % (member, member)
+            elif field.pbtype != 'FIXED_LENGTH_BYTES':
+                return '%s != 0' % member
+        return None
+
+    def specialized_definition(self, dependencies, specialized):
+        '''Return definitions of the specialized functions for the .pb.c file.
+        specialized is a dictionary of the messages in the same file that
+        have specialized functions, used for calling them for submessages.'''
+        structname = Globals.naming_style.type_name(self.name)
+        encode, decode, decode_fields = self.specialized_names()
+        has_defaults = bool(self.default_value(dependencies))
+        sorted_fields = sorted(self.all_fields(), key = lambda f: f.tag)
+
+        def indent(lines, level = 1):
+            return [line if line.startswith('#') or not line else '    ' * level + line
+                    for line in lines]
+
+        # Encoding function, fields are written in tag number order
+        # same as in pb_encode().
+        body = []
+        if any(field.rules == 'REPEATED' for field in sorted_fields):
+            body.append('pb_size_t i;')
+        if not sorted_fields:
+            body += ['PB_UNUSED(stream);', 'PB_UNUSED(msg);']
+
+        for field in sorted_fields:
+            member = field.specialized_member()
+            wiretype = wiretypes[field.pbtype]
+            tagline = ['if (!pb_encode_tag(stream, PB_WT_%s, %d))' % (wiretype, field.tag),
+                       '    return false;']
+
+            if field.rules == 'REPEATED':
+                count = 'msg->%s_count' % Globals.naming_style.var_name(field.name)
+                item = '%s[i]' % member
+                block = []
+                if wiretype != 'STRING':
+                    # Arrays of scalar values are always packed
+                    block += ['size_t size;',
+                              'if (%s > %d)' % (count, field.max_count),
+                              '    PB_RETURN_ERROR(stream, "array max size exceeded");',
+                              'if (!pb_encode_tag(stream, PB_WT_STRING, %d))' % field.tag,
+                              '    return false;']
+                    if wiretype == '32BIT':
+                        block += ['size = 4 * (size_t)%s;' % count]
+                    elif wiretype == '64BIT':
+                        block += ['size = 8 * (size_t)%s;' % count]
+                    else:
+                        block += ['{',
+                                  '    pb_ostream_t sizestream = PB_OSTREAM_SIZING;',
+                                  '    for (i = 0; i < %s; i++)' % count,
+                                  '    {']
+                        block += indent(field.specialized_encode(item, '&sizestream',
+                                    'PB_RETURN_ERROR(stream, PB_GET_ERROR(&sizestream));', specialized), 2)
+                        block += ['    }',
+                                  '    size = sizestream.bytes_written;',
+                                  '}']
+                    block += ['if (!pb_encode_varint(stream, (pb_uint64_t)size))',
+                              '    return false;',
+                              'for (i = 0; i < %s; i++)' % count,
+                              '{']
+                    block += indent(field.specialized_encode(item, 'stream', 'return false;', specialized))
+                    block += ['}']
+                else:
+                    block += ['if (%s > %d)' % (count, field.max_count),
+                              '    PB_RETURN_ERROR(stream, "array max size exceeded");',
+                              'for (i = 0; i < %s; i++)' % count,
+                              '{']
+                    block += indent(tagline + field.specialized_encode(item, 'stream', 'return false;', specialized))
+                    block += ['}']
+                condition = '%s > 0' % count
+            else:
+                block = tagline + field.specialized_encode(member, 'stream', 'return false;', specialized)
+                condition = self.specialized_presence(field, has_defaults)
+
+            body.append('')
+            if condition:
+                body += ['if (%s)' % condition, '{'] + indent(block) + ['}']
+            else:
+                body += block
+
+        result = 'bool %s(pb_ostream_t *stream, const %s *msg)\n{\n' % (encode, structname)
+        result += '\n'.join(indent(body)).lstrip('\n') + '\n'
+        result += '\n    return true;\n}\n\n'
+
+        # Decoding function, fields can come in any order.
+        cases = []
+        required_count = 0
+        for field in sorted_fields:
+            name = Globals.naming_style.var_name(field.name)
+            member = field.specialized_member()
+            wiretype = wiretypes[field.pbtype]
+            wirecheck = ['if (wire_type != PB_WT_%s)' % wiretype,
+                         '    PB_RETURN_ERROR(stream, "wrong wire type");']
+            body = []
+
+            if field.rules == 'REPEATED':
+                count = 'msg->%s_count' % name
+                item = '%s[%s]' % (member, count)
+                if wiretype != 'STRING':
+                    # Accept both packed and unpacked arrays
+                    body += ['if (wire_type == PB_WT_STRING)',
+                             '{',
+                             '    pb_istream_t substream;',
+                             '    if (!pb_make_string_substream(stream, &substream))',
+                             '        return false;',
+                             '    while (substream.bytes_left > 0 && %s < %d)' % (count, field.max_count),
+                             '    {']
+                    body += indent(field.specialized_decode(item, '&substream',
+                                'PB_RETURN_ERROR(stream, PB_GET_ERROR(&substream));', specialized), 2)
+                    body += ['        %s++;' % count,
+                             '    }',
+                             '    if (substream.bytes_left != 0)',
+                             '        PB_RETURN_ERROR(stream, "array overflow");',
+                             '    if (!pb_close_string_substream(stream, &substream))',
+                             '        return false;',
+                             '    break;',
+                             '}']
+                body += wirecheck
+                body += ['if (%s >= %d)' % (count, field.max_count),
+                         '    PB_RETURN_ERROR(stream, "array overflow");']
+                body += field.specialized_decode(item, 'stream', 'return false;', specialized)
+                body += ['%s++;' % count]
+            elif field.rules == 'ONEOF':
+                which = 'msg->which_%s' % Globals.naming_style.var_name(field.union_name)
+                # Submessage is initialized when the oneof changes to it
+                init = '%s != %d' % (which, field.tag)
+                body += wirecheck
+                body += field.specialized_decode(member, 'stream', 'return false;', specialized, init)
+                body += ['%s = %d;' % (which, field.tag)]
+            else:
+                body += wirecheck
+                body += field.specialized_decode(member, 'stream', 'return false;', specialized, False)
+                if field.rules == 'OPTIONAL':
+                    body += ['msg->has_%s = true;' % name]
+                elif field.rules == 'REQUIRED':
+                    body += ['required_seen |= (uint32_t)1 << %d;' % required_count]
+                    required_count += 1
+
+            cases += ['case %d:' % field.tag] + indent(body) + ['    break;', '']
+
+        cases += ['case 0:',
+                  '    PB_RETURN_ERROR(stream, "zero tag");',
+                  '',
+                  'default:',
+                  '    if (!pb_skip_field(stream, wire_type))',
+                  '        return false;',
+                  '    break;']
+
+        result += 'static bool %s(pb_istream_t *stream, %s *msg)\n{\n' % (decode_fields, structname)
+        result += '    uint32_t tag;\n'
+        result += '    pb_wire_type_t wire_type;\n'
+        result += '    bool eof;\n'
+        if required_count:
+            result += '    uint32_t required_seen = 0;\n'
+        if not sorted_fields:
+            result += '    PB_UNUSED(msg);\n'
+        result += '\n'
+        result += '    while (pb_decode_tag(stream, &wire_type, &tag, &eof))\n'
+        result += '    {\n'
+        result += '        switch (tag)\n'
+        result += '        {\n'
+        result += '\n'.join(line.rstrip() for line in indent(cases, 3)) + '\n'
+        result += '        }\n'
+        result += '    }\n\n'
+        result += '    if (!eof)\n'
+        result += '        return false;\n\n'
+        if required_count:
+            result += '    if (required_seen != 0x%xu)\n' % ((1 << required_count) - 1)
+            result += '        PB_RETURN_ERROR(stream, "missing required field");\n\n'
+        result += '    return true;\n'
+        result += '}\n\n'
+
+        result += 'bool %s(pb_istream_t *stream, %s *msg)\n{\n' % (decode, structname)
+        result += '    static const %s init = %s;\n' % (structname,
+                    Globals.naming_style.define_name('%s_init_default' % self.name))
+        result += '    *msg = init;\n'
+        result += '    return %s(stream, msg);\n' % decode_fields
+        result += '}\n'
         return result
 
     def required_descriptor_width(self, dependencies):
@@ -2186,8 +2927,18 @@ class ProtoFile:
                 yield msg.fields_declaration(self.dependencies) + '\n'
             for msg in self.messages:
                 yield 'extern const pb_msgdesc_t %s_msg;\n' % Globals.naming_style.type_name(msg.name)
+            for msg in self.messages:
+                if msg.decode_mask:
+                    yield 'extern const pb_field_mask_t %s_decode_mask;\n' % Globals.naming_style.type_name(msg.name)
             yield '\n'
 
+            if [msg for msg in self.messages if msg.specialize]:
+                yield '/* Specialized encoding and decoding functions (with "specialize" option) */\n'
+                for msg in self.messages:
+                    if msg.specialize:
+                        yield msg.specialized_declaration()
+                yield '\n'
+
             yield '/* Defines for backwards compatibility with code written before nanopb-0.4.0 */\n'
             for msg in self.messages:
               yield '#define %s &%s_msg\n' % (
@@ -2313,6 +3064,15 @@ class ProtoFile:
         yield options.genformat % (headername)
         yield '\n'
 
+        specialized = [msg for msg in self.messages if msg.specialize]
+        if specialized:
+            for libheader in ('pb_encode.h', 'pb_decode.h', 'pb_common.h'):
+                try:
+                    yield options.libformat % libheader
+                except TypeError:
+                    yield '#include <%s>' % libheader
+                yield '\n'
+
         if Globals.protoc_insertion_points:
             yield '/* @@protoc_insertion_point(includes) */\n'
 
@@ -2343,6 +3103,78 @@ class ProtoFile:
         for ext in self.extensions:
             yield ext.extension_def(self.dependencies) + '\n'
 
+        # Generate field masks for pb_decode_masked() if decode_mask option
+        # is defined
+        masked = [msg for msg in self.messages if msg.decode_mask]
+        if masked:
+            yield '/* Field masks for pb_decode_masked() (with "decode_mask" option) */\n'
+            for msg in masked:
+                yield msg.decode_mask_definition(msg.decode_mask,
+                    '%s_decode_mask' % Globals.naming_style.type_name(msg.name),
+                    self.dependencies) + '\n'
+
+        # Generate Message_encode() and Message_decode() functions if
+        # specialize option is defined
+        if specialized:
+            yield '/* Specialized encoding and decoding functions (with "specialize" option) */\n'
+            yield '#ifdef PB_WITHOUT_64BIT\n'
+            yield '#define pb_int64_t int32_t\n'
+            yield '#define pb_uint64_t uint32_t\n'
+            yield '#else\n'
+            yield '#define pb_int64_t int64_t\n'
+            yield '#define pb_uint64_t uint64_t\n'
+            yield '#endif\n\n'
+
+            conditions = [msg.specialized_presence(field, bool(msg.default_value(self.dependencies)))
+                          for msg in specialized for field in msg.all_fields()]
+            if [c for c in conditions if c and c.startswith('has_nonzero_bytes')]:
+                yield '/* Check for non-zero proto3 float values, including negative zero */\n'
+                yield 'static bool has_nonzero_bytes(const void *data, size_t size)\n'
+                yield '{\n'
+                yield '    const pb_byte_t *p = (const pb_byte_t*)data;\n'
+                yield '    while (size-- > 0)\n'
+                yield '    {\n'
+                yield '        if (*p++ != 0)\n'
+                yield '            return true;\n'
+                yield '    }\n'
+                yield '    return false;\n'
+                yield '}\n\n'
+
+            if [f for msg in specialized for f in msg.all_fields() if f.pbtype in ('INT32', 'ENUM')]:
+                yield '/* Negative int32 and enum values are sign extended to 64 bits,\n'
+                yield ' * same as in pb_encode.c */\n'
+                yield '#ifdef PB_WITHOUT_64BIT\n'
+                yield 'static bool encode_int32_varint(pb_ostream_t *stream, int32_t value)\n'
+                yield '{\n'
+                yield '    pb_byte_t bytes[10];\n'
+                yield '    uint32_t low = (uint32_t)value;\n'
+                yield '    int i;\n'
+                yield '    if (value >= 0)\n'
+                yield '        return pb_encode_varint(stream, low);\n'
+                yield '    for (i = 0; i < 4; i++)\n'
+                yield '    {\n'
+                yield '        bytes[i] = (pb_byte_t)((low & 0x7F) | 0x80);\n'
+                yield '        low >>= 7;\n'
+                yield '    }\n'
+                yield '    bytes[4] = (pb_byte_t)(low | 0xF0);\n'
+                yield '    bytes[5] = bytes[6] = bytes[7] = bytes[8] = 0xFF;\n'
+                yield '    bytes[9] = 0x01;\n'
+                yield '    return pb_write(stream, bytes, 10);\n'
+                yield '}\n'
+                yield '#else\n'
+                yield '#define encode_int32_varint(stream, value) \\\n'
+                yield '    pb_encode_varint(stream, (pb_uint64_t)(pb_int64_t)(value))\n'
+                yield '#endif\n\n'
+
+            for msg in specialized:
+                yield 'static bool %s(pb_istream_t *stream, %s *msg);\n' % (
+                    msg.specialized_names()[2], Globals.naming_style.type_name(msg.name))
+            yield '\n'
+
+            specialized_names = dict((str(msg.name), msg) for msg in specialized)
+            for msg in specialized:
+                yield msg.specialized_definition(self.dependencies, specialized_names) + '\n'
+
         # Generate enum_name function if enum_to_string option is defined
         for enum in self.enums:
             yield enum.enum_to_string_definition() + '\n'
@@ -2379,6 +3211,19 @@ class ProtoFile:
             yield 'PB_STATIC_ASSERT(sizeof(double) == 8, DOUBLE_MUST_BE_8_BYTES)\n'
             yield '#endif\n'
 
+        # Add check that element buffers of streaming fields follow the callbacks
+        streaming = [(msg, field) for msg in self.messages
+                     for field in msg.all_fields() if field.pbtype == 'MSG_STREAM']
+        if streaming:
+            yield '\n'
+            yield '/* The decoder finds the element buffer of a streaming field right\n'
+            yield ' * after its pb_stream_callback_t. */\n'
+            for msg, field in streaming:
+                structname = Globals.naming_style.type_name(msg.name)
+                name = Globals.naming_style.var_name(field.name)
+                yield 'PB_STATIC_ASSERT(offsetof(%s, %s_item) == offsetof(%s, %s) + sizeof(pb_stream_callback_t), STREAMING_BUFFER_MUST_FOLLOW_CALLBACK)\n' % (
+                    structname, name, structname, name)
+
         yield '\n'
 
         if Globals.protoc_insertion_points:
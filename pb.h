@@ -13,6 +13,10 @@
 /* Enable support for dynamically allocated fields */
 /* #define PB_ENABLE_MALLOC 1 */
 
+/* Allow decoding pointer fields into a caller-provided memory arena
+ * instead of allocating them one by one. Requires PB_ENABLE_MALLOC. */
+/* #define PB_ENABLE_ARENA 1 */
+
 /* Define this if your CPU / compiler combination does not support
  * unaligned memory access to packed structures. Note that packed
  * structures are only used when requested in .proto options. */
@@ -55,6 +59,32 @@
  * Normally it is automatically detected based on __BYTE_ORDER__ macro. */
 /* #define PB_LITTLE_ENDIAN_8BIT 1 */
 
+/* Store field descriptors also in an unpacked format that can be
+ * used directly, trading flash space for faster field iteration. */
+/* #define PB_DESCRIPTOR_UNPACKED 1 */
+
+/* Store the encoded tag bytes of each field in the descriptors, so that
+ * the encoder can copy them instead of computing the tag every time. */
+/* #define PB_PRECOMPUTED_TAGS 1 */
+
+/* Use the tag number lookup tables generated by the tag_lookup option
+ * to find fields in constant time. Without this, the tables are left
+ * out of the .pb.c files and fields are searched linearly. */
+/* #define PB_TAG_LOOKUP 1 */
+
+/* Decode scalar fields through the tables generated by the fast_decode
+ * option. Without this, the tables are left out of the .pb.c files. */
+/* #define PB_FAST_DECODE 1 */
+
+/* Store a default-initialized copy of each message structure, so that
+ * pb_decode() can initialize messages with memcpy() instead of setting
+ * each field separately. Costs flash space equal to the structure sizes. */
+/* #define PB_DEFAULT_IMAGES 1 */
+
+/* Add pb_encode_ex_cached(), which stores submessage sizes in a caller
+ * provided array so that they are only computed once per encoding. */
+/* #define PB_ENCODE_SIZE_CACHE 1 */
+
 /* Configure static assert mechanism. Instead of changing these, set your
  * compiler to C11 standard mode if possible. */
 /* #define PB_C99_STATIC_ASSERT 1 */
@@ -234,6 +264,10 @@ PB_STATIC_ASSERT(1, STATIC_ASSERT_IS_NOT_WORKING)
 #error You should not lower PB_MAX_REQUIRED_FIELDS from the default value (64).
 #endif
 
+#if defined(PB_ENABLE_ARENA) && !defined(PB_ENABLE_MALLOC)
+#error PB_ENABLE_ARENA requires PB_ENABLE_MALLOC.
+#endif
+
 #ifdef PB_WITHOUT_64BIT
 #ifdef PB_CONVERT_DOUBLE_FLOAT
 /* Cannot use doubles without 64-bit types */
@@ -299,8 +333,20 @@ typedef pb_byte_t pb_type_t;
  * pb_byte_t[data_size] rather than pb_bytes_array_t. */
 #define PB_LTYPE_FIXED_LENGTH_BYTES 0x0BU
 
+/* String or bytes referencing the input buffer.
+ * The field is a pb_view_t, which is pointed to the data in the
+ * input buffer when decoding. Requires a memory buffer stream.
+ * String views are not checked with PB_VALIDATE_UTF8. */
+#define PB_LTYPE_VIEW 0x0CU
+
+/* Repeated submessage decoded one element at a time
+ * The field is a pb_stream_callback_t, followed in the structure by a
+ * buffer for a single element. Used only with PB_ATYPE_CALLBACK.
+ * submsg_fields is pointer to field descriptions */
+#define PB_LTYPE_SUBMSG_STREAM 0x0DU
+
 /* Number of declared LTYPES */
-#define PB_LTYPES_COUNT 0x0CU
+#define PB_LTYPES_COUNT 0x0EU
 #define PB_LTYPE_MASK 0x0FU
 
 /**** Field repetition rules ****/
@@ -324,7 +370,8 @@ typedef pb_byte_t pb_type_t;
 #define PB_HTYPE(x) ((x) & PB_HTYPE_MASK)
 #define PB_LTYPE(x) ((x) & PB_LTYPE_MASK)
 #define PB_LTYPE_IS_SUBMSG(x) (PB_LTYPE(x) == PB_LTYPE_SUBMESSAGE || \
-                               PB_LTYPE(x) == PB_LTYPE_SUBMSG_W_CB)
+                               PB_LTYPE(x) == PB_LTYPE_SUBMSG_W_CB || \
+                               PB_LTYPE(x) == PB_LTYPE_SUBMSG_STREAM)
 
 /* Data type used for storing sizes of struct fields
  * and array counts.
@@ -343,6 +390,73 @@ typedef struct pb_istream_s pb_istream_t;
 typedef struct pb_ostream_s pb_ostream_t;
 typedef struct pb_field_iter_s pb_field_iter_t;
 
+/* Optional tag number lookup table entry, generated when the
+ * tag_lookup option is enabled. The table is indexed by tag number
+ * and stores the iterator position of the corresponding field.
+ * Unused tag numbers have index set to PB_SIZE_MAX.
+ */
+typedef struct pb_field_lookup_s pb_field_lookup_t;
+struct pb_field_lookup_s {
+    pb_size_t index;
+    pb_size_t field_info_index;
+    pb_size_t required_field_index;
+    pb_size_t submessage_index;
+};
+
+/* Optional fast decoding table entry, generated when the fast_decode
+ * option is enabled. The table is indexed by tag number and covers the
+ * tags that fit in a single byte together with the wire type. Entries
+ * exist for static scalar fields that are not repeated or in a oneof,
+ * and the decoder handles them without searching the field descriptor.
+ * Unused entries have tag_byte set to 0.
+ */
+typedef struct pb_fast_field_s pb_fast_field_t;
+struct pb_fast_field_s {
+    uint32_t data_offset;
+    pb_size_t required_field_index;
+    pb_byte_t tag_byte;         /* (tag << 3) | wire type */
+    pb_type_t type;
+    pb_byte_t data_size;
+    int_least8_t size_offset;   /* Offset of has_ field, 0 if none */
+};
+#define PB_FAST_TABLE_MAX_COUNT 16
+
+#ifdef PB_DESCRIPTOR_UNPACKED
+/* Field information in unpacked format, generated for each field
+ * when PB_DESCRIPTOR_UNPACKED is defined. */
+typedef struct pb_field_desc_s pb_field_desc_t;
+struct pb_field_desc_s {
+    uint32_t data_offset;
+    pb_size_t tag;
+    pb_size_t data_size;
+    pb_size_t array_size;
+    pb_size_t required_field_index;
+    pb_size_t submessage_index;
+    pb_type_t type;
+    int_least8_t size_offset;
+};
+#endif
+
+#ifdef PB_PRECOMPUTED_TAGS
+/* Tag of a field already encoded as varint of (tag << 3) | wire type,
+ * generated for each field when PB_PRECOMPUTED_TAGS is defined. */
+typedef struct pb_field_tag_s pb_field_tag_t;
+struct pb_field_tag_s {
+    pb_byte_t size;
+    pb_byte_t bytes[5];
+};
+#endif
+
+/* Set of fields to decode with pb_decode_masked(), generated by the
+ * decode_mask option. Bit (tag & 31) of tags[tag >> 5] selects a field.
+ * For submessage fields, submsgs is indexed by the submessage index and
+ * gives the mask to use inside the submessage, NULL to decode all of it. */
+typedef struct pb_field_mask_s pb_field_mask_t;
+struct pb_field_mask_s {
+    const uint32_t *tags;
+    const pb_field_mask_t * const *submsgs;
+};
+
 /* This structure is used in auto-generated constants
  * to specify struct fields.
  */
@@ -357,6 +471,32 @@ struct pb_msgdesc_s {
     pb_size_t field_count;
     pb_size_t required_field_count;
     pb_size_t largest_tag;
+
+#ifdef PB_TAG_LOOKUP
+    /* Tag lookup table, or NULL if not generated */
+    const pb_field_lookup_t *field_lookup;
+    pb_size_t field_lookup_count;
+#endif
+
+#ifdef PB_FAST_DECODE
+    /* Fast decoding table, or NULL if not generated */
+    const pb_fast_field_t *fast_table;
+    pb_size_t fast_table_count;
+#endif
+
+#ifdef PB_DESCRIPTOR_UNPACKED
+    const pb_field_desc_t *field_desc;
+#endif
+
+#ifdef PB_PRECOMPUTED_TAGS
+    const pb_field_tag_t *field_tags;
+#endif
+
+#ifdef PB_DEFAULT_IMAGES
+    /* Initialized structure, or NULL if the message has callback fields */
+    const void *default_image;
+    size_t default_image_size;
+#endif
 };
 
 /* Iterator for message descriptor */
@@ -365,7 +505,7 @@ struct pb_field_iter_s {
     void *message;                   /* Pointer to start of the structure */
 
     pb_size_t index;                 /* Index of the field */
-    pb_size_t field_info_index;      /* Index to descriptor->field_info array */
+    pb_size_t field_info_index;      /* Index to descriptor->field_info array, not used with PB_DESCRIPTOR_UNPACKED */
     pb_size_t required_field_index;  /* Index that counts only the required fields */
     pb_size_t submessage_index;      /* Index that counts only submessages */
 
@@ -408,6 +548,17 @@ struct pb_bytes_array_s {
 };
 typedef struct pb_bytes_array_s pb_bytes_array_t;
 
+/* This structure is used for FT_VIEW string and bytes fields.
+ * After decoding, it points directly to the data in the input buffer,
+ * which must remain valid for as long as the message is used.
+ * The data is not null-terminated.
+ */
+struct pb_view_s {
+    const pb_byte_t *bytes;
+    size_t size;
+};
+typedef struct pb_view_s pb_view_t;
+
 /* This structure is used for giving the callback function.
  * It is stored in the message structure and filled in by the method that
  * calls pb_decode.
@@ -440,6 +591,26 @@ struct pb_callback_s {
     void *arg;
 };
 
+/* Callback for a repeated submessage field with the streaming option.
+ * The decoder decodes each element into the element buffer that follows
+ * this structure in the message, and then calls the decode function with
+ * a pointer to it. The buffer is reused for the next element, so the
+ * function must copy any data it wants to keep. Each element is still
+ * initialized to defaults and decoded like a normal submessage.
+ *
+ * The encode function works the same as in pb_callback_t.
+ */
+typedef struct pb_stream_callback_s pb_stream_callback_t;
+struct pb_stream_callback_s {
+    union {
+        bool (*decode)(const pb_field_t *field, void *item, void **arg);
+        bool (*encode)(pb_ostream_t *stream, const pb_field_t *field, void * const *arg);
+    } funcs;
+
+    /* Free arg for use by callback */
+    void *arg;
+};
+
 extern bool pb_default_field_callback(pb_istream_t *istream, pb_ostream_t *ostream, const pb_field_t *field);
 
 /* Wire types. Library user needs these only in encoder callbacks. */
@@ -528,12 +699,50 @@ struct pb_extension_s {
 #define PB_EXPAND(x) x
 
 /* Binding of a message field set into a specific structure */
+#ifdef PB_DESCRIPTOR_UNPACKED
 #define PB_BIND(msgname, structname, width) \
+    PB_GEN_FIELD_POSITIONS(msgname, structname, width) \
+    PB_BIND_DESCRIPTOR(msgname, structname, width, NULL, 0, NULL, 0)
+#else
+#define PB_BIND(msgname, structname, width) \
+    PB_BIND_DESCRIPTOR(msgname, structname, width, NULL, 0, NULL, 0)
+#endif
+
+/* Binding with a tag number lookup table for faster field search.
+ * The table itself is defined separately as structname_field_lookup[],
+ * with an entry of PB_FIELD_LOOKUP(structname, tag) for each field and
+ * PB_FIELD_LOOKUP_NONE for unused tag numbers. The table is only used
+ * when PB_TAG_LOOKUP is defined. */
+#define PB_BIND_LOOKUP(msgname, structname, width, lookup_count) \
+    PB_GEN_FIELD_POSITIONS(msgname, structname, width) \
+    extern const pb_field_lookup_t structname ## _field_lookup[lookup_count]; \
+    PB_BIND_DESCRIPTOR(msgname, structname, width, structname ## _field_lookup, lookup_count, NULL, 0)
+
+/* Binding with a fast decoding table, defined separately as
+ * structname_fast_table[], with an entry of PB_FAST_FIELD(...) for
+ * each eligible field and PB_FAST_FIELD_NONE for other tag numbers.
+ * The table is only used when PB_FAST_DECODE is defined.
+ * PB_BIND_LOOKUP_FAST() generates both tables. */
+#define PB_BIND_FAST(msgname, structname, width, fast_count) \
+    PB_GEN_FIELD_POSITIONS(msgname, structname, width) \
+    extern const pb_fast_field_t structname ## _fast_table[fast_count]; \
+    PB_BIND_DESCRIPTOR(msgname, structname, width, NULL, 0, structname ## _fast_table, fast_count)
+
+#define PB_BIND_LOOKUP_FAST(msgname, structname, width, lookup_count, fast_count) \
+    PB_GEN_FIELD_POSITIONS(msgname, structname, width) \
+    extern const pb_field_lookup_t structname ## _field_lookup[lookup_count]; \
+    extern const pb_fast_field_t structname ## _fast_table[fast_count]; \
+    PB_BIND_DESCRIPTOR(msgname, structname, width, structname ## _field_lookup, lookup_count, \
+                       structname ## _fast_table, fast_count)
+
+#define PB_BIND_DESCRIPTOR(msgname, structname, width, lookup, lookup_count, fast, fast_count) \
     const uint32_t structname ## _field_info[] PB_PROGMEM = \
     { \
         msgname ## _FIELDLIST(PB_GEN_FIELD_INFO_ ## width, structname) \
         0 \
     }; \
+    PB_GEN_FIELD_DESC_ARRAY(msgname, structname) \
+    PB_GEN_FIELD_TAGS_ARRAY(msgname, structname) \
     const pb_msgdesc_t* const structname ## _submsg_info[] = \
     { \
         msgname ## _FIELDLIST(PB_GEN_SUBMSG_INFO, structname) \
@@ -548,9 +757,144 @@ struct pb_extension_s {
        0 msgname ## _FIELDLIST(PB_GEN_FIELD_COUNT, structname), \
        0 msgname ## _FIELDLIST(PB_GEN_REQ_FIELD_COUNT, structname), \
        0 msgname ## _FIELDLIST(PB_GEN_LARGEST_TAG, structname), \
+       PB_GEN_FIELD_LOOKUP_POINTER(lookup, lookup_count) \
+       PB_GEN_FAST_TABLE_POINTER(fast, fast_count) \
+       PB_GEN_FIELD_DESC_POINTER(structname) \
+       PB_GEN_FIELD_TAGS_POINTER(structname) \
+       PB_GEN_DEFAULT_IMAGE_POINTER(msgname, structname) \
     }; \
     msgname ## _FIELDLIST(PB_GEN_FIELD_INFO_ASSERT_ ## width, structname)
 
+/* Tag lookup table, only referenced from the descriptor when
+ * PB_TAG_LOOKUP is defined. */
+#ifdef PB_TAG_LOOKUP
+#define PB_GEN_FIELD_LOOKUP_POINTER(lookup, lookup_count) lookup, lookup_count,
+#else
+#define PB_GEN_FIELD_LOOKUP_POINTER(lookup, lookup_count)
+#endif
+
+/* Entries of the structname_field_lookup[] array */
+#define PB_FIELD_LOOKUP(structname, tag) \
+    {(pb_size_t)structname ## _index_ ## tag, \
+     (pb_size_t)structname ## _field_info_index_ ## tag, \
+     (pb_size_t)structname ## _required_field_index_ ## tag, \
+     (pb_size_t)structname ## _submessage_index_ ## tag}
+#define PB_FIELD_LOOKUP_NONE {PB_SIZE_MAX, 0, 0, 0}
+
+/* Fast decoding table, only referenced from the descriptor when
+ * PB_FAST_DECODE is defined. */
+#ifdef PB_FAST_DECODE
+#define PB_GEN_FAST_TABLE_POINTER(fast, fast_count) fast, fast_count,
+#else
+#define PB_GEN_FAST_TABLE_POINTER(fast, fast_count)
+#endif
+
+/* Entries of the structname_fast_table[] array. htype is REQUIRED,
+ * OPTIONAL or SINGULAR and wiretype is VARINT, 32BIT or 64BIT. */
+#define PB_FAST_FIELD(structname, htype, ltype, fieldname, tag, wiretype) \
+    {(uint32_t)offsetof(structname, fieldname), \
+     (pb_size_t)structname ## _required_field_index_ ## tag, \
+     (pb_byte_t)(((tag) << 3) | PB_WT_ ## wiretype), \
+     (pb_type_t)(PB_ATYPE_STATIC | PB_HTYPE_ ## htype | PB_LTYPE_MAP_ ## ltype), \
+     (pb_byte_t)pb_membersize(structname, fieldname), \
+     (int_least8_t)PB_SIZE_OFFSET_STATIC(_PB_HTYPE_ ## htype, structname, fieldname)}
+#define PB_FAST_FIELD_NONE {0, 0, 0, 0, 0, 0}
+
+/* Enum values giving the iterator position of each field, named
+ * after the pb_field_iter_t members and the field tag number. */
+#define PB_GEN_FIELD_POSITIONS(msgname, structname, width) \
+    enum { msgname ## _FIELDLIST(PB_GEN_POSITION_INDEX, structname) \
+           structname ## _index_end }; \
+    enum { msgname ## _FIELDLIST(PB_GEN_POSITION_FIELD_INFO_ ## width, structname) \
+           structname ## _field_info_index_end }; \
+    enum { msgname ## _FIELDLIST(PB_GEN_POSITION_REQUIRED, structname) \
+           structname ## _required_field_index_end }; \
+    enum { msgname ## _FIELDLIST(PB_GEN_POSITION_SUBMSG, structname) \
+           structname ## _submessage_index_end };
+
+/* X-macros for the position enums. Each field gets a pair of
+ * enumerators, where the second one is placed so that the next
+ * field continues from the position following this field. */
+#define PB_GEN_POSITION_INDEX(structname, atype, htype, ltype, fieldname, tag) \
+    structname ## _index_ ## tag,
+#define PB_GEN_POSITION_REQUIRED(structname, atype, htype, ltype, fieldname, tag) \
+    PB_GEN_POSITION_STEP(structname ## _required_field_index_ ## tag, \
+                         (PB_HTYPE_ ## htype == PB_HTYPE_REQUIRED))
+#define PB_GEN_POSITION_SUBMSG(structname, atype, htype, ltype, fieldname, tag) \
+    PB_GEN_POSITION_STEP(structname ## _submessage_index_ ## tag, \
+                         PB_LTYPE_IS_SUBMSG(PB_LTYPE_MAP_ ## ltype))
+#define PB_GEN_POSITION_FIELD_INFO_1(structname, atype, htype, ltype, fieldname, tag) \
+    PB_GEN_POSITION_STEP(structname ## _field_info_index_ ## tag, 1)
+#define PB_GEN_POSITION_FIELD_INFO_2(structname, atype, htype, ltype, fieldname, tag) \
+    PB_GEN_POSITION_STEP(structname ## _field_info_index_ ## tag, 2)
+#define PB_GEN_POSITION_FIELD_INFO_4(structname, atype, htype, ltype, fieldname, tag) \
+    PB_GEN_POSITION_STEP(structname ## _field_info_index_ ## tag, 4)
+#define PB_GEN_POSITION_FIELD_INFO_8(structname, atype, htype, ltype, fieldname, tag) \
+    PB_GEN_POSITION_STEP(structname ## _field_info_index_ ## tag, 8)
+#define PB_GEN_POSITION_FIELD_INFO_AUTO(structname, atype, htype, ltype, fieldname, tag) \
+    PB_GEN_POSITION_STEP(structname ## _field_info_index_ ## tag, \
+        PB_FIELDINFO_WIDTH_AUTO(_PB_ATYPE_ ## atype, _PB_HTYPE_ ## htype, _PB_LTYPE_ ## ltype))
+#define PB_GEN_POSITION_STEP(name, step) \
+    name, name ## _next = name + (step) - 1,
+
+/* Unpacked field descriptor array, terminated by an all-zero entry. */
+#ifdef PB_DESCRIPTOR_UNPACKED
+#define PB_GEN_FIELD_DESC_ARRAY(msgname, structname) \
+    const pb_field_desc_t structname ## _field_desc[] = \
+    { \
+        msgname ## _FIELDLIST(PB_GEN_FIELD_DESC, structname) \
+        {0, 0, 0, 0, 0, 0, 0, 0} \
+    };
+#define PB_GEN_FIELD_DESC_POINTER(structname) structname ## _field_desc,
+#define PB_GEN_FIELD_DESC(structname, atype, htype, ltype, fieldname, tag) \
+    {(uint32_t)PB_DATA_OFFSET_ ## atype(_PB_HTYPE_ ## htype, structname, fieldname), \
+     (pb_size_t)tag, \
+     (pb_size_t)PB_DATA_SIZE_ ## atype(_PB_HTYPE_ ## htype, structname, fieldname), \
+     (pb_size_t)PB_ARRAY_SIZE_ ## atype(_PB_HTYPE_ ## htype, structname, fieldname), \
+     (pb_size_t)structname ## _required_field_index_ ## tag, \
+     (pb_size_t)structname ## _submessage_index_ ## tag, \
+     (pb_type_t)(PB_ATYPE_ ## atype | PB_HTYPE_ ## htype | PB_LTYPE_MAP_ ## ltype), \
+     (int_least8_t)PB_SIZE_OFFSET_ ## atype(_PB_HTYPE_ ## htype, structname, fieldname)},
+#else
+#define PB_GEN_FIELD_DESC_ARRAY(msgname, structname)
+#define PB_GEN_FIELD_DESC_POINTER(structname)
+#endif
+
+/* Precomputed tag array, with one entry per field. */
+#ifdef PB_PRECOMPUTED_TAGS
+#define PB_GEN_FIELD_TAGS_ARRAY(msgname, structname) \
+    const pb_field_tag_t structname ## _field_tags[] = \
+    { \
+        msgname ## _FIELDLIST(PB_GEN_FIELD_TAG, structname) \
+        {0, {0, 0, 0, 0, 0}} \
+    };
+#define PB_GEN_FIELD_TAGS_POINTER(structname) structname ## _field_tags,
+#define PB_GEN_FIELD_TAG(structname, atype, htype, ltype, fieldname, tag) \
+    PB_FIELD_TAG_BYTES(((uint32_t)(tag) << 3) | (uint32_t)PB_WT_FROM_LTYPE(PB_LTYPE_MAP_ ## ltype)),
+#define PB_FIELD_TAG_BYTES(v) \
+    {(pb_byte_t)(1 + ((v) >> 7 != 0) + ((v) >> 14 != 0) + ((v) >> 21 != 0) + ((v) >> 28 != 0)), \
+     {PB_FIELD_TAG_BYTE(v, 0), PB_FIELD_TAG_BYTE(v, 7), PB_FIELD_TAG_BYTE(v, 14), \
+      PB_FIELD_TAG_BYTE(v, 21), (pb_byte_t)((v) >> 28)}}
+#define PB_FIELD_TAG_BYTE(v, shift) \
+    (pb_byte_t)((((v) >> (shift)) & 0x7F) | ((v) >> ((shift) + 7) != 0 ? 0x80 : 0))
+#define PB_WT_FROM_LTYPE(ltype) \
+    ((ltype) <= PB_LTYPE_SVARINT ? PB_WT_VARINT : \
+     (ltype) == PB_LTYPE_FIXED32 ? PB_WT_32BIT : \
+     (ltype) == PB_LTYPE_FIXED64 ? PB_WT_64BIT : PB_WT_STRING)
+#else
+#define PB_GEN_FIELD_TAGS_ARRAY(msgname, structname)
+#define PB_GEN_FIELD_TAGS_POINTER(structname)
+#endif
+
+/* Default structure image, defined by the generator in the .pb.c file
+ * and referred to by the msgname_DEFAULT_IMAGE define. */
+#ifdef PB_DEFAULT_IMAGES
+#define PB_GEN_DEFAULT_IMAGE_POINTER(msgname, structname) \
+    msgname ## _DEFAULT_IMAGE, sizeof(structname),
+#else
+#define PB_GEN_DEFAULT_IMAGE_POINTER(msgname, structname)
+#endif
+
 #define PB_GEN_FIELD_COUNT(structname, atype, htype, ltype, fieldname, tag) +1
 #define PB_GEN_REQ_FIELD_COUNT(structname, atype, htype, ltype, fieldname, tag) \
     + (PB_HTYPE_ ## htype == PB_HTYPE_REQUIRED)
@@ -745,6 +1089,7 @@ struct pb_extension_s {
 #define PB_SI_PB_LTYPE_INT64(t)
 #define PB_SI_PB_LTYPE_MESSAGE(t)  PB_SUBMSG_DESCRIPTOR(t)
 #define PB_SI_PB_LTYPE_MSG_W_CB(t) PB_SUBMSG_DESCRIPTOR(t)
+#define PB_SI_PB_LTYPE_MSG_STREAM(t) PB_SUBMSG_DESCRIPTOR(t)
 #define PB_SI_PB_LTYPE_SFIXED32(t)
 #define PB_SI_PB_LTYPE_SFIXED64(t)
 #define PB_SI_PB_LTYPE_SINT32(t)
@@ -754,6 +1099,7 @@ struct pb_extension_s {
 #define PB_SI_PB_LTYPE_UINT64(t)
 #define PB_SI_PB_LTYPE_EXTENSION(t)
 #define PB_SI_PB_LTYPE_FIXED_LENGTH_BYTES(t)
+#define PB_SI_PB_LTYPE_VIEW(t)
 #define PB_SUBMSG_DESCRIPTOR(t)    &(t ## _msg),
 
 /* The field descriptors use a variable width format, with width of either
@@ -864,6 +1210,7 @@ struct pb_extension_s {
 #define PB_FI_WIDTH_PB_LTYPE_INT64     1
 #define PB_FI_WIDTH_PB_LTYPE_MESSAGE   2
 #define PB_FI_WIDTH_PB_LTYPE_MSG_W_CB  2
+#define PB_FI_WIDTH_PB_LTYPE_MSG_STREAM 2
 #define PB_FI_WIDTH_PB_LTYPE_SFIXED32  1
 #define PB_FI_WIDTH_PB_LTYPE_SFIXED64  1
 #define PB_FI_WIDTH_PB_LTYPE_SINT32    1
@@ -873,6 +1220,7 @@ struct pb_extension_s {
 #define PB_FI_WIDTH_PB_LTYPE_UINT64    1
 #define PB_FI_WIDTH_PB_LTYPE_EXTENSION 1
 #define PB_FI_WIDTH_PB_LTYPE_FIXED_LENGTH_BYTES 2
+#define PB_FI_WIDTH_PB_LTYPE_VIEW      2
 
 /* The mapping from protobuf types to LTYPEs is done using these macros. */
 #define PB_LTYPE_MAP_BOOL               PB_LTYPE_BOOL
@@ -887,6 +1235,7 @@ struct pb_extension_s {
 #define PB_LTYPE_MAP_INT64              PB_LTYPE_VARINT
 #define PB_LTYPE_MAP_MESSAGE            PB_LTYPE_SUBMESSAGE
 #define PB_LTYPE_MAP_MSG_W_CB           PB_LTYPE_SUBMSG_W_CB
+#define PB_LTYPE_MAP_MSG_STREAM         PB_LTYPE_SUBMSG_STREAM
 #define PB_LTYPE_MAP_SFIXED32           PB_LTYPE_FIXED32
 #define PB_LTYPE_MAP_SFIXED64           PB_LTYPE_FIXED64
 #define PB_LTYPE_MAP_SINT32             PB_LTYPE_SVARINT
@@ -896,6 +1245,7 @@ struct pb_extension_s {
 #define PB_LTYPE_MAP_UINT64             PB_LTYPE_UVARINT
 #define PB_LTYPE_MAP_EXTENSION          PB_LTYPE_EXTENSION
 #define PB_LTYPE_MAP_FIXED_LENGTH_BYTES PB_LTYPE_FIXED_LENGTH_BYTES
+#define PB_LTYPE_MAP_VIEW               PB_LTYPE_VIEW
 
 /* These macros are used for giving out error messages.
  * They are mostly a debugging aid; the main error information
@@ -7,13 +7,28 @@
 
 static bool load_descriptor_values(pb_field_iter_t *iter)
 {
+#ifdef PB_DESCRIPTOR_UNPACKED
+    const pb_field_desc_t *desc;
+#else
     uint32_t word0;
+#endif
     uint32_t data_offset;
     int_least8_t size_offset;
 
     if (iter->index >= iter->descriptor->field_count)
         return false;
 
+#ifdef PB_DESCRIPTOR_UNPACKED
+    desc = &iter->descriptor->field_desc[iter->index];
+    iter->type = desc->type;
+    iter->tag = desc->tag;
+    iter->array_size = desc->array_size;
+    iter->data_size = desc->data_size;
+    iter->required_field_index = desc->required_field_index;
+    iter->submessage_index = desc->submessage_index;
+    size_offset = desc->size_offset;
+    data_offset = desc->data_offset;
+#else
     word0 = PB_PROGMEM_READU32(iter->descriptor->field_info[iter->field_info_index]);
     iter->type = (pb_type_t)((word0 >> 8) & 0xFF);
 
@@ -70,6 +85,7 @@ static bool load_descriptor_values(pb_field_iter_t *iter)
             break;
         }
     }
+#endif
 
     if (!iter->message)
     {
@@ -133,6 +149,12 @@ static void advance_iterator(pb_field_iter_t *iter)
     }
     else
     {
+#ifdef PB_DESCRIPTOR_UNPACKED
+        /* Indexes are stored directly in the unpacked descriptor */
+        const pb_field_desc_t *desc = &iter->descriptor->field_desc[iter->index];
+        iter->required_field_index = desc->required_field_index;
+        iter->submessage_index = desc->submessage_index;
+#else
         /* Increment indexes based on previous field type.
          * All field info formats have the following fields:
          * - lowest 2 bits tell the amount of words in the descriptor (2^n words)
@@ -150,9 +172,23 @@ static void advance_iterator(pb_field_iter_t *iter)
         iter->field_info_index = (pb_size_t)(iter->field_info_index + descriptor_len);
         iter->required_field_index = (pb_size_t)(iter->required_field_index + (PB_HTYPE(prev_type) == PB_HTYPE_REQUIRED));
         iter->submessage_index = (pb_size_t)(iter->submessage_index + PB_LTYPE_IS_SUBMSG(prev_type));
+#endif
     }
 }
 
+/* Get the first descriptor word of the current field without loading
+ * all values. It gives the lowest 6 bits of tag number in bits 2..7
+ * and the field type in bits 8..15. */
+static uint32_t peek_descriptor_word0(const pb_field_iter_t *iter)
+{
+#ifdef PB_DESCRIPTOR_UNPACKED
+    const pb_field_desc_t *desc = &iter->descriptor->field_desc[iter->index];
+    return (((uint32_t)desc->tag << 2) & 0xFC) | ((uint32_t)desc->type << 8);
+#else
+    return PB_PROGMEM_READU32(iter->descriptor->field_info[iter->field_info_index]);
+#endif
+}
+
 bool pb_field_iter_begin(pb_field_iter_t *iter, const pb_msgdesc_t *desc, void *message)
 {
     memset(iter, 0, sizeof(*iter));
@@ -202,6 +238,26 @@ bool pb_field_iter_find(pb_field_iter_t *iter, uint32_t tag)
     {
         return false;
     }
+#ifdef PB_TAG_LOOKUP
+    else if (iter->descriptor->field_lookup != NULL)
+    {
+        /* Direct lookup by tag number, generated by tag_lookup option */
+        const pb_field_lookup_t *entry;
+
+        if (tag >= iter->descriptor->field_lookup_count)
+            return false;
+
+        entry = &iter->descriptor->field_lookup[tag];
+        if (entry->index == PB_SIZE_MAX)
+            return false;
+
+        iter->index = entry->index;
+        iter->field_info_index = entry->field_info_index;
+        iter->required_field_index = entry->required_field_index;
+        iter->submessage_index = entry->submessage_index;
+        return load_descriptor_values(iter);
+    }
+#endif
     else
     {
         pb_size_t start = iter->index;
@@ -221,7 +277,7 @@ bool pb_field_iter_find(pb_field_iter_t *iter, uint32_t tag)
             advance_iterator(iter);
 
             /* Do fast check for tag number match */
-            fieldinfo = PB_PROGMEM_READU32(iter->descriptor->field_info[iter->field_info_index]);
+            fieldinfo = peek_descriptor_word0(iter);
 
             if (((fieldinfo >> 2) & 0x3F) == (tag & 0x3F))
             {
@@ -260,7 +316,7 @@ bool pb_field_iter_find_extension(pb_field_iter_t *iter)
             advance_iterator(iter);
 
             /* Do fast check for field type */
-            fieldinfo = PB_PROGMEM_READU32(iter->descriptor->field_info[iter->field_info_index]);
+            fieldinfo = peek_descriptor_word0(iter);
 
             if (PB_LTYPE((fieldinfo >> 8) & 0xFF) == PB_LTYPE_EXTENSION)
             {
@@ -299,6 +355,20 @@ bool pb_field_iter_begin_extension_const(pb_field_iter_t *iter, const pb_extensi
 
 bool pb_default_field_callback(pb_istream_t *istream, pb_ostream_t *ostream, const pb_field_t *field)
 {
+    if (PB_LTYPE(field->type) == PB_LTYPE_SUBMSG_STREAM)
+    {
+        /* Elements of streamed fields are passed to the decode function
+         * by the decoder itself. */
+        pb_stream_callback_t *pCallback = (pb_stream_callback_t*)field->pData;
+
+        if (ostream != NULL && pCallback->funcs.encode != NULL)
+        {
+            return pCallback->funcs.encode(ostream, field, &pCallback->arg);
+        }
+
+        return true;
+    }
+
     if (field->data_size == sizeof(pb_callback_t))
     {
         pb_callback_t *pCallback = (pb_callback_t*)field->pData;
@@ -23,32 +23,71 @@
  **************************************/
 
 static bool checkreturn buf_read(pb_istream_t *stream, pb_byte_t *buf, size_t count);
+#ifndef PB_BUFFER_ONLY
+static bool checkreturn transient_buf_read(pb_istream_t *stream, pb_byte_t *buf, size_t count);
+#endif
+#ifndef PB_BUFFER_ONLY
+static bool checkreturn buffered_read(pb_istream_t *stream, pb_byte_t *buf, size_t count);
+#endif
 static bool checkreturn read_raw_value(pb_istream_t *stream, pb_wire_type_t wire_type, pb_byte_t *buf, size_t *size);
 static bool checkreturn decode_basic_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field);
 static bool checkreturn decode_static_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field);
-static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field);
+static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field, pb_array_alloc_t *arrays);
 static bool checkreturn decode_callback_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field);
-static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field);
+static bool checkreturn decode_stream_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field);
+static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field, pb_array_alloc_t *arrays);
+#ifdef PB_FAST_DECODE
+static bool checkreturn decode_fast_field(pb_istream_t *stream, const pb_fast_field_t *fast, void *dest_struct);
+#endif
 static bool checkreturn default_extension_decoder(pb_istream_t *stream, pb_extension_t *extension, uint32_t tag, pb_wire_type_t wire_type);
 static bool checkreturn decode_extension(pb_istream_t *stream, uint32_t tag, pb_wire_type_t wire_type, pb_extension_t *extension);
 static bool pb_field_set_to_default(pb_field_iter_t *field);
 static bool pb_message_set_to_defaults(pb_field_iter_t *iter);
+static bool pb_message_set_to_defaults_masked(pb_field_iter_t *iter, const pb_field_mask_t *mask);
+static bool checkreturn pb_decode_inner(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags, const pb_field_mask_t *mask);
+static bool checkreturn decode_masked_submessage(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field, const pb_field_mask_t *mask);
+static void mark_unmasked_required_fields(const pb_msgdesc_t *fields, void *dest_struct, const pb_field_mask_t *mask, uint32_t *fields_seen);
 static bool checkreturn pb_dec_bool(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_varint(pb_istream_t *stream, const pb_field_iter_t *field);
+static bool checkreturn pb_dec_packed_varints(pb_istream_t *stream, pb_field_iter_t *field);
+static bool checkreturn pb_dec_packed_fixed(pb_istream_t *stream, pb_field_iter_t *field);
 static bool checkreturn pb_dec_bytes(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_string(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_submessage(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_dec_fixed_length_bytes(pb_istream_t *stream, const pb_field_iter_t *field);
+static bool checkreturn pb_dec_view(pb_istream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_skip_varint(pb_istream_t *stream);
 static bool checkreturn pb_skip_string(pb_istream_t *stream);
+static size_t decode_varint32_buffer(const pb_byte_t *buf, uint32_t *dest);
+#ifndef PB_WITHOUT_64BIT
+static size_t decode_varint_buffer(const pb_byte_t *buf, uint64_t *dest);
+#endif
 
 #ifdef PB_ENABLE_MALLOC
 static bool checkreturn allocate_field(pb_istream_t *stream, void *pData, size_t data_size, size_t array_size);
 static void initialize_pointer_field(void *pItem, pb_field_iter_t *field);
 static bool checkreturn pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *field);
-static void pb_release_single_field(pb_field_iter_t *field);
+static void pb_release_single_field(pb_field_iter_t *field, bool free_memory);
+static void release_message(const pb_msgdesc_t *fields, void *dest_struct, bool free_memory);
+#endif
+
+#ifdef PB_ENABLE_ARENA
+/* Alignment of arena allocations, must be a power of two */
+#ifndef PB_ARENA_ALIGNMENT
+#define PB_ARENA_ALIGNMENT 8
+#endif
+static void *pb_arena_realloc(pb_arena_t *arena, void *ptr, size_t size);
+#define PB_USES_ARENA(stream) ((stream)->arena != NULL)
+#else
+#define PB_USES_ARENA(stream) false
 #endif
 
+#define PB_FIELD_MASK_HAS(mask, tag) (((mask)->tags[(tag) >> 5] >> ((tag) & 31)) & 1U)
+
+/* Internal marker passed as wire type to decode_field() to only prepare the
+ * storage of a submessage field, for decoding it in pb_decode_iterative(). */
+#define PB_WT_SUBMSG_PREPARE ((pb_wire_type_t)254)
+
 #ifdef PB_WITHOUT_64BIT
 #define pb_int64_t int32_t
 #define pb_uint64_t uint32_t
@@ -57,9 +96,27 @@ static void pb_release_single_field(pb_field_iter_t *field);
 #define pb_uint64_t uint64_t
 #endif
 
-typedef struct {
-    uint32_t bitfield[(PB_MAX_REQUIRED_FIELDS + 31) / 32];
-} pb_fields_seen_t;
+/* Memory buffer streams can be accessed directly through stream->state.
+ * Transient buffer streams are used by the incremental decoder, and their
+ * data is only valid during the call, so views must not point into them. */
+#ifdef PB_BUFFER_ONLY
+static int transient_buffer_marker;
+#define PB_IS_BUFFER_ISTREAM(stream) true
+#define PB_IS_TRANSIENT_ISTREAM(stream) ((stream)->callback == &transient_buffer_marker)
+#else
+#define PB_IS_BUFFER_ISTREAM(stream) ((stream)->callback == buf_read || \
+                                      (stream)->callback == transient_buf_read)
+#define PB_IS_TRANSIENT_ISTREAM(stream) ((stream)->callback == transient_buf_read)
+#endif
+
+/* Streams from pb_istream_from_read_buffer() have their data in the
+ * pb_read_buffer_t pointed to by stream->state */
+#ifndef PB_BUFFER_ONLY
+#define PB_IS_BUFFERED_ISTREAM(stream) ((stream)->callback == buffered_read)
+#endif
+
+/* Maximum length of an encoded varint */
+#define PB_VARINT_MAX_LENGTH 10
 
 /*******************************
  * pb_istream_t implementation *
@@ -78,13 +135,20 @@ static bool checkreturn buf_read(pb_istream_t *stream, pb_byte_t *buf, size_t co
     return true;
 }
 
+#ifndef PB_BUFFER_ONLY
+static bool checkreturn transient_buf_read(pb_istream_t *stream, pb_byte_t *buf, size_t count)
+{
+    return buf_read(stream, buf, count);
+}
+#endif
+
 bool checkreturn pb_read(pb_istream_t *stream, pb_byte_t *buf, size_t count)
 {
     if (count == 0)
         return true;
 
 #ifndef PB_BUFFER_ONLY
-	if (buf == NULL && stream->callback != buf_read)
+	if (buf == NULL && !PB_IS_BUFFER_ISTREAM(stream) && stream->callback != buffered_read)
 	{
 		/* Skip input bytes */
 		pb_byte_t tmp[16];
@@ -127,6 +191,17 @@ static bool checkreturn pb_readbyte(pb_istream_t *stream, pb_byte_t *buf)
         PB_RETURN_ERROR(stream, "end-of-stream");
 
 #ifndef PB_BUFFER_ONLY
+    if (PB_IS_BUFFERED_ISTREAM(stream))
+    {
+        pb_read_buffer_t *rb = (pb_read_buffer_t*)stream->state;
+        if (rb->start < rb->end)
+        {
+            *buf = rb->buf[rb->start++];
+            stream->bytes_left--;
+            return true;
+        }
+    }
+
     if (!stream->callback(stream, buf, 1))
         PB_RETURN_ERROR(stream, "io error");
 #else
@@ -159,20 +234,182 @@ pb_istream_t pb_istream_from_buffer(const pb_byte_t *buf, size_t msglen)
     stream.bytes_left = msglen;
 #ifndef PB_NO_ERRMSG
     stream.errmsg = NULL;
+#endif
+#ifdef PB_ENABLE_ARENA
+    stream.arena = NULL;
+#endif
+    return stream;
+}
+
+#ifndef PB_BUFFER_ONLY
+static bool checkreturn buffered_read(pb_istream_t *stream, pb_byte_t *buf, size_t count)
+{
+    pb_read_buffer_t *rb = (pb_read_buffer_t*)stream->state;
+
+    while (count > 0)
+    {
+        size_t len = rb->end - rb->start;
+
+        if (len == 0)
+        {
+            /* Large reads go directly to the destination, smaller
+             * ones refill the buffer. */
+            if (buf != NULL && count >= rb->size)
+            {
+                if (!rb->read(rb->source, buf, count, &len) || len > count)
+                    return false;
+
+                if (len == 0)
+                {
+                    stream->bytes_left = 0; /* EOF */
+                    return false;
+                }
+
+                buf += len;
+                count -= len;
+                continue;
+            }
+
+            rb->start = 0;
+            rb->end = 0;
+            if (!rb->read(rb->source, rb->buf, rb->size, &len) || len > rb->size)
+                return false;
+
+            if (len == 0)
+            {
+                stream->bytes_left = 0; /* EOF */
+                return false;
+            }
+
+            rb->end = len;
+        }
+
+        if (len > count)
+            len = count;
+
+        if (buf != NULL)
+        {
+            memcpy(buf, rb->buf + rb->start, len * sizeof(pb_byte_t));
+            buf += len;
+        }
+
+        rb->start += len;
+        count -= len;
+    }
+
+    return true;
+}
+
+void pb_read_buffer_init(pb_read_buffer_t *rb,
+                         bool (*read)(void *source, pb_byte_t *buf, size_t count, size_t *actual),
+                         void *source, pb_byte_t *buf, size_t bufsize)
+{
+    rb->read = read;
+    rb->source = source;
+    rb->buf = buf;
+    rb->size = bufsize;
+    rb->start = 0;
+    rb->end = 0;
+}
+
+pb_istream_t pb_istream_from_read_buffer(pb_read_buffer_t *rb, size_t msglen)
+{
+    pb_istream_t stream;
+    stream.callback = &buffered_read;
+    stream.state = rb;
+    stream.bytes_left = msglen;
+#ifndef PB_NO_ERRMSG
+    stream.errmsg = NULL;
+#endif
+#ifdef PB_ENABLE_ARENA
+    stream.arena = NULL;
 #endif
     return stream;
 }
+#endif
 
 
 /********************
  * Helper functions *
  ********************/
 
+/* Decode a varint directly from a memory buffer that has at least
+ * PB_VARINT_MAX_LENGTH bytes available. Returns the number of bytes
+ * consumed, or 0 if the value is not valid. In that case the normal
+ * code path is used to report the error. */
+static size_t decode_varint32_buffer(const pb_byte_t *buf, uint32_t *dest)
+{
+    uint32_t result = 0;
+    pb_byte_t byte;
+    size_t i;
+
+    for (i = 0; i < 4; i++)
+    {
+        byte = buf[i];
+        result |= (uint32_t)(byte & 0x7F) << (7 * i);
+
+        if ((byte & 0x80) == 0)
+        {
+            *dest = result;
+            return i + 1;
+        }
+    }
+
+    byte = buf[4];
+    if ((byte & 0x70) != 0 && (byte & 0x78) != 0x78)
+        return 0;
+
+    result |= (uint32_t)(byte & 0x0F) << 28;
+
+    /* Bytes after the first 32 bits can only be padding or sign extension */
+    for (i = 5; (byte & 0x80) != 0; i++)
+    {
+        pb_byte_t sign_extension = (i < 9) ? 0xFF : 0x01;
+
+        if (i >= PB_VARINT_MAX_LENGTH)
+            return 0;
+
+        byte = buf[i];
+        if ((byte & 0x7F) != 0x00 && ((result >> 31) == 0 || byte != sign_extension))
+            return 0;
+    }
+
+    *dest = result;
+    return i;
+}
+
 bool checkreturn pb_decode_varint32(pb_istream_t *stream, uint32_t *dest)
 {
     pb_byte_t byte;
     uint32_t result;
     
+    if (PB_IS_BUFFER_ISTREAM(stream) && stream->bytes_left >= PB_VARINT_MAX_LENGTH)
+    {
+        size_t len = decode_varint32_buffer((const pb_byte_t*)stream->state, dest);
+        if (len > 0)
+        {
+            stream->state = (pb_byte_t*)stream->state + len;
+            stream->bytes_left -= len;
+            return true;
+        }
+    }
+#ifndef PB_BUFFER_ONLY
+    else if (PB_IS_BUFFERED_ISTREAM(stream) && stream->bytes_left >= PB_VARINT_MAX_LENGTH)
+    {
+        pb_read_buffer_t *rb = (pb_read_buffer_t*)stream->state;
+        if (rb->end - rb->start >= PB_VARINT_MAX_LENGTH)
+        {
+            size_t len = decode_varint32_buffer(rb->buf + rb->start, dest);
+            if (len > 0)
+            {
+                rb->start += len;
+                stream->bytes_left -= len;
+                return true;
+            }
+        }
+    }
+#endif
+
     if (!pb_readbyte(stream, &byte))
     {
         return false;
@@ -227,12 +464,63 @@ bool checkreturn pb_decode_varint32(pb_istream_t *stream, uint32_t *dest)
 }
 
 #ifndef PB_WITHOUT_64BIT
+static size_t decode_varint_buffer(const pb_byte_t *buf, uint64_t *dest)
+{
+    uint64_t result = 0;
+    size_t i;
+
+    for (i = 0; i < PB_VARINT_MAX_LENGTH; i++)
+    {
+        pb_byte_t byte = buf[i];
+
+        if (i == PB_VARINT_MAX_LENGTH - 1 && (byte & 0xFE) != 0)
+            return 0;
+
+        result |= (uint64_t)(byte & 0x7F) << (7 * i);
+
+        if ((byte & 0x80) == 0)
+        {
+            *dest = result;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
 bool checkreturn pb_decode_varint(pb_istream_t *stream, uint64_t *dest)
 {
     pb_byte_t byte;
     uint_fast8_t bitpos = 0;
     uint64_t result = 0;
     
+    if (PB_IS_BUFFER_ISTREAM(stream) && stream->bytes_left >= PB_VARINT_MAX_LENGTH)
+    {
+        size_t len = decode_varint_buffer((const pb_byte_t*)stream->state, dest);
+        if (len > 0)
+        {
+            stream->state = (pb_byte_t*)stream->state + len;
+            stream->bytes_left -= len;
+            return true;
+        }
+    }
+#ifndef PB_BUFFER_ONLY
+    else if (PB_IS_BUFFERED_ISTREAM(stream) && stream->bytes_left >= PB_VARINT_MAX_LENGTH)
+    {
+        pb_read_buffer_t *rb = (pb_read_buffer_t*)stream->state;
+        if (rb->end - rb->start >= PB_VARINT_MAX_LENGTH)
+        {
+            size_t len = decode_varint_buffer(rb->buf + rb->start, dest);
+            if (len > 0)
+            {
+                rb->start += len;
+                stream->bytes_left -= len;
+                return true;
+            }
+        }
+    }
+#endif
+
     do
     {
         if (!pb_readbyte(stream, &byte))
@@ -298,7 +586,7 @@ bool checkreturn pb_decode_tag(pb_istream_t *stream, pb_wire_type_t *wire_type,
          * no error on eof as bytes_left is already 0 on entry. This causes legitimate errors (e.g. missing
          * required fields) to be incorrectly reported by callback streams.
          */
-        if (stream->callback != buf_read && stream->bytes_left == 0)
+        if (!PB_IS_BUFFER_ISTREAM(stream) && stream->bytes_left == 0)
         {
 #ifndef PB_NO_ERRMSG
             if (strcmp(stream->errmsg, "io error") == 0)
@@ -469,6 +757,9 @@ static bool checkreturn decode_basic_field(pb_istream_t *stream, pb_wire_type_t
 
         case PB_LTYPE_SUBMESSAGE:
         case PB_LTYPE_SUBMSG_W_CB:
+            if (wire_type == PB_WT_SUBMSG_PREPARE)
+                return true; /* Storage is ready, caller decodes the contents */
+
             if (wire_type != PB_WT_STRING)
                 PB_RETURN_ERROR(stream, "wrong wire type");
 
@@ -480,6 +771,12 @@ static bool checkreturn decode_basic_field(pb_istream_t *stream, pb_wire_type_t
 
             return pb_dec_fixed_length_bytes(stream, field);
 
+        case PB_LTYPE_VIEW:
+            if (wire_type != PB_WT_STRING)
+                PB_RETURN_ERROR(stream, "wrong wire type");
+
+            return pb_dec_view(stream, field);
+
         default:
             PB_RETURN_ERROR(stream, "invalid field type");
     }
@@ -510,7 +807,25 @@ static bool checkreturn decode_static_field(pb_istream_t *stream, pb_wire_type_t
                 if (!pb_make_string_substream(stream, &substream))
                     return false;
 
-                while (substream.bytes_left > 0 && *size < field->array_size)
+                if (PB_IS_BUFFER_ISTREAM(&substream) &&
+                    (PB_LTYPE(field->type) == PB_LTYPE_VARINT ||
+                     PB_LTYPE(field->type) == PB_LTYPE_UVARINT ||
+                     PB_LTYPE(field->type) == PB_LTYPE_SVARINT))
+                {
+                    /* Bulk decoding of most of the array */
+                    status = pb_dec_packed_varints(&substream, field);
+                }
+                else if ((PB_LTYPE(field->type) == PB_LTYPE_FIXED32 && field->data_size == 4)
+#ifndef PB_WITHOUT_64BIT
+                         || (PB_LTYPE(field->type) == PB_LTYPE_FIXED64 && field->data_size == 8)
+#endif
+                        )
+                {
+                    /* Read all complete elements at once */
+                    status = pb_dec_packed_fixed(&substream, field);
+                }
+
+                while (status && substream.bytes_left > 0 && *size < field->array_size)
                 {
                     if (!decode_basic_field(&substream, PB_WT_PACKED, field))
                     {
@@ -614,6 +929,28 @@ static bool checkreturn allocate_field(pb_istream_t *stream, void *pData, size_t
         }
     }
     
+#ifdef PB_ENABLE_ARENA
+    if (stream->arena != NULL)
+    {
+        pb_arena_t *arena = stream->arena;
+
+        /* Only arena memory can be grown, the size of any other block
+         * is unknown. */
+        if (ptr != NULL && ((pb_byte_t*)ptr < arena->buffer ||
+                            (pb_byte_t*)ptr >= arena->buffer + arena->used))
+        {
+            PB_RETURN_ERROR(stream, "pointer not in arena");
+        }
+
+        ptr = pb_arena_realloc(arena, ptr, array_size * data_size);
+        if (ptr == NULL)
+            PB_RETURN_ERROR(stream, "arena full");
+
+        *(void**)pData = ptr;
+        return true;
+    }
+#endif
+
     /* Allocate new or expand previous allocation */
     /* Note: on failure the old pointer will remain in the structure,
      * the message must be freed by caller also on error return. */
@@ -625,6 +962,46 @@ static bool checkreturn allocate_field(pb_istream_t *stream, void *pData, size_t
     return true;
 }
 
+#ifdef PB_ENABLE_ARENA
+/* Allocate or grow a block in the arena. The most recent allocation is
+ * grown in place, others are copied to the end of the arena. The old
+ * block is not reused until pb_arena_reset(). */
+static void *pb_arena_realloc(pb_arena_t *arena, void *ptr, size_t size)
+{
+    pb_byte_t *old = (pb_byte_t*)ptr;
+    pb_byte_t *result;
+    size_t offset;
+
+    if (old != NULL && old == arena->buffer + arena->last)
+    {
+        offset = arena->last;
+    }
+    else
+    {
+        offset = (arena->used + (PB_ARENA_ALIGNMENT - 1)) & ~(size_t)(PB_ARENA_ALIGNMENT - 1);
+        if (offset < arena->used)
+            return NULL;
+    }
+
+    if (offset > arena->size || size > arena->size - offset)
+        return NULL;
+
+    result = arena->buffer + offset;
+    if (old != NULL && old != result)
+    {
+        /* The old block size is not stored, but it cannot extend past
+         * the end of the used area. The caller has checked that the old
+         * block is inside the arena. */
+        size_t old_size = (size_t)(arena->buffer + arena->used - old);
+        memcpy(result, old, (old_size < size) ? old_size : size);
+    }
+
+    arena->last = offset;
+    arena->used = offset + size;
+    return result;
+}
+#endif
+
 /* Clear a newly allocated item in case it contains a pointer, or is a submessage. */
 static void initialize_pointer_field(void *pItem, pb_field_iter_t *field)
 {
@@ -642,11 +1019,12 @@ static void initialize_pointer_field(void *pItem, pb_field_iter_t *field)
 }
 #endif
 
-static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field)
+static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field, pb_array_alloc_t *arrays)
 {
 #ifndef PB_ENABLE_MALLOC
     PB_UNUSED(wire_type);
     PB_UNUSED(field);
+    PB_UNUSED(arrays);
     PB_RETURN_ERROR(stream, "no malloc support");
 #else
     switch (PB_HTYPE(field->type))
@@ -658,7 +1036,7 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
             {
                 /* Duplicate field, have to release the old allocation first. */
                 /* FIXME: Does this work correctly for oneofs? */
-                pb_release_single_field(field);
+                pb_release_single_field(field, !PB_USES_ARENA(stream));
             }
         
             if (PB_HTYPE(field->type) == PB_HTYPE_ONEOF)
@@ -693,10 +1071,40 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
                 size_t allocated_size = *size;
                 pb_istream_t substream;
                 
+                if (arrays != NULL && arrays->array != NULL &&
+                    arrays->array == *(void**)field->pField)
+                {
+                    allocated_size = arrays->capacity;
+                }
+
                 if (!pb_make_string_substream(stream, &substream))
                     return false;
                 
-                while (substream.bytes_left)
+                if (PB_IS_BUFFER_ISTREAM(&substream) &&
+                    PB_LTYPE(field->type) <= PB_LTYPE_SVARINT)
+                {
+                    /* Count the varints in the data, so that the array
+                     * can be allocated at once. */
+                    const pb_byte_t *buf = (const pb_byte_t*)substream.state;
+                    size_t remain = 0;
+                    size_t i;
+
+                    for (i = 0; i < substream.bytes_left; i++)
+                    {
+                        if ((buf[i] & 0x80) == 0)
+                            remain++;
+                    }
+
+                    if ((size_t)*size + remain > allocated_size &&
+                        remain < PB_SIZE_MAX - (size_t)*size)
+                    {
+                        status = allocate_field(&substream, field->pField, field->data_size, (size_t)*size + remain);
+                        if (status)
+                            allocated_size = (size_t)*size + remain;
+                    }
+                }
+
+                while (status && substream.bytes_left)
                 {
                     if (*size == PB_SIZE_MAX)
                     {
@@ -742,6 +1150,13 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
                     
                     (*size)++;
                 }
+
+                if (arrays != NULL && *(void**)field->pField != NULL)
+                {
+                    arrays->array = *(void**)field->pField;
+                    arrays->capacity = allocated_size;
+                }
+
                 if (!pb_close_string_substream(stream, &substream))
                     return false;
                 
@@ -755,8 +1170,33 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
                 if (*size == PB_SIZE_MAX)
                     PB_RETURN_ERROR(stream, "too many array entries");
                 
-                if (!allocate_field(stream, field->pField, field->data_size, (size_t)(*size + 1)))
-                    return false;
+                if (arrays == NULL || arrays->array == NULL ||
+                    arrays->array != *(void**)field->pField ||
+                    (size_t)*size >= arrays->capacity)
+                {
+                    /* Double the allocation to avoid reallocating
+                     * for every item. */
+                    size_t capacity = (size_t)*size + 1;
+                    if (arrays != NULL)
+                    {
+                        if (*size < PB_SIZE_MAX / 2)
+                            capacity = (size_t)*size * 2;
+                        else
+                            capacity = PB_SIZE_MAX;
+
+                        if (capacity < 4)
+                            capacity = 4;
+                    }
+
+                    if (!allocate_field(stream, field->pField, field->data_size, capacity))
+                        return false;
+
+                    if (arrays != NULL)
+                    {
+                        arrays->array = *(void**)field->pField;
+                        arrays->capacity = capacity;
+                    }
+                }
             
                 field->pData = *(char**)field->pField + field->data_size * (*size);
                 (*size)++;
@@ -770,8 +1210,65 @@ static bool checkreturn decode_pointer_field(pb_istream_t *stream, pb_wire_type_
 #endif
 }
 
+/* Decode one element of a streamed repeated submessage into the element
+ * buffer that follows the callback, and pass it to the decode function.
+ * The same buffer is used for every element, but it is initialized and
+ * iterated like any other submessage. */
+static bool checkreturn decode_stream_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field)
+{
+    pb_stream_callback_t *callback = (pb_stream_callback_t*)field->pData;
+    void *item = callback + 1;
+    pb_istream_t substream;
+    bool status;
+#ifdef PB_ENABLE_ARENA
+    pb_arena_t arena_state;
+#endif
+
+    if (callback->funcs.decode == NULL)
+        return pb_skip_field(stream, wire_type);
+
+    if (wire_type != PB_WT_STRING)
+        PB_RETURN_ERROR(stream, "wrong wire type");
+
+    if (field->submsg_desc == NULL)
+        PB_RETURN_ERROR(stream, "invalid field descriptor");
+
+    if (!pb_make_string_substream(stream, &substream))
+        return false;
+
+#ifdef PB_ENABLE_ARENA
+    if (PB_USES_ARENA(stream))
+        arena_state = *stream->arena;
+#endif
+
+    status = pb_decode_inner(&substream, field->submsg_desc, item, 0, NULL) &&
+             callback->funcs.decode(field, item, &callback->arg);
+
+#ifdef PB_ENABLE_MALLOC
+    /* Pointer fields of the element are not needed after the callback */
+    release_message(field->submsg_desc, item, !PB_USES_ARENA(stream));
+#endif
+
+#ifdef PB_ENABLE_ARENA
+    /* Give the arena space of the element back for the next one */
+    if (PB_USES_ARENA(stream))
+        *stream->arena = arena_state;
+#endif
+
+    if (!pb_close_string_substream(stream, &substream))
+        return false;
+
+    if (!status)
+        PB_RETURN_ERROR(stream, "callback failed");
+
+    return true;
+}
+
 static bool checkreturn decode_callback_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field)
 {
+    if (PB_LTYPE(field->type) == PB_LTYPE_SUBMSG_STREAM)
+        return decode_stream_field(stream, wire_type, field);
+
     if (!field->descriptor->field_callback)
         return pb_skip_field(stream, wire_type);
 
@@ -832,7 +1329,7 @@ static bool checkreturn decode_callback_field(pb_istream_t *stream, pb_wire_type
     }
 }
 
-static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field)
+static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field, pb_array_alloc_t *arrays)
 {
 #ifdef PB_ENABLE_MALLOC
     /* When decoding an oneof field, check if there is old data that must be
@@ -850,7 +1347,7 @@ static bool checkreturn decode_field(pb_istream_t *stream, pb_wire_type_t wire_t
             return decode_static_field(stream, wire_type, field);
         
         case PB_ATYPE_POINTER:
-            return decode_pointer_field(stream, wire_type, field);
+            return decode_pointer_field(stream, wire_type, field, arrays);
         
         case PB_ATYPE_CALLBACK:
             return decode_callback_field(stream, wire_type, field);
@@ -875,7 +1372,7 @@ static bool checkreturn default_extension_decoder(pb_istream_t *stream,
         return true;
 
     extension->found = true;
-    return decode_field(stream, wire_type, &iter);
+    return decode_field(stream, wire_type, &iter, NULL);
 }
 
 /* Try to decode an unknown field as an extension field. Tries each extension
@@ -992,6 +1489,15 @@ static bool pb_message_set_to_defaults(pb_field_iter_t *iter)
     pb_wire_type_t wire_type = PB_WT_VARINT;
     bool eof;
 
+#ifdef PB_DEFAULT_IMAGES
+    if (iter->descriptor->default_image != NULL)
+    {
+        /* Copy the whole initialized structure at once */
+        memcpy(iter->message, iter->descriptor->default_image, iter->descriptor->default_image_size);
+        return true;
+    }
+#endif
+
     if (iter->descriptor->default_value)
     {
         defstream = pb_istream_from_buffer(iter->descriptor->default_value, (size_t)-1);
@@ -1007,7 +1513,7 @@ static bool pb_message_set_to_defaults(pb_field_iter_t *iter)
         if (tag != 0 && iter->tag == tag)
         {
             /* We have a default value for this field in the defstream */
-            if (!decode_field(&defstream, wire_type, iter))
+            if (!decode_field(&defstream, wire_type, iter, NULL))
                 return false;
             if (!pb_decode_tag(&defstream, &wire_type, &tag, &eof))
                 return false;
@@ -1020,212 +1526,990 @@ static bool pb_message_set_to_defaults(pb_field_iter_t *iter)
     return true;
 }
 
-/*********************
- * Decode all fields *
- *********************/
-
-static bool checkreturn pb_decode_inner(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags)
+/* Same as pb_message_set_to_defaults(), but only for the fields included in
+ * the mask. The fields are looked up by tag, so the cost depends on the
+ * number of fields in the mask rather than in the message. */
+static bool pb_message_set_to_defaults_masked(pb_field_iter_t *iter, const pb_field_mask_t *mask)
 {
-    /* If the message contains extension fields, the extension handlers
-     * are called when tag number is >= extension_range_start. This precheck
-     * is just for speed, and the handlers will check for precise match.
-     */
-    uint32_t extension_range_start = 0;
-    pb_extension_t *extensions = NULL;
-
-    /* 'fixed_count_field' and 'fixed_count_size' track position of a repeated fixed
-     * count field. This can only handle _one_ repeated fixed count field that
-     * is unpacked and unordered among other (non repeated fixed count) fields.
-     */
-    pb_size_t fixed_count_field = PB_SIZE_MAX;
-    pb_size_t fixed_count_size = 0;
-    pb_size_t fixed_count_total_size = 0;
+    pb_istream_t defstream = PB_ISTREAM_EMPTY;
+    uint32_t deftag = 0;
+    pb_wire_type_t wire_type = PB_WT_VARINT;
+    bool eof;
+    pb_size_t word;
 
-    /* Tag and wire type of next field from the input stream */
+    if (iter->descriptor->default_value)
+    {
+        defstream = pb_istream_from_buffer(iter->descriptor->default_value, (size_t)-1);
+        if (!pb_decode_tag(&defstream, &wire_type, &deftag, &eof))
+            return false;
+    }
+
+    for (word = 0; word <= (pb_size_t)(iter->descriptor->largest_tag >> 5); word++)
+    {
+        uint32_t bits = mask->tags[word];
+        uint32_t tag = (uint32_t)word << 5;
+
+        for (; bits != 0; bits >>= 1, tag++)
+        {
+            const pb_field_mask_t *submask = NULL;
+
+            if ((bits & 1) == 0 || !pb_field_iter_find(iter, tag))
+                continue;
+
+            if (mask->submsgs && PB_LTYPE_IS_SUBMSG(iter->type))
+                submask = mask->submsgs[iter->submessage_index];
+
+            if (submask)
+            {
+                /* Only initialize the masked fields of the submessage */
+                pb_field_iter_t submsg_iter;
+
+                if (PB_HTYPE(iter->type) == PB_HTYPE_OPTIONAL && iter->pSize != NULL)
+                    *(bool*)iter->pSize = false;
+
+                if (pb_field_iter_begin(&submsg_iter, iter->submsg_desc, iter->pData))
+                {
+                    if (!pb_message_set_to_defaults_masked(&submsg_iter, submask))
+                        return false;
+                }
+            }
+            else if (!pb_field_set_to_default(iter))
+            {
+                return false;
+            }
+
+            /* Skip defaults of the fields that are not in the mask */
+            while (deftag != 0 && deftag < tag)
+            {
+                if (!pb_skip_field(&defstream, wire_type))
+                    return false;
+                if (!pb_decode_tag(&defstream, &wire_type, &deftag, &eof))
+                    return false;
+            }
+
+            if (deftag == tag)
+            {
+                if (!decode_field(&defstream, wire_type, iter, NULL))
+                    return false;
+                if (!pb_decode_tag(&defstream, &wire_type, &deftag, &eof))
+                    return false;
+
+                if (iter->pSize)
+                    *(bool*)iter->pSize = false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*********************
+ * Decode all fields *
+ *********************/
+
+#ifdef PB_FAST_DECODE
+/* Decode a static scalar field described by an entry of the fast
+ * decoding table. The wire type has already been checked against
+ * fast->tag_byte. */
+static bool checkreturn decode_fast_field(pb_istream_t *stream, const pb_fast_field_t *fast, void *dest_struct)
+{
+    char *pData = (char*)dest_struct + fast->data_offset;
+
+    if (fast->size_offset != 0)
+    {
+        /* Set has_field to true */
+        *(bool*)(pData - fast->size_offset) = true;
+    }
+
+    switch (PB_LTYPE(fast->type))
+    {
+        case PB_LTYPE_BOOL:
+            return pb_decode_bool(stream, (bool*)pData);
+
+        case PB_LTYPE_FIXED32:
+            return pb_decode_fixed32(stream, pData);
+
+        case PB_LTYPE_FIXED64:
+#ifdef PB_CONVERT_DOUBLE_FLOAT
+            if (fast->data_size == sizeof(float))
+            {
+                return pb_decode_double_as_float(stream, (float*)pData);
+            }
+#endif
+
+#ifdef PB_WITHOUT_64BIT
+            PB_RETURN_ERROR(stream, "invalid data_size");
+#else
+            return pb_decode_fixed64(stream, pData);
+#endif
+
+        default:
+        {
+            /* Varint types, pb_dec_varint() only uses these members */
+            pb_field_iter_t field;
+            field.type = fast->type;
+            field.data_size = fast->data_size;
+            field.pData = pData;
+            return pb_dec_varint(stream, &field);
+        }
+    }
+}
+#endif
+
+/* Decode a submessage field using the nested mask for its contents.
+ * The submessage has already been initialized by the top-level call. */
+static bool checkreturn decode_masked_submessage(pb_istream_t *stream, pb_wire_type_t wire_type, pb_field_iter_t *field, const pb_field_mask_t *mask)
+{
+    bool status;
+    pb_istream_t substream;
+
+    if (wire_type != PB_WT_STRING)
+        PB_RETURN_ERROR(stream, "wrong wire type");
+
+    if (PB_HTYPE(field->type) == PB_HTYPE_OPTIONAL && field->pSize != NULL)
+    {
+        /* Set has_field to true */
+        *(bool*)field->pSize = true;
+    }
+
+    if (!pb_make_string_substream(stream, &substream))
+        return false;
+
+    status = pb_decode_inner(&substream, field->submsg_desc, field->pData, PB_DECODE_NOINIT, mask);
+
+    if (!pb_close_string_substream(stream, &substream))
+        return false;
+
+    return status;
+}
+
+/* Required fields that are not in the mask are never decoded, so they
+ * are marked as seen to pass the check for missing required fields. */
+static void mark_unmasked_required_fields(const pb_msgdesc_t *fields, void *dest_struct, const pb_field_mask_t *mask, uint32_t *fields_seen)
+{
+    pb_field_iter_t iter;
+
+    if (!pb_field_iter_begin(&iter, fields, dest_struct))
+        return;
+
+    do
+    {
+        if (PB_HTYPE(iter.type) == PB_HTYPE_REQUIRED
+            && iter.required_field_index < PB_MAX_REQUIRED_FIELDS
+            && !PB_FIELD_MASK_HAS(mask, iter.tag))
+        {
+            fields_seen[iter.required_field_index >> 5] |= ((uint32_t)1 << (iter.required_field_index & 31));
+        }
+    } while (pb_field_iter_next(&iter));
+}
+
+/* Set up the decoding state of a message and initialize its fields */
+static bool checkreturn decode_frame_begin(pb_istream_t *stream, pb_decode_frame_t *frame, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags, const pb_field_mask_t *mask)
+{
+    /* If the message contains extension fields, the extension handlers
+     * are called when tag number is >= extension_range_start. This precheck
+     * is just for speed, and the handlers will check for precise match.
+     */
+    frame->extension_range_start = 0;
+    frame->extensions = NULL;
+
+    /* 'fixed_count_field' and 'fixed_count_size' track position of a repeated fixed
+     * count field. This can only handle _one_ repeated fixed count field that
+     * is unpacked and unordered among other (non repeated fixed count) fields.
+     */
+    frame->fixed_count_field = PB_SIZE_MAX;
+    frame->fixed_count_size = 0;
+    frame->fixed_count_total_size = 0;
+
+    /* Track presence of required fields */
+    memset(frame->fields_seen, 0, sizeof(frame->fields_seen));
+
+    frame->mask = mask;
+
+#ifdef PB_ENABLE_MALLOC
+    /* Capacity of the repeated pointer field that was grown last */
+    frame->array_alloc.array = NULL;
+    frame->array_alloc.capacity = 0;
+#endif
+
+    if (pb_field_iter_begin(&frame->iter, fields, dest_struct))
+    {
+        if ((flags & PB_DECODE_NOINIT) == 0)
+        {
+            if (mask != NULL ? !pb_message_set_to_defaults_masked(&frame->iter, mask)
+                             : !pb_message_set_to_defaults(&frame->iter))
+                PB_RETURN_ERROR(stream, "failed to set defaults");
+        }
+    }
+
+    return true;
+}
+
+/* Decode one field of the message, after its tag has been read.
+ * If submsg is not NULL, plain submessage fields are not decoded. Instead
+ * their storage is prepared, frame->iter.pData is left pointing to it and
+ * *submsg is set to true. The caller then decodes the submessage contents. */
+static bool checkreturn decode_frame_field(pb_istream_t *stream, pb_decode_frame_t *frame, uint32_t tag, pb_wire_type_t wire_type, bool *submsg)
+{
+    const pb_msgdesc_t *fields = frame->iter.descriptor;
+    pb_field_iter_t *iter = &frame->iter;
+#ifdef PB_ENABLE_MALLOC
+    pb_array_alloc_t *arrays = &frame->array_alloc;
+#else
+    pb_array_alloc_t *arrays = NULL;
+#endif
+
+    /* Skip fields that are not in the mask, including extensions */
+    if (frame->mask != NULL && (tag > fields->largest_tag || !PB_FIELD_MASK_HAS(frame->mask, tag)))
+        return pb_skip_field(stream, wire_type);
+
+#ifdef PB_FAST_DECODE
+    /* Static scalar fields with small tag numbers can be decoded
+     * directly from the fast table, without searching the descriptor. */
+    if (tag < fields->fast_table_count)
+    {
+        const pb_fast_field_t *fast = &fields->fast_table[tag];
+
+        if (fast->tag_byte == (pb_byte_t)((tag << 3) | (uint32_t)wire_type))
+        {
+            if (PB_HTYPE(fast->type) == PB_HTYPE_REQUIRED
+                && fast->required_field_index < PB_MAX_REQUIRED_FIELDS)
+            {
+                uint32_t tmp = ((uint32_t)1 << (fast->required_field_index & 31));
+                frame->fields_seen[fast->required_field_index >> 5] |= tmp;
+            }
+
+            return decode_fast_field(stream, fast, iter->message);
+        }
+    }
+#endif
+
+    if (!pb_field_iter_find(iter, tag) || PB_LTYPE(iter->type) == PB_LTYPE_EXTENSION)
+    {
+        /* No match found, check if it matches an extension. */
+        if (frame->extension_range_start == 0)
+        {
+            if (pb_field_iter_find_extension(iter))
+            {
+                frame->extensions = *(pb_extension_t* const *)iter->pData;
+                frame->extension_range_start = iter->tag;
+            }
+
+            if (!frame->extensions)
+            {
+                frame->extension_range_start = (uint32_t)-1;
+            }
+        }
+
+        if (tag >= frame->extension_range_start)
+        {
+            size_t pos = stream->bytes_left;
+
+            if (!decode_extension(stream, tag, wire_type, frame->extensions))
+                return false;
+
+            if (pos != stream->bytes_left)
+            {
+                /* The field was handled */
+                return true;
+            }
+        }
+
+        /* No match found, skip data */
+        return pb_skip_field(stream, wire_type);
+    }
+
+    /* If a repeated fixed count field was found, get size from
+     * 'fixed_count_field' as there is no counter contained in the struct.
+     */
+    if (PB_HTYPE(iter->type) == PB_HTYPE_REPEATED && iter->pSize == &iter->array_size)
+    {
+        if (frame->fixed_count_field != iter->index) {
+            /* If the new fixed count field does not match the previous one,
+             * check that the previous one is NULL or that it finished
+             * receiving all the expected data.
+             */
+            if (frame->fixed_count_field != PB_SIZE_MAX &&
+                frame->fixed_count_size != frame->fixed_count_total_size)
+            {
+                PB_RETURN_ERROR(stream, "wrong size for fixed count field");
+            }
+
+            frame->fixed_count_field = iter->index;
+            frame->fixed_count_size = 0;
+            frame->fixed_count_total_size = iter->array_size;
+        }
+
+        iter->pSize = &frame->fixed_count_size;
+    }
+
+    if (PB_HTYPE(iter->type) == PB_HTYPE_REQUIRED
+        && iter->required_field_index < PB_MAX_REQUIRED_FIELDS)
+    {
+        uint32_t tmp = ((uint32_t)1 << (iter->required_field_index & 31));
+        frame->fields_seen[iter->required_field_index >> 5] |= tmp;
+    }
+
+    if (frame->mask != NULL && frame->mask->submsgs != NULL && PB_LTYPE_IS_SUBMSG(iter->type)
+        && frame->mask->submsgs[iter->submessage_index] != NULL)
+    {
+        return decode_masked_submessage(stream, wire_type, iter, frame->mask->submsgs[iter->submessage_index]);
+    }
+
+    if (submsg != NULL && PB_LTYPE(iter->type) == PB_LTYPE_SUBMESSAGE &&
+        PB_ATYPE(iter->type) != PB_ATYPE_CALLBACK && wire_type == PB_WT_STRING)
+    {
+        *submsg = true;
+        wire_type = PB_WT_SUBMSG_PREPARE;
+    }
+
+    return decode_field(stream, wire_type, iter, arrays);
+}
+
+/* Check the fields of a message after all of it has been decoded */
+static bool checkreturn decode_frame_end(pb_istream_t *stream, pb_decode_frame_t *frame)
+{
+    const uint32_t allbits = ~(uint32_t)0;
+
+    /* Check that all elements of the last decoded fixed count field were present. */
+    if (frame->fixed_count_field != PB_SIZE_MAX &&
+        frame->fixed_count_size != frame->fixed_count_total_size)
+    {
+        PB_RETURN_ERROR(stream, "wrong size for fixed count field");
+    }
+
+    /* Check that all required fields were present. */
+    {
+        pb_size_t req_field_count = frame->iter.descriptor->required_field_count;
+
+        if (req_field_count > 0)
+        {
+            pb_size_t i;
+
+            if (frame->mask != NULL)
+                mark_unmasked_required_fields(frame->iter.descriptor, frame->iter.message, frame->mask, frame->fields_seen);
+
+            if (req_field_count > PB_MAX_REQUIRED_FIELDS)
+                req_field_count = PB_MAX_REQUIRED_FIELDS;
+
+            /* Check the whole words */
+            for (i = 0; i < (req_field_count >> 5); i++)
+            {
+                if (frame->fields_seen[i] != allbits)
+                    PB_RETURN_ERROR(stream, "missing required field");
+            }
+
+            /* Check the remaining bits (if any) */
+            if ((req_field_count & 31) != 0)
+            {
+                if (frame->fields_seen[req_field_count >> 5] !=
+                    (allbits >> (uint_least8_t)(32 - (req_field_count & 31))))
+                {
+                    PB_RETURN_ERROR(stream, "missing required field");
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool checkreturn pb_decode_inner(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags, const pb_field_mask_t *mask)
+{
+    pb_decode_frame_t frame;
+
+    /* Tag and wire type of next field from the input stream */
     uint32_t tag;
     pb_wire_type_t wire_type;
     bool eof;
 
-    /* Track presence of required fields */
-    pb_fields_seen_t fields_seen = {{0, 0}};
-    const uint32_t allbits = ~(uint32_t)0;
+    if (!decode_frame_begin(stream, &frame, fields, dest_struct, flags, mask))
+        return false;
+
+    while (pb_decode_tag(stream, &wire_type, &tag, &eof))
+    {
+        if (tag == 0)
+        {
+          if (flags & PB_DECODE_NULLTERMINATED)
+          {
+            eof = true;
+            break;
+          }
+          else
+          {
+            PB_RETURN_ERROR(stream, "zero tag");
+          }
+        }
+
+        if (!decode_frame_field(stream, &frame, tag, wire_type, NULL))
+            return false;
+    }
+
+    if (!eof)
+    {
+        /* pb_decode_tag() returned error before end of stream */
+        return false;
+    }
+
+    return decode_frame_end(stream, &frame);
+}
+
+/* Same as pb_decode_inner(), but decodes submessages in the same loop by
+ * keeping the state of each nesting level in the frames array. */
+static bool checkreturn pb_decode_iterative_inner(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, pb_decode_frame_t *frames, pb_size_t max_depth, unsigned int flags)
+{
+    pb_decode_frame_t *frame = frames;
+    pb_decode_frame_t *last = frames + max_depth - 1;
+
+    /* Tag and wire type of next field from the input stream */
+    uint32_t tag;
+    pb_wire_type_t wire_type;
+    bool eof;
+
+    if (max_depth == 0)
+        PB_RETURN_ERROR(stream, "max depth exceeded");
+
+    if (!decode_frame_begin(stream, frame, fields, dest_struct, flags, NULL))
+        return false;
+
+    for (;;)
+    {
+        bool submsg = false;
+
+        if (!pb_decode_tag(stream, &wire_type, &tag, &eof))
+        {
+            if (!eof)
+            {
+                /* pb_decode_tag() returned error before end of stream */
+                return false;
+            }
+
+            /* End of the current message */
+            if (!decode_frame_end(stream, frame))
+                return false;
+
+            if (frame == frames)
+                return true;
+
+            /* Continue with the parent message after the submessage */
+            stream->bytes_left = frame->parent_bytes_left;
+            frame--;
+            continue;
+        }
+
+        if (tag == 0)
+        {
+            if (frame == frames && (flags & PB_DECODE_NULLTERMINATED))
+            {
+                return decode_frame_end(stream, frame);
+            }
+            else
+            {
+                PB_RETURN_ERROR(stream, "zero tag");
+            }
+        }
+
+        if (!decode_frame_field(stream, frame, tag, wire_type, &submsg))
+            return false;
+
+        if (submsg)
+        {
+            /* Start decoding the submessage in the next frame, with the
+             * stream limited to its length like pb_make_string_substream()
+             * would do. */
+            const pb_field_iter_t *field = &frame->iter;
+            unsigned int subflags = 0;
+            uint32_t size;
+
+            if (!pb_decode_varint32(stream, &size))
+                return false;
+
+            if (stream->bytes_left < size)
+                PB_RETURN_ERROR(stream, "parent stream too short");
+
+            if (field->submsg_desc == NULL)
+                PB_RETURN_ERROR(stream, "invalid field descriptor");
+
+            if (frame == last)
+                PB_RETURN_ERROR(stream, "max depth exceeded");
+
+            /* Static required/optional fields are already initialized by
+             * the parent message, like in pb_dec_submessage(). */
+            if (PB_ATYPE(field->type) == PB_ATYPE_STATIC &&
+                PB_HTYPE(field->type) != PB_HTYPE_REPEATED)
+            {
+                subflags = PB_DECODE_NOINIT;
+            }
+
+            frame[1].parent_bytes_left = stream->bytes_left - size;
+            stream->bytes_left = size;
+
+            if (!decode_frame_begin(stream, frame + 1, field->submsg_desc, field->pData, subflags, NULL))
+                return false;
+
+            frame++;
+        }
+    }
+}
+
+bool checkreturn pb_decode_iterative(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, pb_decode_frame_t *frames, pb_size_t max_depth, unsigned int flags)
+{
+    bool status;
+
+    if ((flags & PB_DECODE_DELIMITED) == 0)
+    {
+      status = pb_decode_iterative_inner(stream, fields, dest_struct, frames, max_depth, flags);
+    }
+    else
+    {
+      pb_istream_t substream;
+      if (!pb_make_string_substream(stream, &substream))
+        return false;
+
+      status = pb_decode_iterative_inner(&substream, fields, dest_struct, frames, max_depth, flags);
+
+      if (!pb_close_string_substream(stream, &substream))
+        status = false;
+    }
+
+#ifdef PB_ENABLE_MALLOC
+    if (!status)
+        release_message(fields, dest_struct, !PB_USES_ARENA(stream));
+#endif
+
+    return status;
+}
+
+bool checkreturn pb_decode_masked(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, const pb_field_mask_t *mask, unsigned int flags)
+{
+    bool status;
+
+    if ((flags & PB_DECODE_DELIMITED) == 0)
+    {
+      status = pb_decode_inner(stream, fields, dest_struct, flags, mask);
+    }
+    else
+    {
+      pb_istream_t substream;
+      if (!pb_make_string_substream(stream, &substream))
+        return false;
+
+      status = pb_decode_inner(&substream, fields, dest_struct, flags, mask);
+
+      if (!pb_close_string_substream(stream, &substream))
+        status = false;
+    }
+    
+#ifdef PB_ENABLE_MALLOC
+    if (!status)
+        release_message(fields, dest_struct, !PB_USES_ARENA(stream));
+#endif
+    
+    return status;
+}
+
+bool checkreturn pb_decode_ex(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags)
+{
+    return pb_decode_masked(stream, fields, dest_struct, NULL, flags);
+}
+
+bool checkreturn pb_decode(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct)
+{
+    return pb_decode_ex(stream, fields, dest_struct, 0);
+}
+
+bool checkreturn pb_decode_lazy(const pb_view_t *view, const pb_msgdesc_t *fields, void *dest_struct)
+{
+    pb_istream_t stream = pb_istream_from_buffer(view->bytes, view->size);
+    return pb_decode(&stream, fields, dest_struct);
+}
+
+/* Stream for decoding one field of the incremental decoder */
+static pb_istream_t incremental_stream(const pb_decoder_t *decoder, const pb_byte_t *buf, size_t size)
+{
+    pb_istream_t stream = pb_istream_from_buffer(buf, size);
+
+    /* The chunks are not kept after pb_decoder_feed() returns */
+#ifdef PB_BUFFER_ONLY
+    stream.callback = &transient_buffer_marker;
+#else
+    stream.callback = &transient_buf_read;
+#endif
+
+#ifdef PB_ENABLE_ARENA
+    stream.arena = decoder->arena;
+#else
+    PB_UNUSED(decoder);
+#endif
+    return stream;
+}
+
+/* Report an error of the stream through the decoder and release the message */
+static bool incremental_failed(pb_decoder_t *decoder, const pb_istream_t *stream)
+{
+    PB_UNUSED(stream);
+    decoder->failed = true;
+
+#ifndef PB_NO_ERRMSG
+    if (decoder->errmsg == NULL)
+        decoder->errmsg = stream->errmsg;
+#endif
+
+#ifdef PB_ENABLE_MALLOC
+    release_message(decoder->frames[0].iter.descriptor, decoder->frames[0].iter.message,
+                    !PB_USES_ARENA(stream));
+#endif
+
+    return false;
+}
+
+/* Length of the varint at the start of buf, or 0 if it is not complete yet */
+static bool checkreturn varint_length(const pb_byte_t *buf, size_t size, size_t *length)
+{
+    size_t i;
+    for (i = 0; i < size && i < 10; i++)
+    {
+        if ((buf[i] & 0x80) == 0)
+        {
+            *length = i + 1;
+            return true;
+        }
+    }
+
+    *length = 0;
+    return i < 10;
+}
+
+/* Check if a field would be decoded as a submessage in the next frame */
+static bool frame_field_is_submsg(const pb_decode_frame_t *frame, uint32_t tag)
+{
+    pb_field_iter_t iter = frame->iter;
+    return pb_field_iter_find(&iter, tag) &&
+           PB_LTYPE(iter.type) == PB_LTYPE_SUBMESSAGE &&
+           PB_ATYPE(iter.type) != PB_ATYPE_CALLBACK;
+}
+
+/* Find the number of bytes needed to decode the next field from buf,
+ * which holds size bytes of the current message. The length is 0 if
+ * even the field header is not complete yet. A submessage that is
+ * not complete only needs its header, its fields are decoded one by one.
+ */
+static bool checkreturn incremental_field_length(pb_istream_t *stream, const pb_decode_frame_t *frame, const pb_byte_t *buf, size_t size, size_t *length)
+{
+    size_t tag_length;
+    size_t value_length;
+
+    *length = 0;
 
-    /* Descriptor for the structure field matching the tag decoded from stream */
-    pb_field_iter_t iter;
+    if (!varint_length(buf, size, &tag_length))
+        PB_RETURN_ERROR(stream, "varint overflow");
+
+    if (tag_length == 0)
+        return true;
 
-    if (pb_field_iter_begin(&iter, fields, dest_struct))
+    switch ((pb_wire_type_t)(buf[0] & 7))
     {
-        if ((flags & PB_DECODE_NOINIT) == 0)
+        case PB_WT_VARINT:
+            if (!varint_length(buf + tag_length, size - tag_length, &value_length))
+                PB_RETURN_ERROR(stream, "varint overflow");
+
+            if (value_length == 0)
+                return true;
+            break;
+
+        case PB_WT_64BIT:
+            value_length = 8;
+            break;
+
+        case PB_WT_32BIT:
+            value_length = 4;
+            break;
+
+        case PB_WT_STRING:
         {
-            if (!pb_message_set_to_defaults(&iter))
-                PB_RETURN_ERROR(stream, "failed to set defaults");
+            pb_istream_t header;
+            uint32_t tag, data_size;
+
+            if (!varint_length(buf + tag_length, size - tag_length, &value_length))
+                PB_RETURN_ERROR(stream, "varint overflow");
+
+            if (value_length == 0)
+                return true;
+
+            header = pb_istream_from_buffer(buf, tag_length + value_length);
+            if (!pb_decode_varint32(&header, &tag) || !pb_decode_varint32(&header, &data_size))
+                PB_RETURN_ERROR(stream, "varint overflow");
+
+            if (tag_length + value_length + data_size <= size ||
+                !frame_field_is_submsg(frame, tag >> 3))
+            {
+                value_length += data_size;
+            }
+            break;
         }
+
+        default:
+            /* Decoding the tag reports the error */
+            value_length = 0;
+            break;
     }
 
-    while (pb_decode_tag(stream, &wire_type, &tag, &eof))
+    *length = tag_length + value_length;
+    return true;
+}
+
+/* Finish the submessages that have been received completely */
+static bool checkreturn incremental_pop(pb_decoder_t *decoder)
+{
+    while (decoder->bytes_left == 0 && decoder->depth > 0)
     {
-        if (tag == 0)
-        {
-          if (flags & PB_DECODE_NULLTERMINATED)
-          {
-            eof = true;
+        pb_decode_frame_t *frame = &decoder->frames[decoder->depth];
+        pb_istream_t stream = incremental_stream(decoder, NULL, 0);
+
+        if (!decode_frame_end(&stream, frame))
+            return incremental_failed(decoder, &stream);
+
+        decoder->bytes_left = frame->parent_bytes_left;
+        decoder->depth--;
+    }
+
+    return true;
+}
+
+/* Decode all complete fields from buf and store the number of bytes used */
+static bool checkreturn incremental_decode(pb_decoder_t *decoder, const pb_byte_t *buf, size_t size, size_t *consumed)
+{
+    size_t pos = 0;
+
+    for (;;)
+    {
+        pb_decode_frame_t *frame;
+        pb_istream_t stream;
+        size_t available, length;
+        uint32_t tag;
+        pb_wire_type_t wire_type;
+        bool eof;
+        bool submsg = false;
+
+        if (!incremental_pop(decoder))
+            return false;
+
+        frame = &decoder->frames[decoder->depth];
+        available = size - pos;
+        if (available > decoder->bytes_left)
+            available = decoder->bytes_left;
+
+        if (available == 0)
             break;
-          }
-          else
-          {
-            PB_RETURN_ERROR(stream, "zero tag");
-          }
-        }
 
-        if (!pb_field_iter_find(&iter, tag) || PB_LTYPE(iter.type) == PB_LTYPE_EXTENSION)
+        stream = incremental_stream(decoder, buf + pos, available);
+        if (!incremental_field_length(&stream, frame, buf + pos, available, &length))
+            return incremental_failed(decoder, &stream);
+
+        if (length == 0 || length > available)
         {
-            /* No match found, check if it matches an extension. */
-            if (extension_range_start == 0)
+            /* Wait for more data, unless the field overruns its submessage */
+            if (available == decoder->bytes_left)
             {
-                if (pb_field_iter_find_extension(&iter))
-                {
-                    extensions = *(pb_extension_t* const *)iter.pData;
-                    extension_range_start = iter.tag;
-                }
-
-                if (!extensions)
-                {
-                    extension_range_start = (uint32_t)-1;
-                }
+                PB_SET_ERROR(decoder, "parent stream too short");
+                return incremental_failed(decoder, &stream);
             }
 
-            if (tag >= extension_range_start)
-            {
-                size_t pos = stream->bytes_left;
+            break;
+        }
 
-                if (!decode_extension(stream, tag, wire_type, extensions))
-                    return false;
+        stream.bytes_left = length;
 
-                if (pos != stream->bytes_left)
-                {
-                    /* The field was handled */
-                    continue;
-                }
-            }
+        if (!pb_decode_tag(&stream, &wire_type, &tag, &eof))
+            return incremental_failed(decoder, &stream);
 
-            /* No match found, skip data */
-            if (!pb_skip_field(stream, wire_type))
-                return false;
-            continue;
+        if (tag == 0)
+        {
+            PB_SET_ERROR(decoder, "zero tag");
+            return incremental_failed(decoder, &stream);
         }
 
-        /* If a repeated fixed count field was found, get size from
-         * 'fixed_count_field' as there is no counter contained in the struct.
-         */
-        if (PB_HTYPE(iter.type) == PB_HTYPE_REPEATED && iter.pSize == &iter.array_size)
+        if (!decode_frame_field(&stream, frame, tag, wire_type, &submsg))
+            return incremental_failed(decoder, &stream);
+
+        if (submsg)
         {
-            if (fixed_count_field != iter.index) {
-                /* If the new fixed count field does not match the previous one,
-                 * check that the previous one is NULL or that it finished
-                 * receiving all the expected data.
-                 */
-                if (fixed_count_field != PB_SIZE_MAX &&
-                    fixed_count_size != fixed_count_total_size)
-                {
-                    PB_RETURN_ERROR(stream, "wrong size for fixed count field");
-                }
+            /* Continue in the next frame with the fields of the submessage */
+            const pb_field_iter_t *field = &frame->iter;
+            unsigned int subflags = 0;
+            uint32_t data_size;
+
+            if (!pb_decode_varint32(&stream, &data_size))
+                return incremental_failed(decoder, &stream);
+
+            /* Only the header is consumed from the current message */
+            length -= stream.bytes_left;
+            if (data_size > decoder->bytes_left - length)
+            {
+                PB_SET_ERROR(decoder, "parent stream too short");
+                return incremental_failed(decoder, &stream);
+            }
 
-                fixed_count_field = iter.index;
-                fixed_count_size = 0;
-                fixed_count_total_size = iter.array_size;
+            if (field->submsg_desc == NULL)
+            {
+                PB_SET_ERROR(decoder, "invalid field descriptor");
+                return incremental_failed(decoder, &stream);
             }
 
-            iter.pSize = &fixed_count_size;
-        }
+            if (decoder->depth + 1 >= decoder->max_depth)
+            {
+                PB_SET_ERROR(decoder, "max depth exceeded");
+                return incremental_failed(decoder, &stream);
+            }
 
-        if (PB_HTYPE(iter.type) == PB_HTYPE_REQUIRED
-            && iter.required_field_index < PB_MAX_REQUIRED_FIELDS)
+            if (PB_ATYPE(field->type) == PB_ATYPE_STATIC &&
+                PB_HTYPE(field->type) != PB_HTYPE_REPEATED)
+            {
+                subflags = PB_DECODE_NOINIT;
+            }
+
+            if (!decode_frame_begin(&stream, frame + 1, field->submsg_desc, field->pData, subflags, NULL))
+                return incremental_failed(decoder, &stream);
+
+            frame[1].parent_bytes_left = decoder->bytes_left - length - data_size;
+            decoder->bytes_left = data_size;
+            decoder->depth++;
+        }
+        else
         {
-            uint32_t tmp = ((uint32_t)1 << (iter.required_field_index & 31));
-            fields_seen.bitfield[iter.required_field_index >> 5] |= tmp;
+            decoder->bytes_left -= length;
         }
 
-        if (!decode_field(stream, wire_type, &iter))
-            return false;
+        pos += length;
     }
 
-    if (!eof)
+    *consumed = pos;
+    return true;
+}
+
+bool checkreturn pb_decoder_init(pb_decoder_t *decoder, const pb_msgdesc_t *fields, void *dest_struct, pb_decode_frame_t *frames, pb_size_t max_depth, pb_byte_t *buffer, size_t buffer_size, unsigned int flags)
+{
+    pb_istream_t stream = pb_istream_from_buffer(NULL, 0);
+
+    decoder->frames = frames;
+    decoder->max_depth = max_depth;
+    decoder->depth = 0;
+    decoder->bytes_left = (size_t)-1;
+    decoder->buffer = buffer;
+    decoder->buffer_size = buffer_size;
+    decoder->buffered = 0;
+    decoder->failed = true;
+#ifndef PB_NO_ERRMSG
+    decoder->errmsg = NULL;
+#endif
+#ifdef PB_ENABLE_ARENA
+    decoder->arena = NULL;
+#endif
+
+    if (max_depth == 0)
+        PB_RETURN_ERROR(decoder, "max depth exceeded");
+
+    /* The end of the message is given by pb_decoder_finish() */
+    if (flags & (PB_DECODE_DELIMITED | PB_DECODE_NULLTERMINATED))
+        PB_RETURN_ERROR(decoder, "invalid flags");
+
+    if (!decode_frame_begin(&stream, frames, fields, dest_struct, flags, NULL))
     {
-        /* pb_decode_tag() returned error before end of stream */
+#ifndef PB_NO_ERRMSG
+        decoder->errmsg = stream.errmsg;
+#endif
         return false;
     }
 
-    /* Check that all elements of the last decoded fixed count field were present. */
-    if (fixed_count_field != PB_SIZE_MAX &&
-        fixed_count_size != fixed_count_total_size)
-    {
-        PB_RETURN_ERROR(stream, "wrong size for fixed count field");
-    }
+    decoder->failed = false;
+    return true;
+}
 
-    /* Check that all required fields were present. */
+bool checkreturn pb_decoder_feed(pb_decoder_t *decoder, const pb_byte_t *data, size_t size)
+{
+    size_t consumed;
+
+    if (decoder->failed)
+        return false;
+
+    /* Complete the field that was split between chunks */
+    while (decoder->buffered > 0 && size > 0)
     {
-        pb_size_t req_field_count = iter.descriptor->required_field_count;
+        size_t previous = decoder->buffered;
+        size_t count = decoder->buffer_size - previous;
 
-        if (req_field_count > 0)
+        if (count == 0)
         {
-            pb_size_t i;
+            pb_istream_t stream = incremental_stream(decoder, NULL, 0);
+            PB_SET_ERROR(decoder, "field too large for buffer");
+            return incremental_failed(decoder, &stream);
+        }
 
-            if (req_field_count > PB_MAX_REQUIRED_FIELDS)
-                req_field_count = PB_MAX_REQUIRED_FIELDS;
+        if (count > size)
+            count = size;
 
-            /* Check the whole words */
-            for (i = 0; i < (req_field_count >> 5); i++)
-            {
-                if (fields_seen.bitfield[i] != allbits)
-                    PB_RETURN_ERROR(stream, "missing required field");
-            }
+        memcpy(decoder->buffer + previous, data, count);
+        decoder->buffered += count;
 
-            /* Check the remaining bits (if any) */
-            if ((req_field_count & 31) != 0)
-            {
-                if (fields_seen.bitfield[req_field_count >> 5] !=
-                    (allbits >> (uint_least8_t)(32 - (req_field_count & 31))))
-                {
-                    PB_RETURN_ERROR(stream, "missing required field");
-                }
-            }
+        if (!incremental_decode(decoder, decoder->buffer, decoder->buffered, &consumed))
+            return false;
+
+        if (consumed > previous)
+        {
+            /* The rest of the buffer is still available in data */
+            data += consumed - previous;
+            size -= consumed - previous;
+            decoder->buffered = 0;
+        }
+        else
+        {
+            data += count;
+            size -= count;
+        }
+    }
+
+    if (size > 0)
+    {
+        if (!incremental_decode(decoder, data, size, &consumed))
+            return false;
+
+        /* Keep the incomplete field until the next chunk */
+        size -= consumed;
+        if (size > decoder->buffer_size)
+        {
+            pb_istream_t stream = incremental_stream(decoder, NULL, 0);
+            PB_SET_ERROR(decoder, "field too large for buffer");
+            return incremental_failed(decoder, &stream);
         }
+
+        if (size > 0)
+            memcpy(decoder->buffer, data + consumed, size);
+        decoder->buffered = size;
     }
 
     return true;
 }
 
-bool checkreturn pb_decode_ex(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, unsigned int flags)
+bool checkreturn pb_decoder_finish(pb_decoder_t *decoder)
 {
-    bool status;
+    pb_istream_t stream = incremental_stream(decoder, NULL, 0);
 
-    if ((flags & PB_DECODE_DELIMITED) == 0)
-    {
-      status = pb_decode_inner(stream, fields, dest_struct, flags);
-    }
-    else
-    {
-      pb_istream_t substream;
-      if (!pb_make_string_substream(stream, &substream))
+    if (decoder->failed)
         return false;
 
-      status = pb_decode_inner(&substream, fields, dest_struct, flags);
+    if (!incremental_pop(decoder))
+        return false;
 
-      if (!pb_close_string_substream(stream, &substream))
-        status = false;
+    if (decoder->buffered > 0 || decoder->depth > 0)
+    {
+        PB_SET_ERROR(decoder, "end-of-stream");
+        return incremental_failed(decoder, &stream);
     }
-    
-#ifdef PB_ENABLE_MALLOC
-    if (!status)
-        pb_release(fields, dest_struct);
-#endif
-    
-    return status;
-}
 
-bool checkreturn pb_decode(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct)
-{
-    return pb_decode_ex(stream, fields, dest_struct, 0);
+    if (!decode_frame_end(&stream, &decoder->frames[0]))
+        return incremental_failed(decoder, &stream);
+
+    return true;
 }
 
 #ifdef PB_ENABLE_MALLOC
@@ -1248,7 +2532,7 @@ static bool pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *field)
     if (!pb_field_iter_find(&old_field, old_tag))
         PB_RETURN_ERROR(stream, "invalid union tag");
 
-    pb_release_single_field(&old_field);
+    pb_release_single_field(&old_field, !PB_USES_ARENA(stream));
 
     if (PB_ATYPE(field->type) == PB_ATYPE_POINTER)
     {
@@ -1261,7 +2545,9 @@ static bool pb_release_union_field(pb_istream_t *stream, pb_field_iter_t *field)
     return true;
 }
 
-static void pb_release_single_field(pb_field_iter_t *field)
+/* Release the memory allocated for a field. If free_memory is false, the
+ * memory belongs to an arena and the pointers are only cleared. */
+static void pb_release_single_field(pb_field_iter_t *field, bool free_memory)
 {
     pb_type_t type;
     type = field->type;
@@ -1284,7 +2570,7 @@ static void pb_release_single_field(pb_field_iter_t *field)
             pb_field_iter_t ext_iter;
             if (pb_field_iter_begin_extension(&ext_iter, ext))
             {
-                pb_release_single_field(&ext_iter);
+                pb_release_single_field(&ext_iter, free_memory);
             }
             ext = ext->next;
         }
@@ -1318,7 +2604,7 @@ static void pb_release_single_field(pb_field_iter_t *field)
         {
             for (; count > 0; count--)
             {
-                pb_release(field->submsg_desc, field->pData);
+                release_message(field->submsg_desc, field->pData, free_memory);
                 field->pData = (char*)field->pData + field->data_size;
             }
         }
@@ -1335,7 +2621,8 @@ static void pb_release_single_field(pb_field_iter_t *field)
             pb_size_t count = *(pb_size_t*)field->pSize;
             for (; count > 0; count--)
             {
-                pb_free(*pItem);
+                if (free_memory)
+                    pb_free(*pItem);
                 *pItem++ = NULL;
             }
         }
@@ -1347,12 +2634,13 @@ static void pb_release_single_field(pb_field_iter_t *field)
         }
         
         /* Release main pointer */
-        pb_free(*(void**)field->pField);
+        if (free_memory)
+            pb_free(*(void**)field->pField);
         *(void**)field->pField = NULL;
     }
 }
 
-void pb_release(const pb_msgdesc_t *fields, void *dest_struct)
+static void release_message(const pb_msgdesc_t *fields, void *dest_struct, bool free_memory)
 {
     pb_field_iter_t iter;
     
@@ -1364,9 +2652,29 @@ void pb_release(const pb_msgdesc_t *fields, void *dest_struct)
     
     do
     {
-        pb_release_single_field(&iter);
+        pb_release_single_field(&iter, free_memory);
     } while (pb_field_iter_next(&iter));
 }
+
+void pb_release(const pb_msgdesc_t *fields, void *dest_struct)
+{
+    release_message(fields, dest_struct, true);
+}
+
+#ifdef PB_ENABLE_ARENA
+void pb_arena_init(pb_arena_t *arena, void *buffer, size_t size)
+{
+    arena->buffer = (pb_byte_t*)buffer;
+    arena->size = size;
+    pb_arena_reset(arena);
+}
+
+void pb_arena_reset(pb_arena_t *arena)
+{
+    arena->used = 0;
+    arena->last = 0;
+}
+#endif
 #else
 void pb_release(const pb_msgdesc_t *fields, void *dest_struct)
 {
@@ -1457,13 +2765,13 @@ static bool checkreturn pb_dec_bool(pb_istream_t *stream, const pb_field_iter_t
     return pb_decode_bool(stream, (bool*)field->pData);
 }
 
-static bool checkreturn pb_dec_varint(pb_istream_t *stream, const pb_field_iter_t *field)
+/* Convert a decoded varint value to the field type and store it to
+ * field->pData, while checking for overflows. */
+static bool checkreturn pb_store_varint(pb_istream_t *stream, const pb_field_iter_t *field, pb_uint64_t value)
 {
     if (PB_LTYPE(field->type) == PB_LTYPE_UVARINT)
     {
-        pb_uint64_t value, clamped;
-        if (!pb_decode_varint(stream, &value))
-            return false;
+        pb_uint64_t clamped;
 
         /* Cast to the proper field size, while checking for overflows */
         if (field->data_size == sizeof(pb_uint64_t))
@@ -1484,20 +2792,19 @@ static bool checkreturn pb_dec_varint(pb_istream_t *stream, const pb_field_iter_
     }
     else
     {
-        pb_uint64_t value;
         pb_int64_t svalue;
         pb_int64_t clamped;
 
         if (PB_LTYPE(field->type) == PB_LTYPE_SVARINT)
         {
-            if (!pb_decode_svarint(stream, &svalue))
-                return false;
+            /* Zigzag decoding, same as pb_decode_svarint() */
+            if (value & 1)
+                svalue = (pb_int64_t)(~(value >> 1));
+            else
+                svalue = (pb_int64_t)(value >> 1);
         }
         else
         {
-            if (!pb_decode_varint(stream, &value))
-                return false;
-
             /* See issue 97: Google's C++ protobuf allows negative varint values to
             * be cast as int32_t, instead of the int64_t that should be used when
             * encoding. Nanopb versions before 0.2.5 had a bug in encoding. In order to
@@ -1529,6 +2836,105 @@ static bool checkreturn pb_dec_varint(pb_istream_t *stream, const pb_field_iter_
     }
 }
 
+static bool checkreturn pb_dec_varint(pb_istream_t *stream, const pb_field_iter_t *field)
+{
+    pb_uint64_t value;
+    if (!pb_decode_varint(stream, &value))
+        return false;
+
+    return pb_store_varint(stream, field, value);
+}
+
+/* Decode elements of a packed varint array directly from a memory
+ * buffer stream, as long as a complete varint is guaranteed to fit in
+ * the remaining data. The rest of the elements, and any invalid values,
+ * are left for the normal per-element decoding. */
+static bool checkreturn pb_dec_packed_varints(pb_istream_t *stream, pb_field_iter_t *field)
+{
+    const pb_byte_t *buf = (const pb_byte_t*)stream->state;
+    pb_size_t *size = (pb_size_t*)field->pSize;
+    size_t pos = 0;
+    bool status = true;
+
+    while (stream->bytes_left - pos >= PB_VARINT_MAX_LENGTH && *size < field->array_size)
+    {
+        pb_uint64_t value;
+#ifdef PB_WITHOUT_64BIT
+        size_t len = decode_varint32_buffer(buf + pos, &value);
+#else
+        size_t len = decode_varint_buffer(buf + pos, &value);
+#endif
+        if (len == 0)
+            break;
+
+        pos += len;
+
+        if (!pb_store_varint(stream, field, value))
+        {
+            status = false;
+            break;
+        }
+
+        (*size)++;
+        field->pData = (char*)field->pData + field->data_size;
+    }
+
+    stream->state = (pb_byte_t*)stream->state + pos;
+    stream->bytes_left -= pos;
+    return status;
+}
+
+/* Decode elements of a packed fixed32 or fixed64 array with a single
+ * read, and convert the byte order afterwards if needed. Elements that
+ * do not fit in the array are left for the normal per-element decoding. */
+static bool checkreturn pb_dec_packed_fixed(pb_istream_t *stream, pb_field_iter_t *field)
+{
+    pb_size_t *size = (pb_size_t*)field->pSize;
+    size_t count = stream->bytes_left / field->data_size;
+
+    if (count > (size_t)(field->array_size - *size))
+        count = (size_t)(field->array_size - *size);
+
+    if (!pb_read(stream, (pb_byte_t*)field->pData, count * field->data_size))
+        return false;
+
+#if !defined(PB_LITTLE_ENDIAN_8BIT) || PB_LITTLE_ENDIAN_8BIT != 1
+    {
+        pb_byte_t *p = (pb_byte_t*)field->pData;
+        size_t i;
+
+        for (i = 0; i < count; i++)
+        {
+            if (field->data_size == 4)
+            {
+                *(uint32_t*)p = ((uint32_t)p[0] << 0) |
+                                ((uint32_t)p[1] << 8) |
+                                ((uint32_t)p[2] << 16) |
+                                ((uint32_t)p[3] << 24);
+            }
+#ifndef PB_WITHOUT_64BIT
+            else
+            {
+                *(uint64_t*)p = ((uint64_t)p[0] << 0) |
+                                ((uint64_t)p[1] << 8) |
+                                ((uint64_t)p[2] << 16) |
+                                ((uint64_t)p[3] << 24) |
+                                ((uint64_t)p[4] << 32) |
+                                ((uint64_t)p[5] << 40) |
+                                ((uint64_t)p[6] << 48) |
+                                ((uint64_t)p[7] << 56);
+            }
+#endif
+            p += field->data_size;
+        }
+    }
+#endif
+
+    *size = (pb_size_t)(*size + count);
+    field->pData = (char*)field->pData + count * field->data_size;
+    return true;
+}
+
 static bool checkreturn pb_dec_bytes(pb_istream_t *stream, const pb_field_iter_t *field)
 {
     uint32_t size;
@@ -1662,7 +3068,7 @@ static bool checkreturn pb_dec_submessage(pb_istream_t *stream, const pb_field_i
             flags = PB_DECODE_NOINIT;
         }
 
-        status = pb_decode_inner(&substream, field->submsg_desc, field->pData, flags);
+        status = pb_decode_inner(&substream, field->submsg_desc, field->pData, flags, NULL);
     }
     
     if (!pb_close_string_substream(stream, &substream))
@@ -1694,6 +3100,28 @@ static bool checkreturn pb_dec_fixed_length_bytes(pb_istream_t *stream, const pb
     return pb_read(stream, (pb_byte_t*)field->pData, (size_t)field->data_size);
 }
 
+static bool checkreturn pb_dec_view(pb_istream_t *stream, const pb_field_iter_t *field)
+{
+    uint32_t size;
+    pb_view_t *view = (pb_view_t*)field->pData;
+
+    if (!pb_decode_varint32(stream, &size))
+        return false;
+
+    /* The view points directly to the data in the input buffer */
+    if (!PB_IS_BUFFER_ISTREAM(stream) || PB_IS_TRANSIENT_ISTREAM(stream))
+        PB_RETURN_ERROR(stream, "view needs buffer stream");
+
+    if (stream->bytes_left < size)
+        PB_RETURN_ERROR(stream, "end-of-stream");
+
+    /* Strings, bytes and lazy submessages share this type, so string
+     * views are not checked with PB_VALIDATE_UTF8. */
+    view->bytes = (const pb_byte_t*)stream->state;
+    view->size = (size_t)size;
+    return pb_read(stream, NULL, (size_t)size);
+}
+
 #ifdef PB_CONVERT_DOUBLE_FLOAT
 bool pb_decode_double_as_float(pb_istream_t *stream, float *dest)
 {
@@ -12,6 +12,40 @@
 extern "C" {
 #endif
 
+#ifdef PB_ENABLE_ARENA
+/* Memory region for allocating pointer fields during decoding.
+ * Allocations are made sequentially from the buffer, and all of
+ * them are released at once by pb_arena_reset().
+ */
+typedef struct pb_arena_s pb_arena_t;
+struct pb_arena_s
+{
+    pb_byte_t *buffer;  /* Start of the memory region */
+    size_t size;        /* Total size of the region */
+    size_t used;        /* Number of bytes allocated so far */
+    size_t last;        /* Offset of the most recent allocation */
+};
+#endif
+
+#ifndef PB_BUFFER_ONLY
+/* Refill buffer for pb_istream_from_read_buffer(). Data is read from the
+ * source in large blocks, and the decoder takes its input from the buffer.
+ */
+typedef struct pb_read_buffer_s pb_read_buffer_t;
+struct pb_read_buffer_s
+{
+    /* Read up to count bytes into buf and store the number of bytes read
+     * in *actual, which may be less than count. Set *actual to 0 at the
+     * end of input. Return false on IO errors. */
+    bool (*read)(void *source, pb_byte_t *buf, size_t count, size_t *actual);
+    void *source;       /* Passed to the read function */
+    pb_byte_t *buf;     /* Start of the refill buffer */
+    size_t size;        /* Total size of the refill buffer */
+    size_t start;       /* Offset of the next unread byte */
+    size_t end;         /* Offset after the last valid byte */
+};
+#endif
+
 /* Structure for defining custom input streams. You will need to provide
  * a callback function to read the bytes from your storage, which can be
  * for example a file or a network socket.
@@ -54,14 +88,80 @@ struct pb_istream_s
     /* Pointer to constant (ROM) string when decoding function returns error */
     const char *errmsg;
 #endif
+
+#ifdef PB_ENABLE_ARENA
+    /* If not NULL, pointer fields are allocated from this arena instead
+     * of using pb_realloc(). Streams that are not created with
+     * pb_istream_from_buffer() or PB_ISTREAM_EMPTY must set this to NULL. */
+    pb_arena_t *arena;
+#endif
 };
 
-#ifndef PB_NO_ERRMSG
+#if !defined(PB_NO_ERRMSG) && defined(PB_ENABLE_ARENA)
+#define PB_ISTREAM_EMPTY {0,0,0,0,0}
+#elif !defined(PB_NO_ERRMSG) || defined(PB_ENABLE_ARENA)
 #define PB_ISTREAM_EMPTY {0,0,0,0}
 #else
 #define PB_ISTREAM_EMPTY {0,0,0}
 #endif
 
+/* Allocated capacity of the repeated pointer field that was grown most
+ * recently. Arrays grow geometrically, but the spare capacity is only
+ * used for arrays the decoder itself allocated. Only one array per
+ * message level is tracked, so when items of two repeated fields
+ * alternate, each item reallocates its array. */
+typedef struct pb_array_alloc_s pb_array_alloc_t;
+#ifdef PB_ENABLE_MALLOC
+struct pb_array_alloc_s {
+    void *array;
+    size_t capacity;
+};
+#endif
+
+/* Decoding state of one nesting level for pb_decode_iterative().
+ * The contents are internal to the decoder. */
+typedef struct pb_decode_frame_s pb_decode_frame_t;
+struct pb_decode_frame_s
+{
+    pb_field_iter_t iter;               /* Message and the field being decoded */
+    const pb_field_mask_t *mask;        /* Mask for pb_decode_masked(), or NULL */
+    pb_extension_t *extensions;         /* Extensions of the message, if any */
+    uint32_t extension_range_start;     /* Smallest tag handled by extensions */
+    size_t parent_bytes_left;           /* Remaining length of the parent message */
+    pb_size_t fixed_count_field;        /* Index of the repeated fixed count field */
+    pb_size_t fixed_count_size;         /* Number of its elements decoded so far */
+    pb_size_t fixed_count_total_size;   /* Number of its elements expected */
+    uint32_t fields_seen[(PB_MAX_REQUIRED_FIELDS + 31) / 32]; /* Required fields present */
+#ifdef PB_ENABLE_MALLOC
+    pb_array_alloc_t array_alloc;
+#endif
+};
+
+/* State of the incremental decoder, see pb_decoder_init().
+ * The contents are internal to the decoder, except for errmsg and arena. */
+typedef struct pb_decoder_s pb_decoder_t;
+struct pb_decoder_s
+{
+    pb_decode_frame_t *frames;  /* Frame for each nesting level */
+    pb_size_t max_depth;        /* Number of frames */
+    pb_size_t depth;            /* Index of the current frame */
+    size_t bytes_left;          /* Remaining length of the current submessage */
+    pb_byte_t *buffer;          /* Holds a field that was split between chunks */
+    size_t buffer_size;         /* Total size of the buffer */
+    size_t buffered;            /* Number of bytes in the buffer */
+    bool failed;                /* Set after an error, decoding cannot continue */
+
+#ifndef PB_NO_ERRMSG
+    /* Pointer to constant (ROM) string when decoding function returns error */
+    const char *errmsg;
+#endif
+
+#ifdef PB_ENABLE_ARENA
+    /* If not NULL, pointer fields are allocated from this arena */
+    pb_arena_t *arena;
+#endif
+};
+
 /***************************
  * Main decoding functions *
  ***************************/
@@ -118,12 +218,99 @@ bool pb_decode_ex(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_s
 #define pb_decode_delimited_noinit(s,f,d) pb_decode_ex(s,f,d, PB_DECODE_DELIMITED | PB_DECODE_NOINIT)
 #define pb_decode_nullterminated(s,f,d) pb_decode_ex(s,f,d, PB_DECODE_NULLTERMINATED)
 
+/* Same as pb_decode_ex(), but only decodes the fields included in the mask
+ * generated by the (nanopb_msgopt).decode_mask option. Other fields and
+ * extensions are skipped, and are neither initialized nor stored. The
+ * structure should therefore be initialized before the call, for example
+ * with MyMessage_init_zero.
+ *
+ * Example usage:
+ *    MyMessage msg = MyMessage_init_zero;
+ *    pb_decode_masked(&stream, MyMessage_fields, &msg, &MyMessage_decode_mask, 0);
+ */
+bool pb_decode_masked(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, const pb_field_mask_t *mask, unsigned int flags);
+
+/* Decode a submessage stored by a field with the (nanopb).lazy option.
+ * The view points to the input buffer of the outer message, which must
+ * still be valid. A view that was not set decodes as an empty message.
+ *
+ * Example usage:
+ *    Envelope env;
+ *    Payload payload;
+ *    pb_decode(&stream, Envelope_fields, &env);
+ *    pb_decode_lazy(&env.payload, Payload_fields, &payload);
+ */
+bool pb_decode_lazy(const pb_view_t *view, const pb_msgdesc_t *fields, void *dest_struct);
+
+/* Same as pb_decode_ex(), but decodes nested submessages in a single loop
+ * instead of recursive function calls. The state of each nesting level is
+ * kept in the frames array, which is provided by the caller and limits the
+ * nesting depth to max_depth levels, including the top-level message.
+ * Deeper input fails with "max depth exceeded". Submessages that have
+ * callbacks or are stored in extensions are still decoded recursively.
+ *
+ * Example usage:
+ *    pb_decode_frame_t frames[16];
+ *    pb_decode_iterative(&stream, MyMessage_fields, &msg, frames, 16, 0);
+ */
+bool pb_decode_iterative(pb_istream_t *stream, const pb_msgdesc_t *fields, void *dest_struct, pb_decode_frame_t *frames, pb_size_t max_depth, unsigned int flags);
+
+/* Incremental decoding of a message that arrives in chunks, e.g. from a
+ * non-blocking socket. pb_decoder_init() starts decoding into dest_struct,
+ * pb_decoder_feed() decodes the fields that are complete in the next chunk
+ * of input, and pb_decoder_finish() checks the message after the last chunk.
+ *
+ * The frames array limits the nesting depth like in pb_decode_iterative().
+ * Submessages are entered as soon as their header has arrived, so only
+ * other fields (strings, bytes, packed arrays, submessages with callbacks)
+ * that are split between chunks are copied to the buffer. A split field
+ * larger than buffer_size fails with "field too large for buffer".
+ * The flags can be 0 or PB_DECODE_NOINIT. FT_VIEW and lazy fields cannot
+ * be decoded, because the chunks are not kept after pb_decoder_feed().
+ *
+ * After an error, the message has been released and further calls return
+ * false until the decoder is initialized again. The error message is in
+ * decoder->errmsg.
+ *
+ * Example usage:
+ *    pb_decoder_t decoder;
+ *    pb_decode_frame_t frames[8];
+ *    pb_byte_t buffer[64];
+ *    pb_decoder_init(&decoder, MyMessage_fields, &msg, frames, 8, buffer, sizeof(buffer), 0);
+ *    while ((count = recv(sock, chunk, sizeof(chunk), 0)) > 0)
+ *        pb_decoder_feed(&decoder, chunk, count);
+ *    pb_decoder_finish(&decoder);
+ */
+bool pb_decoder_init(pb_decoder_t *decoder, const pb_msgdesc_t *fields, void *dest_struct, pb_decode_frame_t *frames, pb_size_t max_depth, pb_byte_t *buffer, size_t buffer_size, unsigned int flags);
+bool pb_decoder_feed(pb_decoder_t *decoder, const pb_byte_t *data, size_t size);
+bool pb_decoder_finish(pb_decoder_t *decoder);
+
 /* Release any allocated pointer fields. If you use dynamic allocation, you should
  * call this for any successfully decoded message when you are done with it. If
  * pb_decode() returns with an error, the message is already released.
  */
 void pb_release(const pb_msgdesc_t *fields, void *dest_struct);
 
+#ifdef PB_ENABLE_ARENA
+/* Initialize an arena for decoding pointer fields. The buffer should be
+ * aligned suitably for any field type, e.g. allocated with malloc().
+ *
+ * Example usage:
+ *    static uint64_t storage[256];
+ *    pb_arena_t arena;
+ *    pb_arena_init(&arena, storage, sizeof(storage));
+ *
+ *    stream = pb_istream_from_buffer(buffer, count);
+ *    stream.arena = &arena;
+ *    pb_decode(&stream, MyMessage_fields, &msg);
+ *
+ * Messages decoded into an arena must not be passed to pb_release().
+ * Instead, all of them are released at once with pb_arena_reset().
+ */
+void pb_arena_init(pb_arena_t *arena, void *buffer, size_t size);
+void pb_arena_reset(pb_arena_t *arena);
+#endif
+
 /**************************************
  * Functions for manipulating streams *
  **************************************/
@@ -138,6 +325,30 @@ void pb_release(const pb_msgdesc_t *fields, void *dest_struct);
  */
 pb_istream_t pb_istream_from_buffer(const pb_byte_t *buf, size_t msglen);
 
+#ifndef PB_BUFFER_ONLY
+/* Create an input stream that reads through a refill buffer. Instead of
+ * calling the read function for each byte, the data is read in blocks
+ * of up to bufsize bytes, and the decoder reads it directly from the buffer.
+ *
+ * The read buffer can be reused for consecutive messages, for example
+ * delimited messages from a socket. Any data read ahead past the end of
+ * one message remains in the buffer for the next stream.
+ *
+ * Example usage:
+ *    pb_byte_t buffer[256];
+ *    pb_read_buffer_t rb;
+ *    pb_istream_t stream;
+ *
+ *    pb_read_buffer_init(&rb, &socket_read, &fd, buffer, sizeof(buffer));
+ *    stream = pb_istream_from_read_buffer(&rb, SIZE_MAX);
+ *    pb_decode_ex(&stream, MyMessage_fields, &msg, PB_DECODE_DELIMITED);
+ */
+void pb_read_buffer_init(pb_read_buffer_t *rb,
+                         bool (*read)(void *source, pb_byte_t *buf, size_t count, size_t *actual),
+                         void *source, pb_byte_t *buf, size_t bufsize);
+pb_istream_t pb_istream_from_read_buffer(pb_read_buffer_t *rb, size_t msglen);
+#endif
+
 /* Function to read from a pb_istream_t. You can use this if you need to
  * read some custom header data, or to read data in field callbacks.
  */
@@ -22,21 +22,38 @@
  * Declarations internal to this file *
  **************************************/
 static bool checkreturn buf_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
+#ifndef PB_BUFFER_ONLY
+static bool checkreturn iovec_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
+static bool checkreturn iovec_write_reference(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
+static bool checkreturn buffered_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
+static bool checkreturn encoder_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
+static bool checkreturn encoder_write_reference(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
+#endif
+#ifndef PB_ENCODE_ARRAYS_UNPACKED
+static bool checkreturn packed_array_size(pb_ostream_t *stream, const pb_field_iter_t *field, pb_size_t count, size_t *size);
+#endif
 static bool checkreturn encode_array(pb_ostream_t *stream, pb_field_iter_t *field);
+static bool checkreturn check_field_present(pb_ostream_t *stream, const pb_field_iter_t *field, bool *present);
 static bool checkreturn pb_check_proto3_default_value(const pb_field_iter_t *field);
 static bool checkreturn encode_basic_field(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn encode_callback_field(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn encode_field(pb_ostream_t *stream, pb_field_iter_t *field);
 static pb_noinline bool checkreturn encode_extension_field(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn default_extension_encoder(pb_ostream_t *stream, const pb_extension_t *extension);
+static size_t varint_bytes_32(pb_byte_t *buffer, uint32_t low, uint32_t high);
 static bool checkreturn pb_encode_varint_32(pb_ostream_t *stream, uint32_t low, uint32_t high);
+static bool checkreturn encode_submessage_buffer(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src_struct);
 static bool checkreturn pb_enc_bool(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_enc_varint(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_enc_fixed(pb_ostream_t *stream, const pb_field_iter_t *field);
+#ifndef PB_ENCODE_ARRAYS_UNPACKED
+static bool checkreturn pb_enc_fixed_array(pb_ostream_t *stream, const pb_field_iter_t *field, pb_size_t count);
+#endif
 static bool checkreturn pb_enc_bytes(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_enc_string(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_enc_submessage(pb_ostream_t *stream, const pb_field_iter_t *field);
 static bool checkreturn pb_enc_fixed_length_bytes(pb_ostream_t *stream, const pb_field_iter_t *field);
+static bool checkreturn pb_enc_view(pb_ostream_t *stream, const pb_field_iter_t *field);
 
 #ifdef PB_WITHOUT_64BIT
 #define pb_int64_t int32_t
@@ -46,6 +63,29 @@ static bool checkreturn pb_enc_fixed_length_bytes(pb_ostream_t *stream, const pb
 #define pb_uint64_t uint64_t
 #endif
 
+static bool checkreturn read_unsigned_field(pb_ostream_t *stream, const pb_field_iter_t *field, pb_uint64_t *value);
+static bool checkreturn read_signed_field(pb_ostream_t *stream, const pb_field_iter_t *field, pb_int64_t *value);
+static pb_uint64_t zigzag_encode(pb_int64_t value);
+static bool checkreturn scalar_size(pb_ostream_t *stream, const pb_field_iter_t *field, size_t *size);
+
+/* Count leading zeros instruction, used for computing varint length */
+#if (defined(__GNUC__) && __GNUC__ >= 4) || defined(__clang__)
+#define PB_HAVE_BUILTIN_CLZ 1
+#endif
+
+/* Varints are produced with 64-bit shifts only on 64-bit hosts,
+ * as they are quite slow on many smaller platforms. */
+#if !defined(PB_WITHOUT_64BIT) && defined(UINTPTR_MAX) && UINTPTR_MAX > 0xFFFFFFFFUL
+#define PB_VARINT_SHIFT64 1
+#endif
+
+/* Memory buffer streams can be accessed directly through stream->state */
+#ifdef PB_BUFFER_ONLY
+#define PB_IS_BUFFER_OSTREAM(stream) ((stream)->callback != NULL)
+#else
+#define PB_IS_BUFFER_OSTREAM(stream) ((stream)->callback == buf_write)
+#endif
+
 /*******************************
  * pb_ostream_t implementation *
  *******************************/
@@ -86,9 +126,166 @@ pb_ostream_t pb_ostream_from_buffer(pb_byte_t *buf, size_t bufsize)
     stream.bytes_written = 0;
 #ifndef PB_NO_ERRMSG
     stream.errmsg = NULL;
+#endif
+#ifdef PB_ENCODE_SIZE_CACHE
+    stream.size_cache = NULL;
+#endif
+    return stream;
+}
+
+#ifndef PB_BUFFER_ONLY
+static bool checkreturn iovec_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count)
+{
+    pb_iovec_state_t *state = (pb_iovec_state_t*)stream->state;
+    pb_byte_t *dest = state->buf + state->buf_used;
+    pb_iovec_t *last = NULL;
+
+    if (count > state->buf_size - state->buf_used)
+        PB_RETURN_ERROR(stream, "iovec buffer full");
+
+    /* Continue the previous segment if it ends where this data begins */
+    if (state->iov_count > 0)
+        last = &state->iov[state->iov_count - 1];
+
+    if (last == NULL || last->base + last->len != dest)
+    {
+        if (state->iov_count >= state->iov_max)
+            PB_RETURN_ERROR(stream, "iovec full");
+
+        last = &state->iov[state->iov_count++];
+        last->base = dest;
+        last->len = 0;
+    }
+
+    memcpy(dest, buf, count * sizeof(pb_byte_t));
+    last->len += count;
+    state->buf_used += count;
+    return true;
+}
+
+/* Add a segment that refers directly to the data instead of copying it */
+static bool checkreturn iovec_write_reference(pb_ostream_t *stream, const pb_byte_t *buf, size_t count)
+{
+    pb_iovec_state_t *state = (pb_iovec_state_t*)stream->state;
+
+    if (stream->bytes_written + count < stream->bytes_written ||
+        stream->bytes_written + count > stream->max_size)
+    {
+        PB_RETURN_ERROR(stream, "stream full");
+    }
+
+    if (state->iov_count >= state->iov_max)
+        PB_RETURN_ERROR(stream, "iovec full");
+
+    state->iov[state->iov_count].base = buf;
+    state->iov[state->iov_count].len = count;
+    state->iov_count++;
+    stream->bytes_written += count;
+    return true;
+}
+
+pb_ostream_t pb_ostream_from_iovec(pb_iovec_state_t *state, pb_iovec_t *iov, size_t iov_max,
+                                   pb_byte_t *buf, size_t bufsize, size_t threshold)
+{
+    pb_ostream_t stream;
+    state->iov = iov;
+    state->iov_max = iov_max;
+    state->iov_count = 0;
+    state->buf = buf;
+    state->buf_size = bufsize;
+    state->buf_used = 0;
+    state->threshold = threshold;
+
+    stream.callback = &iovec_write;
+    stream.state = state;
+    stream.max_size = (size_t)-1;
+    stream.bytes_written = 0;
+#ifndef PB_NO_ERRMSG
+    stream.errmsg = NULL;
+#endif
+#ifdef PB_ENCODE_SIZE_CACHE
+    stream.size_cache = NULL;
+#endif
+    return stream;
+}
+
+static bool checkreturn buffered_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count)
+{
+    pb_write_buffer_t *wb = (pb_write_buffer_t*)stream->state;
+
+    while (count > wb->size - wb->used)
+    {
+        size_t len = wb->size - wb->used;
+
+        /* Large writes bypass the buffer */
+        if (wb->used == 0)
+            return wb->write(wb->dest, buf, count);
+
+        /* Fill the buffer completely before writing it out */
+        memcpy(wb->buf + wb->used, buf, len * sizeof(pb_byte_t));
+        buf += len;
+        count -= len;
+
+        if (!wb->write(wb->dest, wb->buf, wb->size))
+            return false;
+
+        wb->used = 0;
+    }
+
+    memcpy(wb->buf + wb->used, buf, count * sizeof(pb_byte_t));
+    wb->used += count;
+    return true;
+}
+
+void pb_write_buffer_init(pb_write_buffer_t *wb,
+                          bool (*write)(void *dest, const pb_byte_t *buf, size_t count),
+                          void *dest, pb_byte_t *buf, size_t bufsize)
+{
+    wb->write = write;
+    wb->dest = dest;
+    wb->buf = buf;
+    wb->size = bufsize;
+    wb->used = 0;
+}
+
+pb_ostream_t pb_ostream_from_write_buffer(pb_write_buffer_t *wb, size_t max_size)
+{
+    pb_ostream_t stream;
+    stream.callback = &buffered_write;
+    stream.state = wb;
+    stream.max_size = max_size;
+    stream.bytes_written = 0;
+#ifndef PB_NO_ERRMSG
+    stream.errmsg = NULL;
+#endif
+#ifdef PB_ENCODE_SIZE_CACHE
+    stream.size_cache = NULL;
 #endif
     return stream;
 }
+#endif
+
+bool checkreturn pb_flush(pb_ostream_t *stream)
+{
+#ifndef PB_BUFFER_ONLY
+    if (stream->callback == &buffered_write)
+    {
+        pb_write_buffer_t *wb = (pb_write_buffer_t*)stream->state;
+
+        if (wb->used > 0)
+        {
+            if (!wb->write(wb->dest, wb->buf, wb->used))
+                PB_RETURN_ERROR(stream, "io error");
+
+            wb->used = 0;
+        }
+    }
+#else
+    PB_UNUSED(stream);
+#endif
+
+    return true;
+}
 
 bool checkreturn pb_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count)
 {
@@ -133,6 +330,37 @@ static bool safe_read_bool(const void *pSize)
     return false;
 }
 
+#ifndef PB_ENCODE_ARRAYS_UNPACKED
+/* Determine the total size of packed array. */
+static bool checkreturn packed_array_size(pb_ostream_t *stream, const pb_field_iter_t *field, pb_size_t count, size_t *size)
+{
+    if (PB_LTYPE(field->type) == PB_LTYPE_FIXED32)
+    {
+        *size = 4 * (size_t)count;
+    }
+    else if (PB_LTYPE(field->type) == PB_LTYPE_FIXED64)
+    {
+        *size = 8 * (size_t)count;
+    }
+    else
+    {
+        pb_field_iter_t item = *field;
+        pb_size_t i;
+        *size = 0;
+        for (i = 0; i < count; i++)
+        {
+            size_t item_size;
+            if (!scalar_size(stream, &item, &item_size))
+                return false;
+            *size += item_size;
+            item.pData = (char*)item.pData + item.data_size;
+        }
+    }
+
+    return true;
+}
+#endif
+
 /* Encode a static array. Handles the size calculations and possible packing. */
 static bool checkreturn encode_array(pb_ostream_t *stream, pb_field_iter_t *field)
 {
@@ -157,28 +385,8 @@ static bool checkreturn encode_array(pb_ostream_t *stream, pb_field_iter_t *fiel
         if (!pb_encode_tag(stream, PB_WT_STRING, field->tag))
             return false;
         
-        /* Determine the total size of packed array. */
-        if (PB_LTYPE(field->type) == PB_LTYPE_FIXED32)
-        {
-            size = 4 * (size_t)count;
-        }
-        else if (PB_LTYPE(field->type) == PB_LTYPE_FIXED64)
-        {
-            size = 8 * (size_t)count;
-        }
-        else
-        { 
-            pb_ostream_t sizestream = PB_OSTREAM_SIZING;
-            void *pData_orig = field->pData;
-            for (i = 0; i < count; i++)
-            {
-                if (!pb_enc_varint(&sizestream, field))
-                    PB_RETURN_ERROR(stream, PB_GET_ERROR(&sizestream));
-                field->pData = (char*)field->pData + field->data_size;
-            }
-            field->pData = pData_orig;
-            size = sizestream.bytes_written;
-        }
+        if (!packed_array_size(stream, field, count, &size))
+            return false;
         
         if (!pb_encode_varint(stream, (pb_uint64_t)size))
             return false;
@@ -186,6 +394,16 @@ static bool checkreturn encode_array(pb_ostream_t *stream, pb_field_iter_t *fiel
         if (stream->callback == NULL)
             return pb_write(stream, NULL, size); /* Just sizing.. */
         
+        if ((PB_LTYPE(field->type) == PB_LTYPE_FIXED32 && field->data_size == 4)
+#ifndef PB_WITHOUT_64BIT
+            || (PB_LTYPE(field->type) == PB_LTYPE_FIXED64 && field->data_size == 8)
+#endif
+           )
+        {
+            /* Write the whole array at once */
+            return pb_enc_fixed_array(stream, field, count);
+        }
+
         /* Write the data */
         for (i = 0; i < count; i++)
         {
@@ -319,6 +537,11 @@ static bool checkreturn pb_check_proto3_default_value(const pb_field_iter_t *fie
              * it anyway. */
             return field->data_size == 0;
         }
+        else if (PB_LTYPE(type) == PB_LTYPE_VIEW)
+        {
+            const pb_view_t *view = (const pb_view_t*)field->pData;
+            return view->size == 0;
+        }
         else if (PB_LTYPE_IS_SUBMSG(type))
         {
             /* Check all fields in the submessage to find if any of them
@@ -376,6 +599,17 @@ static bool checkreturn encode_basic_field(pb_ostream_t *stream, const pb_field_
         return true;
     }
 
+    if (stream->callback == NULL && PB_LTYPE(field->type) <= PB_LTYPE_LAST_PACKABLE)
+    {
+        /* Sizing stream only needs the length of scalar fields */
+        size_t size;
+        if (!scalar_size(stream, field, &size))
+            return false;
+
+        stream->bytes_written += pb_varint_size((pb_uint64_t)field->tag << 3) + size;
+        return true;
+    }
+
     if (!pb_encode_tag_for_field(stream, field))
         return false;
 
@@ -406,6 +640,9 @@ static bool checkreturn encode_basic_field(pb_ostream_t *stream, const pb_field_
         case PB_LTYPE_FIXED_LENGTH_BYTES:
             return pb_enc_fixed_length_bytes(stream, field);
 
+        case PB_LTYPE_VIEW:
+            return pb_enc_view(stream, field);
+
         default:
             PB_RETURN_ERROR(stream, "invalid field type");
     }
@@ -423,10 +660,11 @@ static bool checkreturn encode_callback_field(pb_ostream_t *stream, const pb_fie
     return true;
 }
 
-/* Encode a single field of any callback, pointer or static type. */
-static bool checkreturn encode_field(pb_ostream_t *stream, pb_field_iter_t *field)
+/* Check whether a field has a value to encode. */
+static bool checkreturn check_field_present(pb_ostream_t *stream, const pb_field_iter_t *field, bool *present)
 {
-    /* Check field presence */
+    *present = false;
+
     if (PB_HTYPE(field->type) == PB_HTYPE_ONEOF)
     {
         if (*(const pb_size_t*)field->pSize != field->tag)
@@ -462,6 +700,22 @@ static bool checkreturn encode_field(pb_ostream_t *stream, pb_field_iter_t *fiel
         return true;
     }
 
+    *present = true;
+    return true;
+}
+
+/* Encode a single field of any callback, pointer or static type. */
+static bool checkreturn encode_field(pb_ostream_t *stream, pb_field_iter_t *field)
+{
+    bool present;
+
+    /* Check field presence */
+    if (!check_field_present(stream, field, &present))
+        return false;
+
+    if (!present)
+        return true;
+
     /* Then encode field contents */
     if (PB_ATYPE(field->type) == PB_ATYPE_CALLBACK)
     {
@@ -574,144 +828,563 @@ bool pb_get_encoded_size(size_t *size, const pb_msgdesc_t *fields, const void *s
     return true;
 }
 
-/********************
- * Helper functions *
- ********************/
-
-/* This function avoids 64-bit shifts as they are quite slow on many platforms. */
-static bool checkreturn pb_encode_varint_32(pb_ostream_t *stream, uint32_t low, uint32_t high)
+#ifdef PB_ENCODE_SIZE_CACHE
+bool checkreturn pb_encode_ex_cached(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src_struct,
+                                     unsigned int flags, size_t *size_cache, size_t cache_count)
 {
-    size_t i = 0;
-    pb_byte_t buffer[10];
-    pb_byte_t byte = (pb_byte_t)(low & 0x7F);
-    low >>= 7;
+    pb_ostream_t sizestream = PB_OSTREAM_SIZING;
+    pb_size_cache_t *prev_cache = stream->size_cache;
+    pb_size_cache_t cache;
+    bool status;
 
-    while (i < 4 && (low != 0 || high != 0))
-    {
-        byte |= 0x80;
-        buffer[i++] = byte;
-        byte = (pb_byte_t)(low & 0x7F);
-        low >>= 7;
-    }
+    /* Record the submessage sizes in a sizing pass */
+    cache.sizes = size_cache;
+    cache.count = cache_count;
+    cache.index = 0;
+    sizestream.size_cache = &cache;
 
-    if (high)
+    if (!pb_encode_ex(&sizestream, fields, src_struct, flags))
     {
-        byte = (pb_byte_t)(byte | ((high & 0x07) << 4));
-        high >>= 3;
-
-        while (high)
-        {
-            byte |= 0x80;
-            buffer[i++] = byte;
-            byte = (pb_byte_t)(high & 0x7F);
-            high >>= 7;
-        }
+#ifndef PB_NO_ERRMSG
+        stream->errmsg = sizestream.errmsg;
+#endif
+        return false;
     }
 
-    buffer[i++] = byte;
+    /* Encode again, using only the entries that were recorded */
+    if (cache.index < cache.count)
+        cache.count = cache.index;
+    cache.index = 0;
 
-    return pb_write(stream, buffer, i);
+    stream->size_cache = &cache;
+    status = pb_encode_ex(stream, fields, src_struct, flags);
+    stream->size_cache = prev_cache;
+    return status;
 }
-
-bool checkreturn pb_encode_varint(pb_ostream_t *stream, pb_uint64_t value)
-{
-    if (value <= 0x7F)
-    {
-        /* Fast path: single byte */
-        pb_byte_t byte = (pb_byte_t)value;
-        return pb_write(stream, &byte, 1);
-    }
-    else
-    {
-#ifdef PB_WITHOUT_64BIT
-        return pb_encode_varint_32(stream, value, 0);
-#else
-        return pb_encode_varint_32(stream, (uint32_t)value, (uint32_t)(value >> 32));
 #endif
-    }
-}
 
-bool checkreturn pb_encode_svarint(pb_ostream_t *stream, pb_int64_t value)
+#ifndef PB_BUFFER_ONLY
+/* Collect the encoded data of one field in the encoder buffer */
+static bool checkreturn encoder_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count)
 {
-    pb_uint64_t zigzagged;
-    pb_uint64_t mask = ((pb_uint64_t)-1) >> 1; /* Satisfy clang -fsanitize=integer */
-    if (value < 0)
-        zigzagged = ~(((pb_uint64_t)value & mask) << 1);
-    else
-        zigzagged = (pb_uint64_t)value << 1;
-    
-    return pb_encode_varint(stream, zigzagged);
-}
+    pb_encoder_t *encoder = (pb_encoder_t*)stream->state;
 
-bool checkreturn pb_encode_fixed32(pb_ostream_t *stream, const void *value)
-{
-#if defined(PB_LITTLE_ENDIAN_8BIT) && PB_LITTLE_ENDIAN_8BIT == 1
-    /* Fast path if we know that we're on little endian */
-    return pb_write(stream, (const pb_byte_t*)value, 4);
-#else
-    uint32_t val = *(const uint32_t*)value;
-    pb_byte_t bytes[4];
-    bytes[0] = (pb_byte_t)(val & 0xFF);
-    bytes[1] = (pb_byte_t)((val >> 8) & 0xFF);
-    bytes[2] = (pb_byte_t)((val >> 16) & 0xFF);
-    bytes[3] = (pb_byte_t)((val >> 24) & 0xFF);
-    return pb_write(stream, bytes, 4);
-#endif
+    if (encoder->data_left > 0 || count > encoder->buffer_size - encoder->buffer_end)
+        PB_RETURN_ERROR(stream, "field too large for buffer");
+
+    memcpy(encoder->buffer + encoder->buffer_end, buf, count * sizeof(pb_byte_t));
+    encoder->buffer_end += count;
+    return true;
 }
 
-#ifndef PB_WITHOUT_64BIT
-bool checkreturn pb_encode_fixed64(pb_ostream_t *stream, const void *value)
+/* Write string or bytes data directly from the message structure
+ * after the buffered field header */
+static bool checkreturn encoder_write_reference(pb_ostream_t *stream, const pb_byte_t *buf, size_t count)
 {
-#if defined(PB_LITTLE_ENDIAN_8BIT) && PB_LITTLE_ENDIAN_8BIT == 1
-    /* Fast path if we know that we're on little endian */
-    return pb_write(stream, (const pb_byte_t*)value, 8);
-#else
-    uint64_t val = *(const uint64_t*)value;
-    pb_byte_t bytes[8];
-    bytes[0] = (pb_byte_t)(val & 0xFF);
-    bytes[1] = (pb_byte_t)((val >> 8) & 0xFF);
-    bytes[2] = (pb_byte_t)((val >> 16) & 0xFF);
-    bytes[3] = (pb_byte_t)((val >> 24) & 0xFF);
-    bytes[4] = (pb_byte_t)((val >> 32) & 0xFF);
-    bytes[5] = (pb_byte_t)((val >> 40) & 0xFF);
-    bytes[6] = (pb_byte_t)((val >> 48) & 0xFF);
-    bytes[7] = (pb_byte_t)((val >> 56) & 0xFF);
-    return pb_write(stream, bytes, 8);
-#endif
+    pb_encoder_t *encoder = (pb_encoder_t*)stream->state;
+    encoder->data = buf;
+    encoder->data_left = count;
+    stream->bytes_written += count;
+    return true;
 }
-#endif
 
-bool checkreturn pb_encode_tag(pb_ostream_t *stream, pb_wire_type_t wiretype, uint32_t field_number)
+/* Move to the next field of the frame */
+static void encoder_next_field(pb_encode_frame_t *frame)
 {
-    pb_uint64_t tag = ((pb_uint64_t)field_number << 3) | wiretype;
-    return pb_encode_varint(stream, tag);
+    frame->index = 0;
+    frame->packed = false;
+    frame->finished = !pb_field_iter_next(&frame->iter);
 }
 
-bool pb_encode_tag_for_field ( pb_ostream_t* stream, const pb_field_iter_t* field )
+/* Encode the next field or array item of the frame into the encoder buffer.
+ * Submessages only get their header encoded, and their fields are then
+ * encoded in the next frame. */
+static bool checkreturn encoder_step(pb_ostream_t *stream, pb_encoder_t *encoder, pb_encode_frame_t *frame)
 {
-    pb_wire_type_t wiretype;
-    switch (PB_LTYPE(field->type))
+    pb_field_iter_t *field = &frame->iter;
+    pb_field_iter_t item;
+    pb_size_t count = 1;
+
+    if (frame->index == 0 && !frame->packed)
     {
-        case PB_LTYPE_BOOL:
-        case PB_LTYPE_VARINT:
-        case PB_LTYPE_UVARINT:
-        case PB_LTYPE_SVARINT:
-            wiretype = PB_WT_VARINT;
-            break;
-        
-        case PB_LTYPE_FIXED32:
-            wiretype = PB_WT_32BIT;
-            break;
-        
-        case PB_LTYPE_FIXED64:
-            wiretype = PB_WT_64BIT;
+        bool present;
+
+        if (PB_LTYPE(field->type) == PB_LTYPE_EXTENSION)
+        {
+            /* Extensions are encoded as a whole */
+            if (!encode_extension_field(stream, field))
+                return false;
+
+            encoder_next_field(frame);
+            return true;
+        }
+
+        if (!check_field_present(stream, field, &present))
+            return false;
+
+        if (!present)
+        {
+            encoder_next_field(frame);
+            return true;
+        }
+
+        if (PB_ATYPE(field->type) == PB_ATYPE_CALLBACK)
+        {
+            /* The callback can only be called once, so the whole field
+             * must fit in the buffer. */
+            if (!encode_callback_field(stream, field))
+                return false;
+
+            encoder_next_field(frame);
+            return true;
+        }
+    }
+
+    if (PB_HTYPE(field->type) == PB_HTYPE_REPEATED)
+    {
+        count = *(const pb_size_t*)field->pSize;
+
+        if (frame->index == 0 && !frame->packed)
+        {
+            if (count == 0)
+            {
+                encoder_next_field(frame);
+                return true;
+            }
+
+            if (PB_ATYPE(field->type) != PB_ATYPE_POINTER && count > field->array_size)
+                PB_RETURN_ERROR(stream, "array max size exceeded");
+
+#ifndef PB_ENCODE_ARRAYS_UNPACKED
+            if (PB_LTYPE(field->type) <= PB_LTYPE_LAST_PACKABLE)
+            {
+                size_t size;
+
+                if (!pb_encode_tag(stream, PB_WT_STRING, field->tag))
+                    return false;
+
+                if (!packed_array_size(stream, field, count, &size))
+                    return false;
+
+                frame->packed = true;
+                return pb_encode_varint(stream, (pb_uint64_t)size);
+            }
+#endif
+        }
+    }
+
+    item = *field;
+    item.pData = (char*)field->pData + field->data_size * frame->index;
+
+    if (++frame->index >= count)
+        encoder_next_field(frame);
+
+#ifndef PB_ENCODE_ARRAYS_UNPACKED
+    if (PB_HTYPE(item.type) == PB_HTYPE_REPEATED && PB_LTYPE(item.type) <= PB_LTYPE_LAST_PACKABLE)
+    {
+        /* Item of packed array */
+        if (PB_LTYPE(item.type) == PB_LTYPE_FIXED32 || PB_LTYPE(item.type) == PB_LTYPE_FIXED64)
+            return pb_enc_fixed(stream, &item);
+        else
+            return pb_enc_varint(stream, &item);
+    }
+#endif
+
+    if (PB_HTYPE(item.type) == PB_HTYPE_REPEATED &&
+        PB_ATYPE(item.type) == PB_ATYPE_POINTER &&
+        (PB_LTYPE(item.type) == PB_LTYPE_STRING ||
+         PB_LTYPE(item.type) == PB_LTYPE_BYTES))
+    {
+        item.pData = *(void* const*)item.pData;
+
+        if (!item.pData)
+        {
+            /* Null pointer in array is treated as empty string / bytes */
+            return pb_encode_tag_for_field(stream, &item) &&
+                   pb_encode_varint(stream, 0);
+        }
+    }
+
+    if (PB_LTYPE(item.type) == PB_LTYPE_SUBMESSAGE)
+    {
+        pb_ostream_t sizestream = PB_OSTREAM_SIZING;
+        pb_encode_frame_t *child = frame + 1;
+
+        if (item.submsg_desc == NULL)
+            PB_RETURN_ERROR(stream, "invalid field descriptor");
+
+        if (encoder->depth + 1 >= encoder->max_depth)
+            PB_RETURN_ERROR(stream, "max depth exceeded");
+
+        if (!pb_encode(&sizestream, item.submsg_desc, item.pData))
+        {
+#ifndef PB_NO_ERRMSG
+            stream->errmsg = sizestream.errmsg;
+#endif
+            return false;
+        }
+
+        if (!pb_encode_tag_for_field(stream, &item) ||
+            !pb_encode_varint(stream, (pb_uint64_t)sizestream.bytes_written))
+        {
+            return false;
+        }
+
+        child->index = 0;
+        child->packed = false;
+        child->finished = !pb_field_iter_begin_const(&child->iter, item.submsg_desc, item.pData);
+        encoder->depth++;
+        return true;
+    }
+
+    /* String and bytes data is written directly from the structure */
+    encoder->reference_data = (PB_LTYPE(item.type) == PB_LTYPE_STRING ||
+                               PB_LTYPE(item.type) == PB_LTYPE_BYTES ||
+                               PB_LTYPE(item.type) == PB_LTYPE_FIXED_LENGTH_BYTES ||
+                               PB_LTYPE(item.type) == PB_LTYPE_VIEW);
+
+    if (!encode_basic_field(stream, &item))
+        return false;
+
+    encoder->reference_data = false;
+    return true;
+}
+
+/* Encode the next part of the message into the encoder buffer. Nothing is
+ * encoded when the message is complete. */
+static bool checkreturn encoder_next(pb_encoder_t *encoder)
+{
+    pb_ostream_t stream;
+
+    stream.callback = &encoder_write;
+    stream.state = encoder;
+    stream.max_size = (size_t)-1;
+    stream.bytes_written = 0;
+#ifndef PB_NO_ERRMSG
+    stream.errmsg = NULL;
+#endif
+#ifdef PB_ENCODE_SIZE_CACHE
+    stream.size_cache = NULL;
+#endif
+
+    encoder->buffer_start = 0;
+    encoder->buffer_end = 0;
+    encoder->data_left = 0;
+    encoder->reference_data = false;
+
+    while (encoder->buffer_end == 0)
+    {
+        pb_encode_frame_t *frame = &encoder->frames[encoder->depth];
+
+        if (frame->finished)
+        {
+            if (encoder->depth == 0)
+                break;
+
+            encoder->depth--;
+        }
+        else if (!encoder_step(&stream, encoder, frame))
+        {
+#ifndef PB_NO_ERRMSG
+            encoder->errmsg = stream.errmsg;
+#endif
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool checkreturn pb_encoder_init(pb_encoder_t *encoder, const pb_msgdesc_t *fields, const void *src_struct, pb_encode_frame_t *frames, pb_size_t max_depth, pb_byte_t *buffer, size_t buffer_size)
+{
+    encoder->frames = frames;
+    encoder->max_depth = max_depth;
+    encoder->depth = 0;
+    encoder->buffer = buffer;
+    encoder->buffer_size = buffer_size;
+    encoder->buffer_start = 0;
+    encoder->buffer_end = 0;
+    encoder->data = NULL;
+    encoder->data_left = 0;
+    encoder->reference_data = false;
+#ifndef PB_NO_ERRMSG
+    encoder->errmsg = NULL;
+#endif
+
+    if (max_depth == 0)
+        PB_RETURN_ERROR(encoder, "max depth exceeded");
+
+    frames[0].index = 0;
+    frames[0].packed = false;
+    frames[0].finished = !pb_field_iter_begin_const(&frames[0].iter, fields, src_struct);
+    return true;
+}
+
+bool checkreturn pb_encoder_fill(pb_encoder_t *encoder, pb_byte_t *buf, size_t size, size_t *written)
+{
+    size_t pos = 0;
+
+    while (pos < size)
+    {
+        size_t count = encoder->buffer_end - encoder->buffer_start;
+        const pb_byte_t *src = encoder->buffer + encoder->buffer_start;
+
+        if (count == 0)
+        {
+            count = encoder->data_left;
+            src = encoder->data;
+        }
+
+        if (count == 0)
+        {
+            if (!encoder_next(encoder))
+            {
+                *written = pos;
+                return false;
+            }
+
+            if (encoder->buffer_end == 0)
+                break; /* Message is complete */
+
+            continue;
+        }
+
+        if (count > size - pos)
+            count = size - pos;
+
+        memcpy(buf + pos, src, count * sizeof(pb_byte_t));
+        pos += count;
+
+        if (encoder->buffer_start < encoder->buffer_end)
+        {
+            encoder->buffer_start += count;
+        }
+        else
+        {
+            encoder->data += count;
+            encoder->data_left -= count;
+        }
+    }
+
+    *written = pos;
+    return true;
+}
+#endif
+
+/********************
+ * Helper functions *
+ ********************/
+
+/* Write the varint bytes to buffer, which must have space for 10 bytes.
+ * This function avoids 64-bit shifts as they are quite slow on many platforms. */
+static size_t varint_bytes_32(pb_byte_t *buffer, uint32_t low, uint32_t high)
+{
+    size_t i = 0;
+    pb_byte_t byte = (pb_byte_t)(low & 0x7F);
+    low >>= 7;
+
+    while (i < 4 && (low != 0 || high != 0))
+    {
+        byte |= 0x80;
+        buffer[i++] = byte;
+        byte = (pb_byte_t)(low & 0x7F);
+        low >>= 7;
+    }
+
+    if (high)
+    {
+        byte = (pb_byte_t)(byte | ((high & 0x07) << 4));
+        high >>= 3;
+
+        while (high)
+        {
+            byte |= 0x80;
+            buffer[i++] = byte;
+            byte = (pb_byte_t)(high & 0x7F);
+            high >>= 7;
+        }
+    }
+
+    buffer[i++] = byte;
+    return i;
+}
+
+static bool checkreturn pb_encode_varint_32(pb_ostream_t *stream, uint32_t low, uint32_t high)
+{
+    size_t size;
+
+    if (PB_IS_BUFFER_OSTREAM(stream) && stream->max_size - stream->bytes_written >= 10)
+    {
+        /* Write directly to the memory buffer */
+        pb_byte_t *dest = (pb_byte_t*)stream->state;
+        size = varint_bytes_32(dest, low, high);
+        stream->state = dest + size;
+        stream->bytes_written += size;
+        return true;
+    }
+    else
+    {
+        pb_byte_t buffer[10];
+        size = varint_bytes_32(buffer, low, high);
+        return pb_write(stream, buffer, size);
+    }
+}
+
+size_t pb_varint_size(pb_uint64_t value)
+{
+#if defined(PB_HAVE_BUILTIN_CLZ) && !defined(PB_WITHOUT_64BIT)
+    /* For n significant bits, (9 * (n - 1) + 73) / 64 equals n / 7 rounded up */
+    return (size_t)((63 - __builtin_clzll(value | 1)) * 9 + 73) / 64;
+#else
+    size_t size = 1;
+    while (value > 0x7F)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+#endif
+}
+
+bool checkreturn pb_encode_varint(pb_ostream_t *stream, pb_uint64_t value)
+{
+    if (value <= 0x7F)
+    {
+        /* Fast path: single byte */
+        pb_byte_t byte = (pb_byte_t)value;
+        return pb_write(stream, &byte, 1);
+    }
+    else if (stream->callback == NULL)
+    {
+        /* Sizing stream only needs the length */
+        stream->bytes_written += pb_varint_size(value);
+        return true;
+    }
+#ifdef PB_VARINT_SHIFT64
+    else if (PB_IS_BUFFER_OSTREAM(stream) && stream->max_size - stream->bytes_written >= 10)
+    {
+        /* Length is known beforehand, so the bytes are written without
+         * checking the value after each one. */
+        pb_byte_t *dest = (pb_byte_t*)stream->state;
+        size_t size = pb_varint_size(value);
+        size_t i;
+
+        for (i = 1; i < size; i++)
+        {
+            dest[i - 1] = (pb_byte_t)(value | 0x80);
+            value >>= 7;
+        }
+        dest[size - 1] = (pb_byte_t)value;
+
+        stream->state = dest + size;
+        stream->bytes_written += size;
+        return true;
+    }
+#endif
+    else
+    {
+#ifdef PB_WITHOUT_64BIT
+        return pb_encode_varint_32(stream, value, 0);
+#else
+        return pb_encode_varint_32(stream, (uint32_t)value, (uint32_t)(value >> 32));
+#endif
+    }
+}
+
+static pb_uint64_t zigzag_encode(pb_int64_t value)
+{
+    pb_uint64_t mask = ((pb_uint64_t)-1) >> 1; /* Satisfy clang -fsanitize=integer */
+    if (value < 0)
+        return ~(((pb_uint64_t)value & mask) << 1);
+    else
+        return (pb_uint64_t)value << 1;
+}
+
+bool checkreturn pb_encode_svarint(pb_ostream_t *stream, pb_int64_t value)
+{
+    return pb_encode_varint(stream, zigzag_encode(value));
+}
+
+bool checkreturn pb_encode_fixed32(pb_ostream_t *stream, const void *value)
+{
+#if defined(PB_LITTLE_ENDIAN_8BIT) && PB_LITTLE_ENDIAN_8BIT == 1
+    /* Fast path if we know that we're on little endian */
+    return pb_write(stream, (const pb_byte_t*)value, 4);
+#else
+    uint32_t val = *(const uint32_t*)value;
+    pb_byte_t bytes[4];
+    bytes[0] = (pb_byte_t)(val & 0xFF);
+    bytes[1] = (pb_byte_t)((val >> 8) & 0xFF);
+    bytes[2] = (pb_byte_t)((val >> 16) & 0xFF);
+    bytes[3] = (pb_byte_t)((val >> 24) & 0xFF);
+    return pb_write(stream, bytes, 4);
+#endif
+}
+
+#ifndef PB_WITHOUT_64BIT
+bool checkreturn pb_encode_fixed64(pb_ostream_t *stream, const void *value)
+{
+#if defined(PB_LITTLE_ENDIAN_8BIT) && PB_LITTLE_ENDIAN_8BIT == 1
+    /* Fast path if we know that we're on little endian */
+    return pb_write(stream, (const pb_byte_t*)value, 8);
+#else
+    uint64_t val = *(const uint64_t*)value;
+    pb_byte_t bytes[8];
+    bytes[0] = (pb_byte_t)(val & 0xFF);
+    bytes[1] = (pb_byte_t)((val >> 8) & 0xFF);
+    bytes[2] = (pb_byte_t)((val >> 16) & 0xFF);
+    bytes[3] = (pb_byte_t)((val >> 24) & 0xFF);
+    bytes[4] = (pb_byte_t)((val >> 32) & 0xFF);
+    bytes[5] = (pb_byte_t)((val >> 40) & 0xFF);
+    bytes[6] = (pb_byte_t)((val >> 48) & 0xFF);
+    bytes[7] = (pb_byte_t)((val >> 56) & 0xFF);
+    return pb_write(stream, bytes, 8);
+#endif
+}
+#endif
+
+bool checkreturn pb_encode_tag(pb_ostream_t *stream, pb_wire_type_t wiretype, uint32_t field_number)
+{
+    pb_uint64_t tag = ((pb_uint64_t)field_number << 3) | wiretype;
+    return pb_encode_varint(stream, tag);
+}
+
+bool pb_encode_tag_for_field ( pb_ostream_t* stream, const pb_field_iter_t* field )
+{
+    pb_wire_type_t wiretype;
+
+#ifdef PB_PRECOMPUTED_TAGS
+    if (field->descriptor->field_tags != NULL)
+    {
+        const pb_field_tag_t *tag = &field->descriptor->field_tags[field->index];
+        return pb_write(stream, tag->bytes, tag->size);
+    }
+#endif
+
+    switch (PB_LTYPE(field->type))
+    {
+        case PB_LTYPE_BOOL:
+        case PB_LTYPE_VARINT:
+        case PB_LTYPE_UVARINT:
+        case PB_LTYPE_SVARINT:
+            wiretype = PB_WT_VARINT;
+            break;
+        
+        case PB_LTYPE_FIXED32:
+            wiretype = PB_WT_32BIT;
+            break;
+        
+        case PB_LTYPE_FIXED64:
+            wiretype = PB_WT_64BIT;
             break;
         
         case PB_LTYPE_BYTES:
         case PB_LTYPE_STRING:
         case PB_LTYPE_SUBMESSAGE:
         case PB_LTYPE_SUBMSG_W_CB:
+        case PB_LTYPE_SUBMSG_STREAM:
         case PB_LTYPE_FIXED_LENGTH_BYTES:
+        case PB_LTYPE_VIEW:
             wiretype = PB_WT_STRING;
             break;
         
@@ -726,40 +1399,176 @@ bool checkreturn pb_encode_string(pb_ostream_t *stream, const pb_byte_t *buffer,
 {
     if (!pb_encode_varint(stream, (pb_uint64_t)size))
         return false;
+
+#ifndef PB_BUFFER_ONLY
+    if (stream->callback == &iovec_write && size > 0 &&
+        size >= ((const pb_iovec_state_t*)stream->state)->threshold)
+    {
+        return iovec_write_reference(stream, buffer, size);
+    }
+
+    if (stream->callback == &encoder_write && size > 0 &&
+        ((const pb_encoder_t*)stream->state)->reference_data)
+    {
+        return encoder_write_reference(stream, buffer, size);
+    }
+#endif
     
     return pb_write(stream, buffer, size);
 }
 
+/* Encode submessage into a memory buffer in a single pass. Space for
+ * the length prefix is reserved based on the remaining buffer size, and
+ * the message data is moved back afterwards if the length turns out to
+ * need fewer bytes. */
+static bool checkreturn encode_submessage_buffer(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src_struct)
+{
+    pb_byte_t *start = (pb_byte_t*)stream->state;
+    size_t space = stream->max_size - stream->bytes_written;
+    size_t reserved = pb_varint_size((pb_uint64_t)space);
+    size_t size, length;
+    pb_ostream_t substream;
+#ifdef PB_ENCODE_SIZE_CACHE
+    size_t cache_index = stream->size_cache ? stream->size_cache->index : 0;
+#endif
+
+    if (space < reserved)
+        PB_RETURN_ERROR(stream, "stream full");
+
+    substream = *stream;
+    substream.state = start + reserved;
+    substream.max_size = space - reserved;
+    substream.bytes_written = 0;
+#ifndef PB_NO_ERRMSG
+    substream.errmsg = NULL;
+#endif
+
+    if (!pb_encode(&substream, fields, src_struct))
+    {
+        /* A message that exactly fills the buffer has a shorter length
+         * prefix than the one reserved above, so it may not fit in the
+         * remaining space. Calculate the actual size and try again. */
+        pb_ostream_t sizestream = PB_OSTREAM_SIZING;
+
+        if (reserved <= 1 || !pb_encode(&sizestream, fields, src_struct))
+        {
+#ifndef PB_NO_ERRMSG
+            stream->errmsg = substream.errmsg;
+#endif
+            return false;
+        }
+
+        size = sizestream.bytes_written;
+        reserved = pb_varint_size((pb_uint64_t)size);
+        if (size > space || reserved > space - size)
+            PB_RETURN_ERROR(stream, "stream full");
+
+        substream = *stream;
+        substream.state = start + reserved;
+        substream.max_size = size;
+        substream.bytes_written = 0;
+#ifndef PB_NO_ERRMSG
+        substream.errmsg = NULL;
+#endif
+#ifdef PB_ENCODE_SIZE_CACHE
+        if (stream->size_cache)
+            stream->size_cache->index = cache_index;
+#endif
+
+        if (!pb_encode(&substream, fields, src_struct))
+        {
+#ifndef PB_NO_ERRMSG
+            stream->errmsg = substream.errmsg;
+#endif
+            return false;
+        }
+    }
+
+    size = substream.bytes_written;
+    length = pb_varint_size((pb_uint64_t)size);
+
+    if (length < reserved)
+        memmove(start + length, start + reserved, size);
+
+    {
+        pb_ostream_t lenstream = pb_ostream_from_buffer(start, length);
+        if (!pb_encode_varint(&lenstream, (pb_uint64_t)size))
+            PB_RETURN_ERROR(stream, PB_GET_ERROR(&lenstream));
+    }
+
+    stream->state = start + length + size;
+    stream->bytes_written += length + size;
+    return true;
+}
+
 bool checkreturn pb_encode_submessage(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src_struct)
 {
-    /* First calculate the message size using a non-writing substream. */
     pb_ostream_t substream = PB_OSTREAM_SIZING;
+    size_t size;
 #if !defined(PB_NO_ENCODE_SIZE_CHECK) || PB_NO_ENCODE_SIZE_CHECK == 0
     bool status;
-    size_t size;
 #endif
-    
-    if (!pb_encode(&substream, fields, src_struct))
+#ifdef PB_ENCODE_SIZE_CACHE
+    size_t *cached = NULL;
+
+    if (stream->size_cache != NULL)
     {
+        /* Submessages are numbered in the order they are encountered,
+         * which is the same in the sizing pass and in the actual encoding. */
+        pb_size_cache_t *cache = stream->size_cache;
+        if (cache->index < cache->count)
+            cached = &cache->sizes[cache->index];
+        cache->index++;
+    }
+
+    if (cached != NULL && stream->callback != NULL)
+    {
+        /* Size was recorded by the sizing pass of pb_encode_ex_cached() */
+        size = *cached;
+    }
+    else
+#endif
+    if (PB_IS_BUFFER_OSTREAM(stream))
+    {
+        /* Memory buffers can be encoded without the sizing pass */
+        return encode_submessage_buffer(stream, fields, src_struct);
+    }
+    else
+    {
+        /* First calculate the message size using a non-writing substream. */
+#ifdef PB_ENCODE_SIZE_CACHE
+        if (stream->callback == NULL)
+            substream.size_cache = stream->size_cache;
+#endif
+
+        if (!pb_encode(&substream, fields, src_struct))
+        {
 #ifndef PB_NO_ERRMSG
-        stream->errmsg = substream.errmsg;
+            stream->errmsg = substream.errmsg;
+#endif
+            return false;
+        }
+
+        size = substream.bytes_written;
+
+#ifdef PB_ENCODE_SIZE_CACHE
+        if (cached != NULL)
+            *cached = size;
 #endif
-        return false;
     }
     
-    if (!pb_encode_varint(stream, (pb_uint64_t)substream.bytes_written))
+    if (!pb_encode_varint(stream, (pb_uint64_t)size))
         return false;
     
     if (stream->callback == NULL)
-        return pb_write(stream, NULL, substream.bytes_written); /* Just sizing */
+        return pb_write(stream, NULL, size); /* Just sizing */
     
-    if (stream->bytes_written + substream.bytes_written > stream->max_size)
+    if (stream->bytes_written + size > stream->max_size)
         PB_RETURN_ERROR(stream, "stream full");
         
 #if defined(PB_NO_ENCODE_SIZE_CHECK) && PB_NO_ENCODE_SIZE_CHECK == 1
     return pb_encode(stream, fields, src_struct);
 #else
-    size = substream.bytes_written;
     /* Use a substream to verify that a callback doesn't write more than
      * what it did the first time. */
     substream.callback = stream->callback;
@@ -769,6 +1578,9 @@ bool checkreturn pb_encode_submessage(pb_ostream_t *stream, const pb_msgdesc_t *
 #ifndef PB_NO_ERRMSG
     substream.errmsg = NULL;
 #endif
+#ifdef PB_ENCODE_SIZE_CACHE
+    substream.size_cache = stream->size_cache;
+#endif
     
     status = pb_encode(&substream, fields, src_struct);
     
@@ -794,41 +1606,55 @@ static bool checkreturn pb_enc_bool(pb_ostream_t *stream, const pb_field_iter_t
     return pb_encode_varint(stream, value);
 }
 
+/* Read an integer field with unsigned extension */
+static bool checkreturn read_unsigned_field(pb_ostream_t *stream, const pb_field_iter_t *field, pb_uint64_t *value)
+{
+    if (field->data_size == sizeof(uint_least8_t))
+        *value = *(const uint_least8_t*)field->pData;
+    else if (field->data_size == sizeof(uint_least16_t))
+        *value = *(const uint_least16_t*)field->pData;
+    else if (field->data_size == sizeof(uint32_t))
+        *value = *(const uint32_t*)field->pData;
+    else if (field->data_size == sizeof(pb_uint64_t))
+        *value = *(const pb_uint64_t*)field->pData;
+    else
+        PB_RETURN_ERROR(stream, "invalid data_size");
+
+    return true;
+}
+
+/* Read an integer field with signed extension */
+static bool checkreturn read_signed_field(pb_ostream_t *stream, const pb_field_iter_t *field, pb_int64_t *value)
+{
+    if (field->data_size == sizeof(int_least8_t))
+        *value = *(const int_least8_t*)field->pData;
+    else if (field->data_size == sizeof(int_least16_t))
+        *value = *(const int_least16_t*)field->pData;
+    else if (field->data_size == sizeof(int32_t))
+        *value = *(const int32_t*)field->pData;
+    else if (field->data_size == sizeof(pb_int64_t))
+        *value = *(const pb_int64_t*)field->pData;
+    else
+        PB_RETURN_ERROR(stream, "invalid data_size");
+
+    return true;
+}
+
 static bool checkreturn pb_enc_varint(pb_ostream_t *stream, const pb_field_iter_t *field)
 {
     if (PB_LTYPE(field->type) == PB_LTYPE_UVARINT)
     {
-        /* Perform unsigned integer extension */
         pb_uint64_t value = 0;
-
-        if (field->data_size == sizeof(uint_least8_t))
-            value = *(const uint_least8_t*)field->pData;
-        else if (field->data_size == sizeof(uint_least16_t))
-            value = *(const uint_least16_t*)field->pData;
-        else if (field->data_size == sizeof(uint32_t))
-            value = *(const uint32_t*)field->pData;
-        else if (field->data_size == sizeof(pb_uint64_t))
-            value = *(const pb_uint64_t*)field->pData;
-        else
-            PB_RETURN_ERROR(stream, "invalid data_size");
+        if (!read_unsigned_field(stream, field, &value))
+            return false;
 
         return pb_encode_varint(stream, value);
     }
     else
     {
-        /* Perform signed integer extension */
         pb_int64_t value = 0;
-
-        if (field->data_size == sizeof(int_least8_t))
-            value = *(const int_least8_t*)field->pData;
-        else if (field->data_size == sizeof(int_least16_t))
-            value = *(const int_least16_t*)field->pData;
-        else if (field->data_size == sizeof(int32_t))
-            value = *(const int32_t*)field->pData;
-        else if (field->data_size == sizeof(pb_int64_t))
-            value = *(const pb_int64_t*)field->pData;
-        else
-            PB_RETURN_ERROR(stream, "invalid data_size");
+        if (!read_signed_field(stream, field, &value))
+            return false;
 
         if (PB_LTYPE(field->type) == PB_LTYPE_SVARINT)
             return pb_encode_svarint(stream, value);
@@ -842,6 +1668,61 @@ static bool checkreturn pb_enc_varint(pb_ostream_t *stream, const pb_field_iter_
     }
 }
 
+/* Get the encoded size of a bool, varint or fixed field value
+ * without encoding it. Checks data_size like the encoders do. */
+static bool checkreturn scalar_size(pb_ostream_t *stream, const pb_field_iter_t *field, size_t *size)
+{
+    pb_type_t ltype = PB_LTYPE(field->type);
+
+    if (ltype == PB_LTYPE_BOOL)
+    {
+        *size = 1;
+    }
+    else if (ltype == PB_LTYPE_UVARINT)
+    {
+        pb_uint64_t value = 0;
+        if (!read_unsigned_field(stream, field, &value))
+            return false;
+
+        *size = pb_varint_size(value);
+    }
+    else if (ltype == PB_LTYPE_VARINT || ltype == PB_LTYPE_SVARINT)
+    {
+        pb_int64_t value = 0;
+        if (!read_signed_field(stream, field, &value))
+            return false;
+
+        if (ltype == PB_LTYPE_SVARINT)
+            *size = pb_varint_size(zigzag_encode(value));
+        else if (value < 0)
+            *size = 10; /* Negative values are sign extended to 64 bits */
+        else
+            *size = pb_varint_size((pb_uint64_t)value);
+    }
+#ifdef PB_CONVERT_DOUBLE_FLOAT
+    else if (ltype == PB_LTYPE_FIXED64 && field->data_size == sizeof(float))
+    {
+        *size = 8;
+    }
+#endif
+    else if (field->data_size == sizeof(uint32_t))
+    {
+        *size = 4;
+    }
+#ifndef PB_WITHOUT_64BIT
+    else if (field->data_size == sizeof(uint64_t))
+    {
+        *size = 8;
+    }
+#endif
+    else
+    {
+        PB_RETURN_ERROR(stream, "invalid data_size");
+    }
+
+    return true;
+}
+
 static bool checkreturn pb_enc_fixed(pb_ostream_t *stream, const pb_field_iter_t *field)
 {
 #ifdef PB_CONVERT_DOUBLE_FLOAT
@@ -867,6 +1748,61 @@ static bool checkreturn pb_enc_fixed(pb_ostream_t *stream, const pb_field_iter_t
     }
 }
 
+#ifndef PB_ENCODE_ARRAYS_UNPACKED
+/* Encode the contents of a packed fixed32 or fixed64 array. On little
+ * endian platforms the array is already in the wire format. */
+static bool checkreturn pb_enc_fixed_array(pb_ostream_t *stream, const pb_field_iter_t *field, pb_size_t count)
+{
+#if defined(PB_LITTLE_ENDIAN_8BIT) && PB_LITTLE_ENDIAN_8BIT == 1
+    return pb_write(stream, (const pb_byte_t*)field->pData, (size_t)count * field->data_size);
+#else
+    /* Convert the byte order in blocks of several elements */
+    pb_byte_t buffer[64];
+    const pb_byte_t *p = (const pb_byte_t*)field->pData;
+    size_t pos = 0;
+    pb_size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (field->data_size == 4)
+        {
+            uint32_t val = *(const uint32_t*)p;
+            buffer[pos + 0] = (pb_byte_t)(val & 0xFF);
+            buffer[pos + 1] = (pb_byte_t)((val >> 8) & 0xFF);
+            buffer[pos + 2] = (pb_byte_t)((val >> 16) & 0xFF);
+            buffer[pos + 3] = (pb_byte_t)((val >> 24) & 0xFF);
+        }
+#ifndef PB_WITHOUT_64BIT
+        else
+        {
+            uint64_t val = *(const uint64_t*)p;
+            buffer[pos + 0] = (pb_byte_t)(val & 0xFF);
+            buffer[pos + 1] = (pb_byte_t)((val >> 8) & 0xFF);
+            buffer[pos + 2] = (pb_byte_t)((val >> 16) & 0xFF);
+            buffer[pos + 3] = (pb_byte_t)((val >> 24) & 0xFF);
+            buffer[pos + 4] = (pb_byte_t)((val >> 32) & 0xFF);
+            buffer[pos + 5] = (pb_byte_t)((val >> 40) & 0xFF);
+            buffer[pos + 6] = (pb_byte_t)((val >> 48) & 0xFF);
+            buffer[pos + 7] = (pb_byte_t)((val >> 56) & 0xFF);
+        }
+#endif
+
+        p += field->data_size;
+        pos += field->data_size;
+
+        if (pos == sizeof(buffer))
+        {
+            if (!pb_write(stream, buffer, pos))
+                return false;
+            pos = 0;
+        }
+    }
+
+    return pb_write(stream, buffer, pos);
+#endif
+}
+#endif
+
 static bool checkreturn pb_enc_bytes(pb_ostream_t *stream, const pb_field_iter_t *field)
 {
     const pb_bytes_array_t *bytes = NULL;
@@ -965,6 +1901,16 @@ static bool checkreturn pb_enc_fixed_length_bytes(pb_ostream_t *stream, const pb
     return pb_encode_string(stream, (const pb_byte_t*)field->pData, (size_t)field->data_size);
 }
 
+static bool checkreturn pb_enc_view(pb_ostream_t *stream, const pb_field_iter_t *field)
+{
+    const pb_view_t *view = (const pb_view_t*)field->pData;
+
+    if (view->bytes == NULL && view->size > 0)
+        PB_RETURN_ERROR(stream, "invalid view");
+
+    return pb_encode_string(stream, view->bytes, view->size);
+}
+
 #ifdef PB_CONVERT_DOUBLE_FLOAT
 bool pb_encode_float_as_double(pb_ostream_t *stream, float value)
 {
@@ -12,6 +12,90 @@
 extern "C" {
 #endif
 
+#ifdef PB_ENCODE_SIZE_CACHE
+/* State of the submessage size cache. The sizes are stored in the order
+ * the submessages are encountered, and index is the next entry to
+ * record or use. */
+typedef struct pb_size_cache_s pb_size_cache_t;
+struct pb_size_cache_s
+{
+    size_t *sizes;
+    size_t count;
+    size_t index;
+};
+#endif
+
+#ifndef PB_BUFFER_ONLY
+/* One segment of scatter-gather output. The members correspond to the
+ * POSIX struct iovec, so the segments can be passed on to writev(). */
+typedef struct pb_iovec_s pb_iovec_t;
+struct pb_iovec_s
+{
+    const pb_byte_t *base;
+    size_t len;
+};
+
+/* State of a scatter-gather output stream, see pb_ostream_from_iovec(). */
+typedef struct pb_iovec_state_s pb_iovec_state_t;
+struct pb_iovec_state_s
+{
+    pb_iovec_t *iov;    /* Array of output segments */
+    size_t iov_max;     /* Number of entries allocated in iov */
+    size_t iov_count;   /* Number of entries used so far */
+    pb_byte_t *buf;     /* Buffer for the data that is copied */
+    size_t buf_size;
+    size_t buf_used;
+    size_t threshold;   /* Minimum length of referenced string/bytes data */
+};
+
+/* Write buffer for pb_ostream_from_write_buffer(). Small writes are
+ * collected in the buffer and passed on to the destination in blocks.
+ */
+typedef struct pb_write_buffer_s pb_write_buffer_t;
+struct pb_write_buffer_s
+{
+    /* Write all count bytes to the destination. Return false on IO errors. */
+    bool (*write)(void *dest, const pb_byte_t *buf, size_t count);
+    void *dest;         /* Passed to the write function */
+    pb_byte_t *buf;     /* Start of the write buffer */
+    size_t size;        /* Total size of the write buffer */
+    size_t used;        /* Number of bytes waiting to be written */
+};
+
+/* Encoding state of one nesting level for pb_encoder_fill().
+ * The contents are internal to the encoder. */
+typedef struct pb_encode_frame_s pb_encode_frame_t;
+struct pb_encode_frame_s
+{
+    pb_field_iter_t iter;   /* Field being encoded */
+    pb_size_t index;        /* Next array item of the field */
+    bool packed;            /* Header of a packed array has been written */
+    bool finished;          /* All fields of the message have been encoded */
+};
+
+/* State of the resumable encoder, see pb_encoder_init().
+ * The contents are internal to the encoder, except for errmsg. */
+typedef struct pb_encoder_s pb_encoder_t;
+struct pb_encoder_s
+{
+    pb_encode_frame_t *frames;  /* Frame for each nesting level */
+    pb_size_t max_depth;        /* Number of frames */
+    pb_size_t depth;            /* Index of the current frame */
+    pb_byte_t *buffer;          /* Encoded data of the current field */
+    size_t buffer_size;         /* Total size of the buffer */
+    size_t buffer_start;        /* Offset of the first byte not written out yet */
+    size_t buffer_end;          /* Offset after the last encoded byte */
+    const pb_byte_t *data;      /* String or bytes data written after the buffer */
+    size_t data_left;           /* Number of data bytes not written out yet */
+    bool reference_data;        /* Current field can refer to its data */
+
+#ifndef PB_NO_ERRMSG
+    /* Pointer to constant (ROM) string when encoding function returns error */
+    const char *errmsg;
+#endif
+};
+#endif
+
 /* Structure for defining custom output streams. You will need to provide
  * a callback function to write the bytes to your storage, which can be
  * for example a file or a network socket.
@@ -54,6 +138,11 @@ struct pb_ostream_s
     /* Pointer to constant (ROM) string when decoding function returns error */
     const char *errmsg;
 #endif
+
+#ifdef PB_ENCODE_SIZE_CACHE
+    /* Submessage size cache used by pb_encode_ex_cached(), NULL if unused. */
+    pb_size_cache_t *size_cache;
+#endif
 };
 
 /***************************
@@ -96,10 +185,24 @@ bool pb_encode_ex(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *
 #define pb_encode_delimited(s,f,d) pb_encode_ex(s,f,d, PB_ENCODE_DELIMITED)
 #define pb_encode_nullterminated(s,f,d) pb_encode_ex(s,f,d, PB_ENCODE_NULLTERMINATED)
 
-/* Encode the message to get the size of the encoded data, but do not store
- * the data. */
+/* Calculate the size of the encoded data without storing it. Scalar
+ * fields are sized from their values without encoding them. */
 bool pb_get_encoded_size(size_t *size, const pb_msgdesc_t *fields, const void *src_struct);
 
+#ifdef PB_ENCODE_SIZE_CACHE
+/* Same as pb_encode_ex(), but first computes the sizes of all submessages
+ * in one sizing pass and stores them in the size_cache array, which has
+ * room for cache_count entries. The actual encoding then uses the stored
+ * sizes instead of computing them again at every nesting level.
+ *
+ * If the array is too small, the remaining submessages are sized as usual.
+ * One entry is needed for each submessage instance, including submessages
+ * in arrays and submessages encoded by callbacks.
+ */
+bool pb_encode_ex_cached(pb_ostream_t *stream, const pb_msgdesc_t *fields, const void *src_struct,
+                         unsigned int flags, size_t *size_cache, size_t cache_count);
+#endif
+
 /**************************************
  * Functions for manipulating streams *
  **************************************/
@@ -113,6 +216,77 @@ bool pb_get_encoded_size(size_t *size, const pb_msgdesc_t *fields, const void *s
  */
 pb_ostream_t pb_ostream_from_buffer(pb_byte_t *buf, size_t bufsize);
 
+#ifndef PB_BUFFER_ONLY
+/* Create a scatter-gather output stream. Tags, lengths and other small
+ * fields are copied into buf, while the data of string and bytes fields
+ * that are at least threshold bytes long is only referenced from the
+ * segment list. After encoding, state->iov[0 .. state->iov_count-1]
+ * describe the message. The referenced data must stay valid until the
+ * segments have been written out.
+ *
+ * Example usage:
+ *    pb_iovec_t iov[16];
+ *    pb_byte_t buffer[128];
+ *    pb_iovec_state_t state;
+ *    pb_ostream_t stream;
+ *
+ *    stream = pb_ostream_from_iovec(&state, iov, 16, buffer, sizeof(buffer), 256);
+ *    pb_encode(&stream, MyMessage_fields, &msg);
+ */
+pb_ostream_t pb_ostream_from_iovec(pb_iovec_state_t *state, pb_iovec_t *iov, size_t iov_max,
+                                   pb_byte_t *buf, size_t bufsize, size_t threshold);
+
+/* Create an output stream that collects the encoded data in a write buffer
+ * and passes it to the write function when the buffer becomes full. Writes
+ * larger than the buffer go directly to the write function. Call pb_flush()
+ * after encoding to write out the remaining data.
+ *
+ * Example usage:
+ *    pb_byte_t buffer[256];
+ *    pb_write_buffer_t wb;
+ *    pb_ostream_t stream;
+ *
+ *    pb_write_buffer_init(&wb, &socket_write, &fd, buffer, sizeof(buffer));
+ *    stream = pb_ostream_from_write_buffer(&wb, SIZE_MAX);
+ *    if (pb_encode(&stream, MyMessage_fields, &msg) && pb_flush(&stream))
+ *        ...
+ */
+void pb_write_buffer_init(pb_write_buffer_t *wb,
+                          bool (*write)(void *dest, const pb_byte_t *buf, size_t count),
+                          void *dest, pb_byte_t *buf, size_t bufsize);
+pb_ostream_t pb_ostream_from_write_buffer(pb_write_buffer_t *wb, size_t max_size);
+
+/* Resumable encoding of a message into output windows of any size, e.g.
+ * the free space of a ring buffer. pb_encoder_init() starts encoding the
+ * message, and each pb_encoder_fill() call continues from where the
+ * previous one stopped. The message is complete when a call writes less
+ * than size bytes.
+ *
+ * The frames array limits the nesting depth like in pb_decode_iterative().
+ * String and bytes data is copied directly from the message structure, so
+ * the structure must not change until the encoding is complete. Other
+ * fields are encoded one array item at a time into the buffer, which must
+ * hold the largest such item, or the whole field for callback fields and
+ * extensions. A larger field fails with "field too large for buffer".
+ *
+ * Example usage:
+ *    pb_encoder_t encoder;
+ *    pb_encode_frame_t frames[8];
+ *    pb_byte_t buffer[32];
+ *    size_t count;
+ *
+ *    pb_encoder_init(&encoder, MyMessage_fields, &msg, frames, 8, buffer, sizeof(buffer));
+ *    do {
+ *        if (!pb_encoder_fill(&encoder, window, sizeof(window), &count))
+ *            break;
+ *        send(sock, window, count, 0);
+ *    } while (count == sizeof(window));
+ */
+bool pb_encoder_init(pb_encoder_t *encoder, const pb_msgdesc_t *fields, const void *src_struct,
+                     pb_encode_frame_t *frames, pb_size_t max_depth, pb_byte_t *buffer, size_t buffer_size);
+bool pb_encoder_fill(pb_encoder_t *encoder, pb_byte_t *buf, size_t size, size_t *written);
+#endif
+
 /* Pseudo-stream for measuring the size of a message without actually storing
  * the encoded data.
  * 
@@ -122,7 +296,9 @@ pb_ostream_t pb_ostream_from_buffer(pb_byte_t *buf, size_t bufsize);
  *    pb_encode(&stream, MyMessage_fields, &msg);
  *    printf("Message size is %d\n", stream.bytes_written);
  */
-#ifndef PB_NO_ERRMSG
+#if !defined(PB_NO_ERRMSG) && defined(PB_ENCODE_SIZE_CACHE)
+#define PB_OSTREAM_SIZING {0,0,0,0,0,0}
+#elif !defined(PB_NO_ERRMSG) || defined(PB_ENCODE_SIZE_CACHE)
 #define PB_OSTREAM_SIZING {0,0,0,0,0}
 #else
 #define PB_OSTREAM_SIZING {0,0,0,0}
@@ -133,6 +309,11 @@ pb_ostream_t pb_ostream_from_buffer(pb_byte_t *buf, size_t bufsize);
  */
 bool pb_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count);
 
+/* Write out any data held in the buffer of a stream created with
+ * pb_ostream_from_write_buffer(). Does nothing for other streams.
+ */
+bool pb_flush(pb_ostream_t *stream);
+
 
 /************************************************
  * Helper functions for writing field callbacks *
@@ -154,6 +335,13 @@ bool pb_encode_varint(pb_ostream_t *stream, uint64_t value);
 bool pb_encode_varint(pb_ostream_t *stream, uint32_t value);
 #endif
 
+/* Get the number of bytes needed to encode value as varint, 1 to 10. */
+#ifndef PB_WITHOUT_64BIT
+size_t pb_varint_size(uint64_t value);
+#else
+size_t pb_varint_size(uint32_t value);
+#endif
+
 /* Encode an integer in the zig-zagged svarint format.
  * This works for sint32 and sint64. */
 #ifndef PB_WITHOUT_64BIT
@@ -159,9 +159,18 @@ int main(int argc, char **argv)
         uint8_t buffer[AllTypes_size];
         pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
         
+        size_t size;
+        
         /* Now encode it and check if we succeeded. */
         if (pb_encode(&stream, AllTypes_fields, &alltypes))
         {
+            if (!pb_get_encoded_size(&size, AllTypes_fields, &alltypes) ||
+                size != stream.bytes_written)
+            {
+                fprintf(stderr, "Wrong encoded size\n");
+                return 1;
+            }
+
             SET_BINARY_MODE(stdout);
             fwrite(buffer, 1, stream.bytes_written, stdout);
             return 0; /* Success */
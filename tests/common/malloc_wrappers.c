@@ -26,6 +26,7 @@
 #endif
 
 static size_t g_alloc_count = 0;
+static size_t g_realloc_count = 0;
 static size_t g_alloc_bytes = 0;
 static size_t g_max_alloc_bytes = MAX_ALLOC_BYTES;
 
@@ -107,6 +108,8 @@ void free_with_check(void *mem)
 /* Reallocate block and check / write guard values */
 void* realloc_with_check(void *ptr, size_t size)
 {
+    g_realloc_count++;
+
     if (!ptr && size)
     {
         /* Allocate new block and write guard values */
@@ -173,6 +176,12 @@ size_t get_alloc_count()
     return g_alloc_count;
 }
 
+/* Return total number of realloc_with_check() calls */
+size_t get_realloc_count()
+{
+    return g_realloc_count;
+}
+
 /* Return allocated size for a pointer returned from malloc(). */
 size_t get_allocation_size(const void *mem)
 {
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+static int check_message(const AllTypes *alltypes)
+{
+    int status = 0;
+
+    TEST(alltypes->req_int32     && *alltypes->req_int32         == -1001);
+    TEST(alltypes->req_string    && strcmp(alltypes->req_string, "1014") == 0);
+    TEST(alltypes->req_submsg    && strcmp(alltypes->req_submsg->substuff1, "1016") == 0);
+    TEST(alltypes->rep_int32_count == 5 && alltypes->rep_int32[4] == -2001 && alltypes->rep_int32[0] == 0);
+    TEST(alltypes->rep_double_count == 5 && alltypes->rep_double[4] == 2013.0 && alltypes->rep_double[0] == 0);
+    TEST(alltypes->rep_string_count == 5 && strcmp(alltypes->rep_string[4], "2014") == 0);
+    TEST(alltypes->rep_submsg_count == 5 && strcmp(alltypes->rep_submsg[4].substuff1, "2016") == 0);
+    TEST(alltypes->rep_submsg_count == 5 && *alltypes->rep_submsg[4].substuff2 == 2016);
+    TEST(alltypes->opt_string    && strcmp(alltypes->opt_string, "3054") == 0);
+    TEST(alltypes->end           && *alltypes->end == 1099);
+
+    return status;
+}
+
+int main(void)
+{
+    int status = 0;
+    uint8_t buffer[2048];
+    size_t count;
+    static uint64_t storage[1024];
+    pb_arena_t arena;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(buffer, 1, sizeof(buffer), stdin);
+
+    pb_arena_init(&arena, storage, sizeof(storage));
+
+    {
+        AllTypes alltypes;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+        char *first_string;
+        size_t used;
+
+        COMMENT("Decode into arena");
+        memset(&alltypes, 0, sizeof(alltypes));
+        stream.arena = &arena;
+        TEST(pb_decode(&stream, AllTypes_fields, &alltypes));
+        status |= check_message(&alltypes);
+        TEST(get_alloc_count() == 0);
+        TEST(arena.used > 0 && arena.used <= arena.size);
+        first_string = alltypes.req_string;
+        used = arena.used;
+
+        COMMENT("Reset arena and decode again");
+        pb_arena_reset(&arena);
+        memset(&alltypes, 0, sizeof(alltypes));
+        stream = pb_istream_from_buffer(buffer, count);
+        stream.arena = &arena;
+        TEST(pb_decode(&stream, AllTypes_fields, &alltypes));
+        status |= check_message(&alltypes);
+        TEST(alltypes.req_string == first_string);
+        TEST(arena.used == used);
+        TEST(get_alloc_count() == 0);
+    }
+
+    {
+        AllTypes alltypes;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count / 2);
+
+        COMMENT("Truncated message is released without freeing");
+        pb_arena_reset(&arena);
+        memset(&alltypes, 0, sizeof(alltypes));
+        stream.arena = &arena;
+        TEST(!pb_decode(&stream, AllTypes_fields, &alltypes));
+        TEST(alltypes.req_string == NULL && alltypes.rep_int32 == NULL && alltypes.rep_int32_count == 0);
+        TEST(get_alloc_count() == 0);
+    }
+
+    {
+        AllTypes alltypes;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+        pb_arena_t small;
+
+        COMMENT("Too small arena");
+        pb_arena_init(&small, storage, 256);
+        memset(&alltypes, 0, sizeof(alltypes));
+        stream.arena = &small;
+        TEST(!pb_decode(&stream, AllTypes_fields, &alltypes));
+        TEST(strcmp(PB_GET_ERROR(&stream), "arena full") == 0);
+        TEST(small.used <= small.size);
+        TEST(get_alloc_count() == 0);
+    }
+
+    {
+        AllTypes alltypes;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+        int32_t outside[5] = {0};
+
+        COMMENT("Array that is not in the arena");
+        pb_arena_reset(&arena);
+        memset(&alltypes, 0, sizeof(alltypes));
+        alltypes.rep_int32 = outside;
+        alltypes.rep_int32_count = 5;
+        stream.arena = &arena;
+        TEST(!pb_decode_ex(&stream, AllTypes_fields, &alltypes, PB_DECODE_NOINIT));
+        TEST(strcmp(PB_GET_ERROR(&stream), "pointer not in arena") == 0);
+        TEST(get_alloc_count() == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
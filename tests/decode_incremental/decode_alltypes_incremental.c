@@ -0,0 +1,79 @@
+/* Decodes the alltypes test data with pb_decoder_feed(), split into
+ * chunks of every size, and checks that the result matches pb_decode().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "unittests.h"
+#include "test_helpers.h"
+
+/* Decode the message in chunks of chunk_size bytes */
+static bool decode_chunked(const uint8_t *data, size_t count, size_t chunk_size, AllTypes *msg)
+{
+    pb_decoder_t decoder;
+    pb_decode_frame_t frames[4];
+    pb_byte_t buffer[64];
+    size_t pos;
+
+    if (!pb_decoder_init(&decoder, AllTypes_fields, msg, frames, 4, buffer, sizeof(buffer), 0))
+        return false;
+
+    for (pos = 0; pos < count; pos += chunk_size)
+    {
+        size_t size = count - pos;
+        if (size > chunk_size)
+            size = chunk_size;
+
+        if (!pb_decoder_feed(&decoder, data + pos, size))
+        {
+            printf("Chunk size %d: %s\n", (int)chunk_size, PB_GET_ERROR(&decoder));
+            return false;
+        }
+    }
+
+    if (!pb_decoder_finish(&decoder))
+    {
+        printf("Chunk size %d: %s\n", (int)chunk_size, PB_GET_ERROR(&decoder));
+        return false;
+    }
+
+    return true;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[1024];
+    size_t count, chunk_size;
+    AllTypes expected, actual;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(buffer, 1, sizeof(buffer), stdin);
+
+    memset(&expected, 0, sizeof(expected));
+
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+        TEST(pb_decode(&stream, AllTypes_fields, &expected));
+    }
+
+    for (chunk_size = 1; chunk_size <= count; chunk_size++)
+    {
+        memset(&actual, 0, sizeof(actual));
+        if (!decode_chunked(buffer, count, chunk_size, &actual) ||
+            memcmp(&expected, &actual, sizeof(expected)) != 0)
+        {
+            printf("Chunk size %d failed\n", (int)chunk_size);
+            status = 1;
+        }
+    }
+
+    TEST(status == 0);
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
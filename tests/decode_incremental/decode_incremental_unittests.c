@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "decode_incremental.pb.h"
+
+#define MAX_DEPTH 2
+
+int main()
+{
+    int status = 0;
+    pb_byte_t buffer[256];
+    size_t message_length;
+    pb_decode_frame_t frames[MAX_DEPTH];
+    pb_byte_t carry[8];
+
+    {
+        Batch msg = Batch_init_zero;
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+        msg.items_count = 2;
+        msg.items[0].id = 1;
+        msg.items[1].id = 2;
+        msg.items[1].has_name = true;
+        strcpy(msg.items[1].name, "abc");
+        msg.has_first = true;
+        msg.first.id = 3;
+        msg.first.has_name = true;
+        strcpy(msg.first.name, "a longer name");
+        msg.has_total = true;
+        msg.total = 1234567890123ULL;
+
+        TEST(pb_encode(&ostream, Batch_fields, &msg));
+        message_length = ostream.bytes_written;
+    }
+
+    {
+        Batch msg;
+        pb_decoder_t decoder;
+
+        COMMENT("Test feeding the whole message at once");
+        TEST(pb_decoder_init(&decoder, Batch_fields, &msg, frames, MAX_DEPTH, carry, sizeof(carry), 0));
+        TEST(pb_decoder_feed(&decoder, buffer, message_length));
+        TEST(pb_decoder_finish(&decoder));
+        TEST(msg.items_count == 2 && msg.items[0].id == 1 && !msg.items[0].has_name);
+        TEST(msg.items[1].id == 2 && strcmp(msg.items[1].name, "abc") == 0);
+        TEST(msg.has_first && strcmp(msg.first.name, "a longer name") == 0);
+        TEST(msg.has_total && msg.total == 1234567890123ULL);
+    }
+
+    {
+        Batch msg;
+        pb_decoder_t decoder;
+        size_t i;
+        bool ok = true;
+
+        COMMENT("Test splitting a string longer than the buffer");
+        TEST(pb_decoder_init(&decoder, Batch_fields, &msg, frames, MAX_DEPTH, carry, sizeof(carry), 0));
+        for (i = 0; i < message_length && ok; i++)
+            ok = pb_decoder_feed(&decoder, buffer + i, 1);
+        TEST(!ok);
+        TEST(strcmp(PB_GET_ERROR(&decoder), "field too large for buffer") == 0);
+    }
+
+    {
+        Batch msg;
+        pb_decoder_t decoder;
+
+        COMMENT("Test message that ends in the middle of a field");
+        TEST(pb_decoder_init(&decoder, Batch_fields, &msg, frames, MAX_DEPTH, carry, sizeof(carry), 0));
+        TEST(pb_decoder_feed(&decoder, buffer, message_length - 2));
+        TEST(!pb_decoder_finish(&decoder));
+        TEST(strcmp(PB_GET_ERROR(&decoder), "end-of-stream") == 0);
+    }
+
+    {
+        Batch msg;
+        pb_decoder_t decoder;
+        const pb_byte_t input[] = {0x0A, 0x02, 0x12, 0x00, 0x18, 0x01};
+
+        COMMENT("Test missing required field in submessage");
+        TEST(pb_decoder_init(&decoder, Batch_fields, &msg, frames, MAX_DEPTH, carry, sizeof(carry), 0));
+        TEST(!pb_decoder_feed(&decoder, input, sizeof(input)));
+        TEST(strcmp(PB_GET_ERROR(&decoder), "missing required field") == 0);
+    }
+
+    {
+        Batch msg;
+        pb_decoder_t decoder;
+        const pb_byte_t input[] = {0x0A, 0x04, 0x08, 0x01, 0x12, 0x05, 0x61};
+
+        COMMENT("Test field that overruns its submessage");
+        TEST(pb_decoder_init(&decoder, Batch_fields, &msg, frames, MAX_DEPTH, carry, sizeof(carry), 0));
+        TEST(!pb_decoder_feed(&decoder, input, sizeof(input)));
+        TEST(strcmp(PB_GET_ERROR(&decoder), "parent stream too short") == 0);
+    }
+
+    {
+        Batch msg;
+        pb_decoder_t decoder;
+
+        COMMENT("Test nesting deeper than max_depth");
+        TEST(pb_decoder_init(&decoder, Batch_fields, &msg, frames, 1, carry, sizeof(carry), 0));
+        TEST(!pb_decoder_feed(&decoder, buffer, message_length));
+        TEST(strcmp(PB_GET_ERROR(&decoder), "max depth exceeded") == 0);
+    }
+
+    {
+        Batch msg;
+        pb_decoder_t decoder;
+
+        COMMENT("Test that calls after an error keep failing");
+        TEST(pb_decoder_init(&decoder, Batch_fields, &msg, frames, 1, carry, sizeof(carry), 0));
+        TEST(!pb_decoder_feed(&decoder, buffer, message_length));
+        TEST(!pb_decoder_feed(&decoder, buffer + message_length, 0));
+        TEST(!pb_decoder_finish(&decoder));
+        TEST(strcmp(PB_GET_ERROR(&decoder), "max depth exceeded") == 0);
+    }
+
+    {
+        Batch msg;
+        pb_decoder_t decoder;
+
+        COMMENT("Test flags that are not supported");
+        TEST(!pb_decoder_init(&decoder, Batch_fields, &msg, frames, MAX_DEPTH, carry, sizeof(carry), PB_DECODE_DELIMITED));
+        TEST(strcmp(PB_GET_ERROR(&decoder), "invalid flags") == 0);
+        TEST(!pb_decoder_feed(&decoder, buffer, message_length));
+        TEST(!pb_decoder_init(&decoder, Batch_fields, &msg, frames, MAX_DEPTH, carry, sizeof(carry), PB_DECODE_NULLTERMINATED));
+    }
+
+    {
+        Blob msg;
+        pb_decoder_t decoder;
+        const pb_byte_t input[] = {0x0A, 0x03, 0x61, 0x62, 0x63};
+
+        COMMENT("Test that views into the chunks are rejected");
+        TEST(pb_decoder_init(&decoder, Blob_fields, &msg, frames, MAX_DEPTH, carry, sizeof(carry), 0));
+        TEST(!pb_decoder_feed(&decoder, input, sizeof(input)));
+        TEST(strcmp(PB_GET_ERROR(&decoder), "view needs buffer stream") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
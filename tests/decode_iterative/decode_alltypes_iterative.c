@@ -0,0 +1,49 @@
+/* Decodes the alltypes test data with both pb_decode() and
+ * pb_decode_iterative() and checks that the results are identical.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "unittests.h"
+#include "test_helpers.h"
+
+int main()
+{
+    int status = 0;
+    uint8_t buffer[1024];
+    size_t count;
+    AllTypes expected, actual;
+    pb_decode_frame_t frames[4];
+
+    SET_BINARY_MODE(stdin);
+    count = fread(buffer, 1, sizeof(buffer), stdin);
+
+    memset(&expected, 0, sizeof(expected));
+    memset(&actual, 0, sizeof(actual));
+
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+        TEST(pb_decode(&stream, AllTypes_fields, &expected));
+    }
+
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+        TEST(pb_decode_iterative(&stream, AllTypes_fields, &actual, frames, 4, 0));
+        TEST(stream.bytes_left == 0);
+    }
+
+    TEST(memcmp(&expected, &actual, sizeof(expected)) == 0);
+
+    {
+        pb_istream_t stream = pb_istream_from_buffer(buffer, count);
+        TEST(!pb_decode_iterative(&stream, AllTypes_fields, &actual, frames, 1, 0));
+        TEST(strcmp(PB_GET_ERROR(&stream), "max depth exceeded") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "decode_iterative.pb.h"
+
+#define MAX_DEPTH 3
+
+int main()
+{
+    int status = 0;
+    pb_byte_t buffer[256];
+    size_t message_length;
+    pb_decode_frame_t frames[MAX_DEPTH];
+
+    {
+        Root msg = Root_init_zero;
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+        msg.has_branch = true;
+        msg.branch.id = 1;
+        msg.branch.has_leaf = true;
+        msg.branch.leaf.value = 2;
+        msg.branch.leaf.has_name = true;
+        strcpy(msg.branch.leaf.name, "leaf");
+        msg.branch.leaves_count = 2;
+        msg.branch.leaves[0].value = 3;
+        msg.branch.leaves[1].value = 4;
+        msg.has_after = true;
+        msg.after = 5;
+        msg.which_choice = Root_leaf_tag;
+        msg.choice.leaf.value = 6;
+
+        TEST(pb_encode(&ostream, Root_fields, &msg));
+        message_length = ostream.bytes_written;
+    }
+
+    {
+        Root expected, actual;
+        pb_istream_t stream;
+
+        COMMENT("Test that result matches pb_decode()");
+        memset(&expected, 0, sizeof(expected));
+        memset(&actual, 0, sizeof(actual));
+        stream = pb_istream_from_buffer(buffer, message_length);
+        TEST(pb_decode(&stream, Root_fields, &expected));
+        stream = pb_istream_from_buffer(buffer, message_length);
+        TEST(pb_decode_iterative(&stream, Root_fields, &actual, frames, MAX_DEPTH, 0));
+        TEST(stream.bytes_left == 0);
+        TEST(actual.has_branch && actual.branch.id == 1);
+        TEST(actual.branch.has_leaf && actual.branch.leaf.value == 2);
+        TEST(strcmp(actual.branch.leaf.name, "leaf") == 0);
+        TEST(actual.branch.leaves_count == 2);
+        TEST(actual.branch.leaves[0].value == 3 && !actual.branch.leaves[0].has_name);
+        TEST(actual.branch.leaves[1].value == 4);
+        TEST(actual.branch.weight == 5);
+        TEST(actual.has_after && actual.after == 5);
+        TEST(actual.which_choice == Root_leaf_tag && actual.choice.leaf.value == 6);
+        TEST(!actual.choice.leaf.has_name);
+        TEST(memcmp(&expected, &actual, sizeof(expected)) == 0);
+    }
+
+    {
+        Root msg;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, message_length);
+
+        COMMENT("Test nesting deeper than max_depth");
+        TEST(!pb_decode_iterative(&stream, Root_fields, &msg, frames, MAX_DEPTH - 1, 0));
+        TEST(strcmp(PB_GET_ERROR(&stream), "max depth exceeded") == 0);
+    }
+
+    {
+        Root msg;
+        const pb_byte_t input[] = {0x0A, 0x04, 0x12, 0x02, 0x12, 0x00, 0x10, 0x07};
+        pb_istream_t stream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test missing required field in nested submessage");
+        TEST(!pb_decode_iterative(&stream, Root_fields, &msg, frames, MAX_DEPTH, 0));
+        TEST(strcmp(PB_GET_ERROR(&stream), "missing required field") == 0);
+    }
+
+    {
+        Root msg;
+        const pb_byte_t input[] = {0x0A, 0x06, 0x08, 0x01, 0x12, 0x05, 0x08, 0x02};
+        pb_istream_t stream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test submessage longer than its parent");
+        TEST(!pb_decode_iterative(&stream, Root_fields, &msg, frames, MAX_DEPTH, 0));
+        TEST(strcmp(PB_GET_ERROR(&stream), "parent stream too short") == 0);
+    }
+
+    {
+        Root msg;
+        pb_byte_t delimited[256];
+        pb_istream_t stream;
+
+        COMMENT("Test delimited decoding");
+        delimited[0] = (pb_byte_t)message_length;
+        memcpy(delimited + 1, buffer, message_length);
+        stream = pb_istream_from_buffer(delimited, message_length + 1);
+        TEST(pb_decode_iterative(&stream, Root_fields, &msg, frames, MAX_DEPTH, PB_DECODE_DELIMITED));
+        TEST(stream.bytes_left == 0);
+        TEST(msg.branch.leaves[1].value == 4 && msg.after == 5);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
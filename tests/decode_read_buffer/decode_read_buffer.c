@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+/* Memory source that returns at most max_chunk bytes per read */
+typedef struct {
+    const pb_byte_t *data;
+    size_t size;
+    size_t pos;
+    size_t max_chunk;
+    size_t calls;
+    bool fail;
+} source_t;
+
+static bool source_read(void *source, pb_byte_t *buf, size_t count, size_t *actual)
+{
+    source_t *src = (source_t*)source;
+    size_t len = src->size - src->pos;
+
+    src->calls++;
+    if (src->fail)
+        return false;
+
+    if (len > count)
+        len = count;
+    if (len > src->max_chunk)
+        len = src->max_chunk;
+
+    memcpy(buf, src->data + src->pos, len);
+    src->pos += len;
+    *actual = len;
+    return true;
+}
+
+static void init_source(source_t *src, const pb_byte_t *data, size_t size, size_t max_chunk)
+{
+    src->data = data;
+    src->size = size;
+    src->pos = 0;
+    src->max_chunk = max_chunk;
+    src->calls = 0;
+    src->fail = false;
+}
+
+int main()
+{
+    int status = 0;
+    pb_byte_t input[AllTypes_size];
+    pb_byte_t delimited[2 * AllTypes_size + 10];
+    size_t count, delimited_length;
+    AllTypes expected, decoded;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(input, 1, sizeof(input), stdin);
+
+    memset(&expected, 0, sizeof(expected));
+    {
+        pb_istream_t stream = pb_istream_from_buffer(input, count);
+        TEST(pb_decode(&stream, AllTypes_fields, &expected));
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_read_buffer_t rb;
+        source_t src;
+        pb_istream_t stream;
+
+        COMMENT("Test decoding through read buffer");
+        init_source(&src, input, count, 1000);
+        pb_read_buffer_init(&rb, &source_read, &src, buffer, sizeof(buffer));
+        stream = pb_istream_from_read_buffer(&rb, count);
+        memset(&decoded, 0, sizeof(decoded));
+        TEST(pb_decode(&stream, AllTypes_fields, &decoded));
+        TEST(memcmp(&decoded, &expected, sizeof(expected)) == 0);
+        TEST(src.calls <= count / sizeof(buffer) + 1);
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_read_buffer_t rb;
+        source_t src;
+        pb_istream_t stream;
+
+        COMMENT("Test partial reads from source");
+        init_source(&src, input, count, 7);
+        pb_read_buffer_init(&rb, &source_read, &src, buffer, sizeof(buffer));
+        stream = pb_istream_from_read_buffer(&rb, count);
+        memset(&decoded, 0, sizeof(decoded));
+        TEST(pb_decode(&stream, AllTypes_fields, &decoded));
+        TEST(memcmp(&decoded, &expected, sizeof(expected)) == 0);
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_read_buffer_t rb;
+        source_t src;
+        pb_istream_t stream;
+
+        COMMENT("Test decoding until end of input");
+        init_source(&src, input, count, 1000);
+        pb_read_buffer_init(&rb, &source_read, &src, buffer, sizeof(buffer));
+        stream = pb_istream_from_read_buffer(&rb, SIZE_MAX);
+        memset(&decoded, 0, sizeof(decoded));
+        TEST(pb_decode(&stream, AllTypes_fields, &decoded));
+        TEST(memcmp(&decoded, &expected, sizeof(expected)) == 0);
+    }
+
+    /* Two delimited messages back-to-back */
+    delimited[0] = (pb_byte_t)(0x80 | (count & 0x7F));
+    delimited[1] = (pb_byte_t)(count >> 7);
+    memcpy(delimited + 2, input, count);
+    memcpy(delimited + 2 + count, delimited, count + 2);
+    delimited_length = 2 * (count + 2);
+
+    {
+        pb_byte_t buffer[100];
+        pb_read_buffer_t rb;
+        source_t src;
+        pb_istream_t stream;
+
+        COMMENT("Test consecutive delimited messages");
+        TEST(count >= 128 && count < 16384);
+        init_source(&src, delimited, delimited_length, 1000);
+        pb_read_buffer_init(&rb, &source_read, &src, buffer, sizeof(buffer));
+
+        stream = pb_istream_from_read_buffer(&rb, SIZE_MAX);
+        memset(&decoded, 0, sizeof(decoded));
+        TEST(pb_decode_ex(&stream, AllTypes_fields, &decoded, PB_DECODE_DELIMITED));
+        TEST(memcmp(&decoded, &expected, sizeof(expected)) == 0);
+
+        stream = pb_istream_from_read_buffer(&rb, SIZE_MAX);
+        memset(&decoded, 0, sizeof(decoded));
+        TEST(pb_decode_ex(&stream, AllTypes_fields, &decoded, PB_DECODE_DELIMITED));
+        TEST(memcmp(&decoded, &expected, sizeof(expected)) == 0);
+        TEST(src.pos == delimited_length && rb.start == rb.end);
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_read_buffer_t rb;
+        source_t src;
+        pb_istream_t stream;
+
+        COMMENT("Test truncated input");
+        init_source(&src, input, count - 1, 1000);
+        pb_read_buffer_init(&rb, &source_read, &src, buffer, sizeof(buffer));
+        stream = pb_istream_from_read_buffer(&rb, count);
+        TEST(!pb_decode(&stream, AllTypes_fields, &decoded));
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_read_buffer_t rb;
+        source_t src;
+        pb_istream_t stream;
+
+        COMMENT("Test IO error");
+        init_source(&src, input, count, 1000);
+        src.fail = true;
+        pb_read_buffer_init(&rb, &source_read, &src, buffer, sizeof(buffer));
+        stream = pb_istream_from_read_buffer(&rb, count);
+        TEST(!pb_decode(&stream, AllTypes_fields, &decoded));
+        TEST(strcmp(PB_GET_ERROR(&stream), "io error") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -91,6 +91,20 @@ int main()
               !pb_decode_varint(&s, &u)));
     }
 
+    {
+        pb_istream_t s;
+        uint64_t u;
+
+        COMMENT("Test pb_decode_varint with buffer fast path");
+        TEST((s = S("\xAC\x02""abcdefghij"), pb_decode_varint(&s, &u) && u == 300 && s.bytes_left == 10));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01""abc"),
+              pb_decode_varint(&s, &u) && u == UINT64_MAX && s.bytes_left == 3));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x02""abc"),
+              !pb_decode_varint(&s, &u)));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01"),
+              !pb_decode_varint(&s, &u)));
+    }
+
     {
         pb_istream_t s;
         uint32_t u;
@@ -107,6 +121,20 @@ int main()
         TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x80\x00"), !pb_decode_varint32(&s, &u)));
     }
 
+    {
+        pb_istream_t s;
+        uint32_t u;
+
+        COMMENT("Test pb_decode_varint32 with buffer fast path");
+        TEST((s = S("\xAC\x02""abcdefghij"), pb_decode_varint32(&s, &u) && u == 300 && s.bytes_left == 10));
+        TEST((s = S("\xFF\xFF\xFF\xFF\x0F""abcdefghij"), pb_decode_varint32(&s, &u) && u == UINT32_MAX && s.bytes_left == 10));
+        TEST((s = S("\xFF\xFF\xFF\xFF\x8F\x00""abcdefghij"), pb_decode_varint32(&s, &u) && u == UINT32_MAX && s.bytes_left == 10));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x01""abc"), pb_decode_varint32(&s, &u) && u == UINT32_MAX && s.bytes_left == 3));
+        TEST((s = S("\xFF\xFF\xFF\xFF\x10""abcdefghij"), !pb_decode_varint32(&s, &u)));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\x01""abcdefghij"), !pb_decode_varint32(&s, &u)));
+        TEST((s = S("\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\x80\x00""abc"), !pb_decode_varint32(&s, &u)));
+    }
+
     {
         pb_istream_t s;
         COMMENT("Test pb_skip_varint");
@@ -325,12 +353,29 @@ int main()
         TEST((s = S("\x0A\x0A\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0A"), pb_decode(&s, IntegerArray_fields, &dest)
             && dest.data_count == 10 && dest.data[0] == 1 && dest.data[9] == 10))
         TEST((s = S("\x0A\x0B\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0A\x0B"), !pb_decode(&s, IntegerArray_fields, &dest)))
+        TEST((s = S("\x0A\x14\xFF\xFF\xFF\xFF\x07\x80\x80\x80\x80\xF8\xFF\xFF\xFF\xFF\x01\xAC\x02\x01\x02\x03"),
+            pb_decode(&s, IntegerArray_fields, &dest) && dest.data_count == 6 &&
+            dest.data[0] == INT32_MAX && dest.data[1] == INT32_MIN && dest.data[2] == 300 && dest.data[5] == 3))
+        TEST((s = S("\x0A\x0C\x01\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF\xFF"), !pb_decode(&s, IntegerArray_fields, &dest)))
 
         /* Test invalid wire data */
         TEST((s = S("\x0A\xFF"), !pb_decode(&s, IntegerArray_fields, &dest)))
         TEST((s = S("\x0A\x01"), !pb_decode(&s, IntegerArray_fields, &dest)))
     }
 
+    {
+        pb_istream_t s;
+        FloatArray dest;
+
+        COMMENT("Testing pb_decode with packed float field")
+        TEST((s = S("\x0A\x08\x00\x00\xc6\x42\x00\x00\x80\xbf"), pb_decode(&s, FloatArray_fields, &dest)
+            && dest.data_count == 2 && dest.data[0] == 99.0f && dest.data[1] == -1.0f))
+        TEST((s = S("\x0A\x06\x00\x00\xc6\x42\x00\x00"), !pb_decode(&s, FloatArray_fields, &dest)))
+        TEST((s = S("\x0A\x2C\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+                    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+                    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"), !pb_decode(&s, FloatArray_fields, &dest)))
+    }
+
     {
         pb_istream_t s;
         IntegerArray dest;
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "iovec.pb.h"
+
+/* Concatenate the segments into a single buffer */
+static size_t gather(const pb_iovec_state_t *state, pb_byte_t *dest)
+{
+    size_t i, total = 0;
+    for (i = 0; i < state->iov_count; i++)
+    {
+        memcpy(dest + total, state->iov[i].base, state->iov[i].len);
+        total += state->iov[i].len;
+    }
+    return total;
+}
+
+static bool refers_to(const pb_iovec_state_t *state, const pb_byte_t *data, size_t len)
+{
+    size_t i;
+    for (i = 0; i < state->iov_count; i++)
+    {
+        if (state->iov[i].base == data && state->iov[i].len == len)
+            return true;
+    }
+    return false;
+}
+
+int main()
+{
+    int status = 0;
+    Envelope msg = Envelope_init_zero;
+    pb_byte_t expected[Envelope_size];
+    pb_byte_t gathered[Envelope_size];
+    size_t expected_length;
+    size_t i;
+
+    strcpy(msg.name, "envelope");
+    msg.blob.size = 1000;
+    for (i = 0; i < msg.blob.size; i++)
+        msg.blob.bytes[i] = (pb_byte_t)i;
+    msg.payloads_count = 2;
+    msg.payloads[0].id = 1;
+    msg.payloads[0].data.size = 300;
+    memset(msg.payloads[0].data.bytes, 0xAA, 300);
+    msg.payloads[1].id = 2;
+    msg.payloads[1].data.size = 4;
+    memset(msg.payloads[1].data.bytes, 0x55, 4);
+    msg.has_trailer = true;
+    msg.trailer = 1234;
+
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(expected, sizeof(expected));
+        TEST(pb_encode(&stream, Envelope_fields, &msg));
+        expected_length = stream.bytes_written;
+    }
+
+    {
+        pb_iovec_t iov[16];
+        pb_byte_t buffer[64];
+        pb_iovec_state_t state;
+        pb_ostream_t stream;
+
+        COMMENT("Test that large fields are referenced instead of copied");
+        stream = pb_ostream_from_iovec(&state, iov, 16, buffer, sizeof(buffer), 256);
+        TEST(pb_encode(&stream, Envelope_fields, &msg));
+        TEST(stream.bytes_written == expected_length);
+        TEST(gather(&state, gathered) == expected_length);
+        TEST(memcmp(gathered, expected, expected_length) == 0);
+        TEST(refers_to(&state, msg.blob.bytes, 1000));
+        TEST(refers_to(&state, msg.payloads[0].data.bytes, 300));
+        TEST(!refers_to(&state, msg.payloads[1].data.bytes, 4));
+        TEST(state.iov_count == 5);
+        TEST(state.buf_used == expected_length - 1300);
+    }
+
+    {
+        pb_iovec_t iov[16];
+        pb_byte_t buffer[Envelope_size];
+        pb_iovec_state_t state;
+        pb_ostream_t stream;
+
+        COMMENT("Test that data below the threshold is copied");
+        stream = pb_ostream_from_iovec(&state, iov, 16, buffer, sizeof(buffer), 2000);
+        TEST(pb_encode(&stream, Envelope_fields, &msg));
+        TEST(state.iov_count == 1);
+        TEST(state.iov[0].base == buffer && state.iov[0].len == expected_length);
+        TEST(memcmp(buffer, expected, expected_length) == 0);
+    }
+
+    {
+        pb_iovec_t iov[3];
+        pb_byte_t buffer[64];
+        pb_iovec_state_t state;
+        pb_ostream_t stream;
+
+        COMMENT("Test running out of segments");
+        stream = pb_ostream_from_iovec(&state, iov, 3, buffer, sizeof(buffer), 256);
+        TEST(!pb_encode(&stream, Envelope_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&stream), "iovec full") == 0);
+    }
+
+    {
+        pb_iovec_t iov[16];
+        pb_byte_t buffer[16];
+        pb_iovec_state_t state;
+        pb_ostream_t stream;
+
+        COMMENT("Test running out of copy buffer");
+        stream = pb_ostream_from_iovec(&state, iov, 16, buffer, sizeof(buffer), 256);
+        TEST(!pb_encode(&stream, Envelope_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&stream), "iovec buffer full") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
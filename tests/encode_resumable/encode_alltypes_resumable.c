@@ -0,0 +1,80 @@
+/* Encodes the alltypes test data with pb_encoder_fill() into windows of
+ * every size, and checks that the output matches pb_encode().
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "unittests.h"
+#include "test_helpers.h"
+
+/* Encode the message in windows of window_size bytes */
+static size_t encode_windowed(const AllTypes *msg, size_t window_size, pb_byte_t *output, size_t output_size)
+{
+    pb_encoder_t encoder;
+    pb_encode_frame_t frames[4];
+    pb_byte_t buffer[32];
+    size_t pos = 0;
+    size_t count;
+
+    if (!pb_encoder_init(&encoder, AllTypes_fields, msg, frames, 4, buffer, sizeof(buffer)))
+        return 0;
+
+    do {
+        if (pos + window_size > output_size)
+            return 0;
+
+        if (!pb_encoder_fill(&encoder, output + pos, window_size, &count))
+        {
+            printf("Window size %d: %s\n", (int)window_size, PB_GET_ERROR(&encoder));
+            return 0;
+        }
+
+        pos += count;
+    } while (count == window_size);
+
+    return pos;
+}
+
+int main()
+{
+    int status = 0;
+    uint8_t input[1024];
+    pb_byte_t expected[1024];
+    pb_byte_t actual[2048];
+    size_t count, expected_size, window_size;
+    AllTypes msg = AllTypes_init_zero;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(input, 1, sizeof(input), stdin);
+
+    {
+        pb_istream_t stream = pb_istream_from_buffer(input, count);
+        TEST(pb_decode(&stream, AllTypes_fields, &msg));
+    }
+
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(expected, sizeof(expected));
+        TEST(pb_encode(&stream, AllTypes_fields, &msg));
+        expected_size = stream.bytes_written;
+    }
+
+    for (window_size = 1; window_size <= expected_size + 1; window_size++)
+    {
+        size_t actual_size = encode_windowed(&msg, window_size, actual, sizeof(actual));
+        if (actual_size != expected_size || memcmp(expected, actual, expected_size) != 0)
+        {
+            printf("Window size %d failed\n", (int)window_size);
+            status = 1;
+        }
+    }
+
+    TEST(status == 0);
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
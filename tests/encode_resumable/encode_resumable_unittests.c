@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "encode_resumable.pb.h"
+
+#define MAX_DEPTH 2
+
+/* Callback for the tags field, arg points to a null-terminated list */
+static bool write_tags(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+    const char * const *tag;
+    for (tag = (const char * const *)*arg; *tag != NULL; tag++)
+    {
+        if (!pb_encode_tag_for_field(stream, field) ||
+            !pb_encode_string(stream, (const pb_byte_t*)*tag, strlen(*tag)))
+            return false;
+    }
+    return true;
+}
+
+/* Encode the message in windows of window_size bytes */
+static bool encode_windowed(const Stream *msg, pb_size_t max_depth, size_t buffer_size,
+                            size_t window_size, pb_byte_t *output, size_t output_size,
+                            size_t *total, const char **error)
+{
+    pb_encoder_t encoder;
+    pb_encode_frame_t frames[MAX_DEPTH];
+    pb_byte_t buffer[64];
+    size_t count;
+
+    *total = 0;
+    *error = NULL;
+
+    if (!pb_encoder_init(&encoder, Stream_fields, msg, frames, max_depth, buffer, buffer_size))
+    {
+        *error = PB_GET_ERROR(&encoder);
+        return false;
+    }
+
+    do {
+        if (*total + window_size > output_size)
+            return false;
+
+        if (!pb_encoder_fill(&encoder, output + *total, window_size, &count))
+        {
+            *error = PB_GET_ERROR(&encoder);
+            return false;
+        }
+
+        *total += count;
+    } while (count == window_size);
+
+    return true;
+}
+
+int main()
+{
+    int status = 0;
+    pb_byte_t expected[512];
+    pb_byte_t actual[512];
+    size_t expected_size, actual_size;
+    const char *error;
+    const char *short_tags[] = {"first", "second", NULL};
+    const char *long_tags[] = {"a tag that is longer than the encoder buffer", NULL};
+    Stream msg = Stream_init_zero;
+    pb_size_t i;
+
+    msg.chunks_count = 3;
+    for (i = 0; i < 3; i++)
+    {
+        msg.chunks[i].seq = i;
+        msg.chunks[i].has_payload = true;
+        msg.chunks[i].payload.size = (pb_size_t)(50 * i);
+        memset(msg.chunks[i].payload.bytes, 'a' + i, msg.chunks[i].payload.size);
+        msg.chunks[i].samples_count = 4;
+        msg.chunks[i].samples[0] = -1;
+        msg.chunks[i].samples[1] = 1000;
+        msg.chunks[i].samples[2] = -100000;
+        msg.chunks[i].samples[3] = (int32_t)i;
+    }
+    msg.has_name = true;
+    strcpy(msg.name, "stream name");
+    msg.tags.funcs.encode = &write_tags;
+    msg.tags.arg = (void*)short_tags;
+
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(expected, sizeof(expected));
+        TEST(pb_encode(&stream, Stream_fields, &msg));
+        expected_size = stream.bytes_written;
+    }
+
+    COMMENT("Test encoding in small windows");
+    TEST(encode_windowed(&msg, MAX_DEPTH, 16, 7, actual, sizeof(actual), &actual_size, &error));
+    TEST(actual_size == expected_size);
+    TEST(memcmp(expected, actual, expected_size) == 0);
+
+    COMMENT("Test encoding in a single large window");
+    TEST(encode_windowed(&msg, MAX_DEPTH, 16, sizeof(actual), actual, sizeof(actual), &actual_size, &error));
+    TEST(actual_size == expected_size);
+    TEST(memcmp(expected, actual, expected_size) == 0);
+
+    COMMENT("Test callback field larger than the buffer");
+    msg.tags.arg = (void*)long_tags;
+    TEST(!encode_windowed(&msg, MAX_DEPTH, 16, 7, actual, sizeof(actual), &actual_size, &error));
+    TEST(error != NULL && strcmp(error, "field too large for buffer") == 0);
+    TEST(encode_windowed(&msg, MAX_DEPTH, 64, 7, actual, sizeof(actual), &actual_size, &error));
+
+    COMMENT("Test nesting deeper than max_depth");
+    TEST(!encode_windowed(&msg, 1, 64, 7, actual, sizeof(actual), &actual_size, &error));
+    TEST(error != NULL && strcmp(error, "max depth exceeded") == 0);
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "size_cache.pb.h"
+
+/* Memory stream that is not recognized as a buffer stream by pb_encode.c */
+static bool memwritecallback(pb_ostream_t *stream, const uint8_t *buf, size_t count)
+{
+    uint8_t *dest = (uint8_t*)stream->state;
+    memcpy(dest, buf, count);
+    stream->state = dest + count;
+    return true;
+}
+
+/* Counts the number of times it has been called */
+static bool textcallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+    int *calls = (int*)*arg;
+    (*calls)++;
+
+    if (!pb_encode_tag_for_field(stream, field))
+        return false;
+
+    return pb_encode_string(stream, (const pb_byte_t*)"abc", 3);
+}
+
+static void init_leaf(Leaf *leaf, int32_t value, int *calls)
+{
+    leaf->value = value;
+    leaf->text.funcs.encode = textcallback;
+    leaf->text.arg = calls;
+}
+
+int main(void)
+{
+    int status = 0;
+    int calls = 0;
+    Level3 msg = Level3_init_zero;
+    uint8_t expected[256];
+    size_t expected_size;
+
+    msg.m.m.leaves_count = 3;
+    init_leaf(&msg.m.m.leaves[0], 1, &calls);
+    init_leaf(&msg.m.m.leaves[1], 200, &calls);
+    init_leaf(&msg.m.m.leaves[2], -3, &calls);
+    msg.m.has_extra = true;
+    init_leaf(&msg.m.extra, 4, &calls);
+    msg.last = 5;
+
+    {
+        pb_ostream_t s = pb_ostream_from_buffer(expected, sizeof(expected));
+        if (!pb_encode(&s, Level3_fields, &msg))
+        {
+            fprintf(stderr, "Encoding failed: %s\n", PB_GET_ERROR(&s));
+            return 1;
+        }
+        expected_size = s.bytes_written;
+    }
+
+    {
+        uint8_t buffer[256];
+        size_t sizes[7];
+        pb_ostream_t s = {&memwritecallback, buffer, sizeof(buffer), 0};
+
+        COMMENT("Encode with room for all sizes");
+        sizes[6] = 12345;
+        calls = 0;
+        TEST(pb_encode_ex_cached(&s, Level3_fields, &msg, 0, sizes, 7));
+        TEST(s.bytes_written == expected_size);
+        TEST(memcmp(buffer, expected, expected_size) == 0);
+        TEST(calls == 2 * 4);
+        TEST(sizes[0] == expected_size - 4);
+        TEST(sizes[6] == 12345);
+        TEST(s.size_cache == NULL);
+    }
+
+    {
+        uint8_t buffer[256];
+        size_t sizes[2];
+        pb_ostream_t s = {&memwritecallback, buffer, sizeof(buffer), 0};
+
+        COMMENT("Encode with too small cache");
+        TEST(pb_encode_ex_cached(&s, Level3_fields, &msg, 0, sizes, 2));
+        TEST(s.bytes_written == expected_size);
+        TEST(memcmp(buffer, expected, expected_size) == 0);
+    }
+
+    {
+        uint8_t buffer[256];
+        size_t sizes[8];
+        pb_ostream_t s = {&memwritecallback, buffer, sizeof(buffer), 0};
+
+        COMMENT("Encode delimited");
+        TEST(pb_encode_ex_cached(&s, Level3_fields, &msg, PB_ENCODE_DELIMITED, sizes, 8));
+        TEST(s.bytes_written == expected_size + 1);
+        TEST(buffer[0] == expected_size);
+        TEST(memcmp(buffer + 1, expected, expected_size) == 0);
+    }
+
+    {
+        uint8_t buffer[256];
+        size_t sizes[7];
+        pb_ostream_t s = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+        COMMENT("Encode to memory buffer");
+        TEST(pb_encode_ex_cached(&s, Level3_fields, &msg, 0, sizes, 7));
+        TEST(s.bytes_written == expected_size);
+        TEST(memcmp(buffer, expected, expected_size) == 0);
+    }
+
+    {
+        uint8_t buffer[256];
+        size_t sizes[7];
+        pb_ostream_t s = {&memwritecallback, buffer, 20, 0};
+
+        COMMENT("Encode to too small stream");
+        TEST(!pb_encode_ex_cached(&s, Level3_fields, &msg, 0, sizes, 7));
+        TEST(strcmp(PB_GET_ERROR(&s), "stream full") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -18,6 +18,15 @@ bool streamcallback(pb_ostream_t *stream, const uint8_t *buf, size_t count)
     return true;
 }
 
+bool memwritecallback(pb_ostream_t *stream, const uint8_t *buf, size_t count)
+{
+    /* Same as buffer stream, but not recognized as one by pb_encode.c */
+    uint8_t *dest = (uint8_t*)stream->state;
+    memcpy(dest, buf, count);
+    stream->state = dest + count;
+    return true;
+}
+
 bool fieldcallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
 {
     int value = 0x55;
@@ -36,6 +45,27 @@ bool crazyfieldcallback(pb_ostream_t *stream, const pb_field_t *field, void * co
     return pb_encode_varint(stream, *state);
 }
 
+bool growingfieldcallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+    /* This callback writes more data every time it is called. */
+    uint32_t *state = (uint32_t*)*arg;
+    *state <<= 8;
+    if (!pb_encode_tag_for_field(stream, field))
+        return false;
+    return pb_encode_varint(stream, *state);
+}
+
+bool longfieldcallback(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+    /* Writes a string of given length */
+    char str[256];
+    size_t len = *(size_t*)*arg;
+    memset(str, 'x', len);
+    if (!pb_encode_tag(stream, PB_WT_STRING, field->tag))
+        return false;
+    return pb_encode_string(stream, (const pb_byte_t*)str, len);
+}
+
 /* Check that expression x writes data y.
  * Y is a string, which may contain null bytes. Null terminator is ignored.
  */
@@ -107,6 +137,39 @@ int main()
         TEST(WRITES(pb_encode_varint(&s, UINT32_MAX), "\xFF\xFF\xFF\xFF\x0F"));
     }
     
+    {
+        uint8_t buffer[12];
+        pb_ostream_t s;
+        pb_ostream_t sizing = PB_OSTREAM_SIZING;
+        
+        COMMENT("Test pb_varint_size")
+        TEST(pb_varint_size(0) == 1);
+        TEST(pb_varint_size(0x7F) == 1);
+        TEST(pb_varint_size(0x80) == 2);
+        TEST(pb_varint_size(0x3FFF) == 2);
+        TEST(pb_varint_size(0x4000) == 3);
+        TEST(pb_varint_size(0x0FFFFFFF) == 4);
+        TEST(pb_varint_size(0x10000000) == 5);
+        TEST(pb_varint_size(UINT32_MAX) == 5);
+        TEST(pb_varint_size((uint64_t)1 << 35) == 6);
+        TEST(pb_varint_size((uint64_t)1 << 56) == 9);
+        TEST(pb_varint_size((uint64_t)1 << 63) == 10);
+        TEST(pb_varint_size(UINT64_MAX) == 10);
+        
+        COMMENT("Test pb_encode_varint to sizing stream")
+        TEST(pb_encode_varint(&sizing, 0x4000) && sizing.bytes_written == 3);
+        TEST(pb_encode_varint(&sizing, UINT64_MAX) && sizing.bytes_written == 13);
+        
+        COMMENT("Test pb_encode_varint near end of buffer")
+        s = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        TEST(pb_write(&s, buffer, 7));
+        TEST(pb_encode_varint(&s, 0x4000) && s.bytes_written == 10);
+        TEST(memcmp(buffer + 7, "\x80\x80\x01", 3) == 0);
+        TEST(!pb_encode_varint(&s, 0x4000) && s.bytes_written == 10);
+        TEST(pb_encode_varint(&s, 0x3FFF) && s.bytes_written == 12);
+        TEST(memcmp(buffer + 10, "\xFF\x7F", 2) == 0);
+    }
+    
     {
         uint8_t buffer[50];
         pb_ostream_t s;
@@ -390,6 +453,58 @@ int main()
         TEST(!pb_encode(&s, CallbackContainer_fields, &msg))
         state = 1;
         TEST(!pb_encode(&s, CallbackContainerContainer_fields, &msg2))
+
+        /* Callback streams encode submessages twice, and detect the change */
+        s.callback = &memwritecallback;
+        s.state = buffer;
+        s.max_size = sizeof(buffer);
+        s.bytes_written = 0;
+        state = 0x7F;
+        msg.submsg.data.funcs.encode = &growingfieldcallback;
+        msg.submsg.data.arg = &state;
+        TEST(!pb_encode(&s, CallbackContainer_fields, &msg))
+    }
+
+    {
+        uint8_t buffer[300];
+        pb_ostream_t s;
+        IntegerContainer msg = {{5, {1,2,3,4,5}}};
+
+        COMMENT("Test submessage length prefix with large buffer")
+        s = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        TEST(pb_encode(&s, IntegerContainer_fields, &msg))
+        TEST(s.bytes_written == 9)
+        TEST(memcmp(buffer, "\x0A\x07\x0A\x05\x01\x02\x03\x04\x05", 9) == 0)
+    }
+
+    {
+        uint8_t buffer[8];
+        pb_ostream_t s;
+        IntegerContainer msg = {{5, {1,2,3,4,5}}};
+
+        COMMENT("Test submessage that does not fit in buffer")
+        s = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        TEST(!pb_encode(&s, IntegerContainer_fields, &msg))
+    }
+
+    {
+        uint8_t buffer[130];
+        pb_ostream_t s;
+        CallbackContainer msg;
+        size_t len = 125;
+        size_t size;
+
+        msg.submsg.data.funcs.encode = &longfieldcallback;
+        msg.submsg.data.arg = &len;
+
+        COMMENT("Test submessage that exactly fills the buffer")
+        TEST(pb_get_encoded_size(&size, CallbackContainer_fields, &msg) && size == 129)
+        s = pb_ostream_from_buffer(buffer, size);
+        TEST(pb_encode(&s, CallbackContainer_fields, &msg))
+        TEST(s.bytes_written == 129)
+        TEST(memcmp(buffer, "\x0A\x7F\x0A\x7D", 4) == 0)
+        s = pb_ostream_from_buffer(buffer, size - 1);
+        TEST(!pb_encode(&s, CallbackContainer_fields, &msg))
     }
     
     {
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "alltypes.pb.h"
+#include "test_helpers.h"
+#include "unittests.h"
+
+/* Memory destination that counts the write calls */
+typedef struct {
+    pb_byte_t data[AllTypes_size + 10];
+    size_t pos;
+    size_t calls;
+    size_t fail_after;
+} sink_t;
+
+static bool sink_write(void *dest, const pb_byte_t *buf, size_t count)
+{
+    sink_t *sink = (sink_t*)dest;
+
+    if (sink->calls++ >= sink->fail_after || count > sizeof(sink->data) - sink->pos)
+        return false;
+
+    memcpy(sink->data + sink->pos, buf, count);
+    sink->pos += count;
+    return true;
+}
+
+static void init_sink(sink_t *sink)
+{
+    sink->pos = 0;
+    sink->calls = 0;
+    sink->fail_after = (size_t)-1;
+}
+
+int main()
+{
+    int status = 0;
+    pb_byte_t input[AllTypes_size];
+    size_t count;
+    AllTypes msg = AllTypes_init_zero;
+    sink_t sink;
+
+    SET_BINARY_MODE(stdin);
+    count = fread(input, 1, sizeof(input), stdin);
+
+    {
+        pb_istream_t stream = pb_istream_from_buffer(input, count);
+        TEST(pb_decode(&stream, AllTypes_fields, &msg));
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_write_buffer_t wb;
+        pb_ostream_t stream;
+
+        COMMENT("Test encoding through write buffer");
+        init_sink(&sink);
+        pb_write_buffer_init(&wb, &sink_write, &sink, buffer, sizeof(buffer));
+        stream = pb_ostream_from_write_buffer(&wb, SIZE_MAX);
+        TEST(pb_encode(&stream, AllTypes_fields, &msg));
+        TEST(pb_flush(&stream));
+        TEST(stream.bytes_written == count);
+        TEST(sink.pos == count && memcmp(sink.data, input, count) == 0);
+        TEST(sink.calls <= count / sizeof(buffer) + 1);
+    }
+
+    {
+        pb_byte_t buffer[4];
+        pb_write_buffer_t wb;
+        pb_ostream_t stream;
+
+        COMMENT("Test write buffer smaller than fields");
+        init_sink(&sink);
+        pb_write_buffer_init(&wb, &sink_write, &sink, buffer, sizeof(buffer));
+        stream = pb_ostream_from_write_buffer(&wb, SIZE_MAX);
+        TEST(pb_encode(&stream, AllTypes_fields, &msg));
+        TEST(pb_flush(&stream));
+        TEST(sink.pos == count && memcmp(sink.data, input, count) == 0);
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_write_buffer_t wb;
+        pb_ostream_t stream;
+
+        COMMENT("Test delimited encoding and flush with empty buffer");
+        init_sink(&sink);
+        pb_write_buffer_init(&wb, &sink_write, &sink, buffer, sizeof(buffer));
+        stream = pb_ostream_from_write_buffer(&wb, SIZE_MAX);
+        TEST(pb_encode_ex(&stream, AllTypes_fields, &msg, PB_ENCODE_DELIMITED));
+        TEST(pb_flush(&stream));
+        TEST(pb_flush(&stream));
+        TEST(sink.pos == count + 2 && memcmp(sink.data + 2, input, count) == 0);
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_write_buffer_t wb;
+        pb_ostream_t stream;
+
+        COMMENT("Test max_size limit");
+        init_sink(&sink);
+        pb_write_buffer_init(&wb, &sink_write, &sink, buffer, sizeof(buffer));
+        stream = pb_ostream_from_write_buffer(&wb, count - 1);
+        TEST(!pb_encode(&stream, AllTypes_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&stream), "stream full") == 0);
+    }
+
+    {
+        pb_byte_t buffer[64];
+        pb_write_buffer_t wb;
+        pb_ostream_t stream;
+
+        COMMENT("Test IO errors");
+        init_sink(&sink);
+        sink.fail_after = 1;
+        pb_write_buffer_init(&wb, &sink_write, &sink, buffer, sizeof(buffer));
+        stream = pb_ostream_from_write_buffer(&wb, SIZE_MAX);
+        TEST(!pb_encode(&stream, AllTypes_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&stream), "io error") == 0);
+
+        init_sink(&sink);
+        sink.fail_after = 0;
+        pb_write_buffer_init(&wb, &sink_write, &sink, buffer, sizeof(buffer));
+        stream = pb_ostream_from_write_buffer(&wb, SIZE_MAX);
+        TEST(pb_encode_tag(&stream, PB_WT_VARINT, 1));
+        TEST(!pb_flush(&stream));
+        TEST(strcmp(PB_GET_ERROR(&stream), "io error") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include "fast_decode.pb.h"
+#include "unittests.h"
+
+static const pb_byte_t full_input[] = {
+    0x08, 0x96, 0x01,                   /* req_int = 150 */
+    0x10, 0x05,                         /* opt_uint = 5 */
+    0x18, 0x03,                         /* opt_sint = -2 */
+    0x20, 0x01,                         /* opt_bool = true */
+    0x28, 0x02,                         /* opt_enum = BLUE */
+    0x35, 0x78, 0x56, 0x34, 0x12,       /* req_fixed = 0x12345678 */
+    0x39, 0, 0, 0, 0, 0, 0, 0xF0, 0x3F, /* opt_double = 1.0 */
+    0x45, 0, 0, 0x80, 0x3F,             /* opt_float = 1.0 */
+    0x48, 0x7F,                         /* small = 127 */
+    0x52, 0x02, 'h', 'i',               /* text = "hi" */
+    0x58, 0x01, 0x58, 0x02,             /* list = [1, 2] */
+    0x60, 0x07,                         /* choice_int = 7 */
+    0x80, 0x01, 0x0B,                   /* big_tag = 11 */
+    0x78, 0x09                          /* req_last = 9 */
+};
+
+#define CHECK_FIELDS(msg) \
+    TEST(msg.req_int == 150 && msg.req_fixed == 0x12345678 && msg.req_last == 9); \
+    TEST(msg.has_opt_uint && msg.opt_uint == 5); \
+    TEST(msg.has_opt_sint && msg.opt_sint == -2); \
+    TEST(msg.has_opt_bool && msg.opt_bool); \
+    TEST(msg.has_opt_enum && msg.opt_enum == Color_BLUE); \
+    TEST(msg.has_opt_double && msg.opt_double == 1.0); \
+    TEST(msg.has_opt_float && msg.opt_float == 1.0f); \
+    TEST(msg.has_small && msg.small == 127); \
+    TEST(msg.has_text && strcmp(msg.text, "hi") == 0); \
+    TEST(msg.list_count == 2 && msg.list[0] == 1 && msg.list[1] == 2); \
+    TEST(msg.which_choice == 12 && msg.choice.choice_int == 7); \
+    TEST(msg.has_big_tag && msg.big_tag == 11)
+
+static bool decode_both(const pb_byte_t *buf, size_t len, const char **fast_err, const char **slow_err)
+{
+    FastMsg fast = FastMsg_init_zero;
+    SlowMsg slow = SlowMsg_init_zero;
+    pb_istream_t s1 = pb_istream_from_buffer(buf, len);
+    pb_istream_t s2 = pb_istream_from_buffer(buf, len);
+    bool r1 = pb_decode(&s1, FastMsg_fields, &fast);
+    bool r2 = pb_decode(&s2, SlowMsg_fields, &slow);
+    *fast_err = PB_GET_ERROR(&s1);
+    *slow_err = PB_GET_ERROR(&s2);
+    return r1 == r2;
+}
+
+int main()
+{
+    int status = 0;
+
+    COMMENT("Test that only FastMsg has the fast table");
+    TEST(FastMsg_msg.fast_table != NULL && FastMsg_msg.fast_table_count == 16);
+    TEST(SlowMsg_msg.fast_table == NULL && SlowMsg_msg.fast_table_count == 0);
+    TEST(FastMsg_msg.fast_table[10].tag_byte == 0);
+    TEST(FastMsg_msg.fast_table[11].tag_byte == 0);
+    TEST(FastMsg_msg.fast_table[12].tag_byte == 0);
+
+    {
+        FastMsg fast = FastMsg_init_zero;
+        SlowMsg slow = SlowMsg_init_zero;
+        pb_istream_t stream;
+
+        COMMENT("Test decoding all fields");
+        stream = pb_istream_from_buffer(full_input, sizeof(full_input));
+        TEST(pb_decode(&stream, FastMsg_fields, &fast));
+        CHECK_FIELDS(fast);
+
+        stream = pb_istream_from_buffer(full_input, sizeof(full_input));
+        TEST(pb_decode(&stream, SlowMsg_fields, &slow));
+        CHECK_FIELDS(slow);
+    }
+
+    {
+        FastMsg fast = FastMsg_init_zero;
+        const pb_byte_t input[] = {0x08, 0x01, 0x35, 0, 0, 0, 0, 0x78, 0x01, 0x10, 0x02};
+        pb_istream_t stream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test has_ fields of missing optional fields");
+        TEST(pb_decode(&stream, FastMsg_fields, &fast));
+        TEST(fast.has_opt_uint && !fast.has_opt_sint && !fast.has_opt_bool && !fast.has_small);
+    }
+
+    {
+        const char *fast_err, *slow_err;
+
+        COMMENT("Test missing required field");
+        TEST(decode_both(full_input, sizeof(full_input) - 2, &fast_err, &slow_err));
+        TEST(strcmp(fast_err, "missing required field") == 0);
+        TEST(strcmp(slow_err, "missing required field") == 0);
+    }
+
+    {
+        const char *fast_err, *slow_err;
+        const pb_byte_t input[] = {0x48, 0xAC, 0x02};
+
+        COMMENT("Test integer overflow");
+        TEST(decode_both(input, sizeof(input), &fast_err, &slow_err));
+        TEST(strcmp(fast_err, "integer too large") == 0);
+        TEST(strcmp(slow_err, "integer too large") == 0);
+    }
+
+    {
+        const char *fast_err, *slow_err;
+        const pb_byte_t input[] = {0x0D, 0x01, 0x00, 0x00, 0x00};
+
+        COMMENT("Test wrong wire type");
+        TEST(decode_both(input, sizeof(input), &fast_err, &slow_err));
+        TEST(strcmp(fast_err, "wrong wire type") == 0);
+        TEST(strcmp(slow_err, "wrong wire type") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "field_mask.pb.h"
+
+/* Fill the fields outside the mask with values that the decoder must not touch */
+static void init_untouched(Record *msg)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->header.seq = 99;
+    strcpy(msg->header.source, "old");
+    msg->has_name = true;
+    strcpy(msg->name, "old");
+    msg->has_extra = true;
+    msg->extra.seq = 98;
+    msg->count = 77;
+    msg->code = 97;
+}
+
+int main()
+{
+    int status = 0;
+    pb_byte_t buffer[256];
+    size_t message_length;
+
+    {
+        Record msg = Record_init_default;
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+        msg.id = 1;
+        msg.header.seq = 2;
+        msg.header.has_timestamp = true;
+        msg.header.timestamp = 1234567890123LL;
+        msg.header.has_source = true;
+        strcpy(msg.header.source, "source");
+        msg.header.has_priority = true;
+        msg.header.priority = 3;
+        msg.has_name = true;
+        strcpy(msg.name, "name");
+        msg.values_count = 2;
+        msg.values[0] = -4;
+        msg.values[1] = 5;
+        msg.has_extra = true;
+        msg.extra.seq = 6;
+        msg.has_count = true;
+        msg.count = 7;
+        msg.code = 8;
+        msg.has_far = true;
+        msg.far = 9;
+
+        TEST(pb_encode(&ostream, Record_fields, &msg));
+        message_length = ostream.bytes_written;
+    }
+
+    COMMENT("Test generated mask");
+    TEST(Record_decode_mask.tags[0] == ((1U << 1) | (1U << 2) | (1U << 4)));
+    TEST(Record_decode_mask.tags[1] == 0 && Record_decode_mask.tags[2] == 0);
+    TEST(Record_decode_mask.tags[3] == (1U << (100 - 96)));
+    TEST(Record_decode_mask.submsgs[0] != NULL && Record_decode_mask.submsgs[1] == NULL);
+    TEST(Record_decode_mask.submsgs[0]->tags[0] == ((1U << 2) | (1U << 4)));
+
+    {
+        Record msg;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, message_length);
+
+        COMMENT("Test decoding fields in the mask");
+        init_untouched(&msg);
+        TEST(pb_decode_masked(&stream, Record_fields, &msg, &Record_decode_mask, 0));
+        TEST(stream.bytes_left == 0);
+        TEST(msg.id == 1);
+        TEST(msg.header.has_timestamp && msg.header.timestamp == 1234567890123LL);
+        TEST(msg.header.has_priority && msg.header.priority == 3);
+        TEST(msg.values_count == 2 && msg.values[0] == -4 && msg.values[1] == 5);
+        TEST(msg.has_far && msg.far == 9);
+
+        COMMENT("Test that fields outside the mask are left untouched");
+        TEST(msg.header.seq == 99 && !msg.header.has_source && strcmp(msg.header.source, "old") == 0);
+        TEST(msg.has_name && strcmp(msg.name, "old") == 0);
+        TEST(msg.has_extra && msg.extra.seq == 98);
+        TEST(!msg.has_count && msg.count == 77);
+        TEST(msg.code == 97);
+    }
+
+    {
+        Record msg;
+        const pb_byte_t input[] = {0x08, 0x01, 0x12, 0x02, 0x08, 0x02};
+        pb_istream_t stream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test default values of fields in the mask");
+        init_untouched(&msg);
+        msg.header.has_timestamp = true;
+        msg.header.priority = 42;
+        msg.values_count = 3;
+        TEST(pb_decode_masked(&stream, Record_fields, &msg, &Record_decode_mask, 0));
+        TEST(msg.id == 1 && msg.header.seq == 99);
+        TEST(!msg.header.has_timestamp && !msg.header.has_priority && msg.header.priority == 5);
+        TEST(msg.values_count == 0 && !msg.has_far);
+        TEST(msg.count == 77);
+    }
+
+    {
+        Record msg;
+        const pb_byte_t input[] = {0x12, 0x02, 0x10, 0x07};
+        pb_istream_t stream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test missing required field in the mask");
+        init_untouched(&msg);
+        TEST(!pb_decode_masked(&stream, Record_fields, &msg, &Record_decode_mask, 0));
+        TEST(strcmp(PB_GET_ERROR(&stream), "missing required field") == 0);
+    }
+
+    {
+        Record msg;
+        pb_byte_t delimited[256];
+        pb_istream_t stream;
+
+        COMMENT("Test delimited masked decoding with PB_DECODE_NOINIT");
+        delimited[0] = (pb_byte_t)message_length;
+        memcpy(delimited + 1, buffer, message_length);
+        stream = pb_istream_from_buffer(delimited, message_length + 1);
+        init_untouched(&msg);
+        msg.header.priority = 42;
+        TEST(pb_decode_masked(&stream, Record_fields, &msg, &Record_decode_mask,
+                              PB_DECODE_DELIMITED | PB_DECODE_NOINIT));
+        TEST(stream.bytes_left == 0);
+        TEST(msg.id == 1 && msg.header.priority == 3 && msg.far == 9);
+        TEST(msg.header.seq == 99 && msg.count == 77);
+    }
+
+    {
+        Record msg;
+        const pb_byte_t input[] = {0x08, 0x01, 0x12, 0x02, 0x08, 0x02, 0x15, 0x00, 0x00, 0x00, 0x00};
+        pb_istream_t stream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test wrong wire type for masked submessage");
+        init_untouched(&msg);
+        TEST(!pb_decode_masked(&stream, Record_fields, &msg, &Record_decode_mask, 0));
+        TEST(strcmp(PB_GET_ERROR(&stream), "wrong wire type") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "lazy_submessage.pb.h"
+
+int main()
+{
+    int status = 0;
+    pb_byte_t buffer[256];
+    size_t message_length;
+
+    {
+        FullEnvelope msg = FullEnvelope_init_zero;
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+        msg.id = 42;
+        msg.has_payload = true;
+        msg.payload.value = 1;
+        msg.payload.has_text = true;
+        strcpy(msg.payload.text, "payload");
+        msg.items_count = 2;
+        msg.items[0].value = 2;
+        msg.items[1].value = 3;
+        msg.items[1].has_text = true;
+        strcpy(msg.items[1].text, "item");
+        msg.has_route = true;
+        strcpy(msg.route, "route");
+
+        TEST(pb_encode(&ostream, FullEnvelope_fields, &msg));
+        message_length = ostream.bytes_written;
+    }
+
+    {
+        Envelope msg = Envelope_init_zero;
+        Payload payload = Payload_init_zero;
+        pb_byte_t buffer2[256];
+        pb_istream_t istream = pb_istream_from_buffer(buffer, message_length);
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+
+        COMMENT("Test decoding with lazy fields");
+        TEST(pb_decode(&istream, Envelope_fields, &msg));
+        TEST(msg.id == 42 && msg.has_route && strcmp(msg.route, "route") == 0);
+        TEST(msg.has_payload && msg.payload.bytes > buffer &&
+             msg.payload.bytes + msg.payload.size < buffer + message_length);
+        TEST(msg.items_count == 2);
+
+        COMMENT("Test decoding lazy fields on demand");
+        TEST(pb_decode_lazy(&msg.payload, Payload_fields, &payload));
+        TEST(payload.value == 1 && payload.has_text && strcmp(payload.text, "payload") == 0);
+        TEST(pb_decode_lazy(&msg.items[0], Payload_fields, &payload));
+        TEST(payload.value == 2 && !payload.has_text);
+        TEST(pb_decode_lazy(&msg.items[1], Payload_fields, &payload));
+        TEST(payload.value == 3 && payload.has_text && strcmp(payload.text, "item") == 0);
+
+        COMMENT("Test that untouched lazy fields are encoded as is");
+        TEST(pb_encode(&ostream, Envelope_fields, &msg));
+        TEST(ostream.bytes_written == message_length);
+        TEST(memcmp(buffer, buffer2, message_length) == 0);
+    }
+
+    {
+        Envelope msg = Envelope_init_zero;
+        Payload payload = Payload_init_zero;
+        Node node = Node_init_zero;
+        const pb_byte_t input[] = {0x08, 0x01, 0x12, 0x02, 0x10, 0x01};
+        pb_istream_t istream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test errors from lazy decoding");
+        TEST(pb_decode(&istream, Envelope_fields, &msg));
+        TEST(!pb_decode_lazy(&msg.payload, Payload_fields, &payload));
+
+        COMMENT("Test that a missing lazy field decodes as empty message");
+        memset(&msg, 0, sizeof(msg));
+        TEST(!pb_decode_lazy(&msg.payload, Payload_fields, &payload));
+        TEST(pb_decode_lazy(&msg.payload, Node_fields, &node));
+        TEST(!node.has_value && !node.has_child);
+    }
+
+    {
+        Node node = Node_init_zero;
+        Node child = Node_init_zero;
+        Node grandchild = Node_init_zero;
+        const pb_byte_t input[] = {0x08, 0x01, 0x12, 0x06, 0x08, 0x02, 0x12, 0x02, 0x08, 0x03};
+        pb_istream_t istream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test recursive lazy fields");
+        TEST(pb_decode(&istream, Node_fields, &node));
+        TEST(node.value == 1 && node.has_child);
+        TEST(pb_decode_lazy(&node.child, Node_fields, &child));
+        TEST(child.value == 2 && child.has_child);
+        TEST(pb_decode_lazy(&child.child, Node_fields, &grandchild));
+        TEST(grandchild.value == 3 && !grandchild.has_child);
+    }
+
+    {
+        Envelope msg = Envelope_init_zero;
+        pb_decoder_t decoder;
+        pb_decode_frame_t frames[4];
+        pb_byte_t carry[64];
+
+        COMMENT("Test that lazy fields need a buffer stream");
+        TEST(pb_decoder_init(&decoder, Envelope_fields, &msg, frames, 4, carry, sizeof(carry), 0));
+        TEST(!pb_decoder_feed(&decoder, buffer, message_length));
+        TEST(strcmp(PB_GET_ERROR(&decoder), "view needs buffer stream") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -236,9 +236,114 @@ static bool test_Garbage()
     return true;
 }
 
+/* Repeated pointer fields that grow over many entries */
+static bool test_ArrayMessage()
+{
+    uint8_t buffer[512];
+    size_t msgsize;
+    int i;
+
+    /* Unpacked entries interleaved with another array, then a packed
+     * block and more unpacked entries for the same field. */
+    {
+        pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+        int32_t packed[20];
+
+        for (i = 0; i < 100; i++)
+        {
+            TEST(pb_encode_tag(&stream, PB_WT_VARINT, ArrayMessage_ints_tag));
+            TEST(pb_encode_varint(&stream, (uint64_t)i));
+
+            if (i % 30 == 0)
+            {
+                TEST(pb_encode_tag(&stream, PB_WT_STRING, ArrayMessage_strs_tag));
+                TEST(pb_encode_string(&stream, (const pb_byte_t*)"abc", 3));
+            }
+        }
+
+        for (i = 0; i < 20; i++)
+        {
+            packed[i] = 100 + i;
+        }
+
+        {
+            pb_ostream_t sizestream = PB_OSTREAM_SIZING;
+            for (i = 0; i < 20; i++)
+                TEST(pb_encode_varint(&sizestream, (uint64_t)packed[i]));
+
+            TEST(pb_encode_tag(&stream, PB_WT_STRING, ArrayMessage_ints_tag));
+            TEST(pb_encode_varint(&stream, sizestream.bytes_written));
+            for (i = 0; i < 20; i++)
+                TEST(pb_encode_varint(&stream, (uint64_t)packed[i]));
+        }
+
+        for (i = 120; i < 130; i++)
+        {
+            TEST(pb_encode_tag(&stream, PB_WT_VARINT, ArrayMessage_ints_tag));
+            TEST(pb_encode_varint(&stream, (uint64_t)i));
+        }
+
+        msgsize = stream.bytes_written;
+    }
+
+    {
+        ArrayMessage msg = ArrayMessage_init_zero;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, msgsize);
+        size_t reallocs = get_realloc_count();
+
+        if (!pb_decode(&stream, ArrayMessage_fields, &msg))
+        {
+            fprintf(stderr, "Decode failed: %s\n", PB_GET_ERROR(&stream));
+            return false;
+        }
+
+        /* Doubling takes 7 reallocs for 130 ints. Each of the 4 strings
+         * costs one for the string, one for the strs array and one when
+         * the ints array is resumed, as only the last array is tracked. */
+        reallocs = get_realloc_count() - reallocs;
+        TEST(reallocs <= 7 + 4 * 3);
+
+        TEST(msg.ints_count == 130);
+        for (i = 0; i < 130; i++)
+        {
+            TEST(msg.ints[i] == i);
+        }
+        TEST(msg.strs_count == 4);
+        TEST(strcmp(msg.strs[3], "abc") == 0);
+
+        pb_release(ArrayMessage_fields, &msg);
+        TEST(get_alloc_count() == 0);
+    }
+
+    /* Merging into an array allocated by the caller must not assume
+     * any spare capacity. */
+    {
+        ArrayMessage msg = ArrayMessage_init_zero;
+        pb_istream_t stream = pb_istream_from_buffer(buffer, msgsize);
+
+        msg.ints_count = 3;
+        msg.ints = malloc_with_check(3 * sizeof(int32_t));
+        msg.ints[0] = msg.ints[1] = msg.ints[2] = -1;
+
+        if (!pb_decode_noinit(&stream, ArrayMessage_fields, &msg))
+        {
+            fprintf(stderr, "Decode failed: %s\n", PB_GET_ERROR(&stream));
+            return false;
+        }
+
+        TEST(msg.ints_count == 133);
+        TEST(msg.ints[2] == -1 && msg.ints[3] == 0 && msg.ints[132] == 129);
+
+        pb_release(ArrayMessage_fields, &msg);
+        TEST(get_alloc_count() == 0);
+    }
+
+    return true;
+}
+
 int main()
 {
-    if (test_TestMessage() && test_OneofMessage() && test_Garbage())
+    if (test_TestMessage() && test_OneofMessage() && test_Garbage() && test_ArrayMessage())
         return 0;
     else
         return 1;
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include "malloc_wrappers.h"
+#include "unittests.h"
+#include "repeated_streaming.pb.h"
+
+typedef struct {
+    int count;
+    size_t first_used;
+    pb_arena_t *arena;
+} notes_state_t;
+
+static bool check_note(const pb_field_t *field, void *item, void **arg)
+{
+    notes_state_t *state = (notes_state_t*)*arg;
+    const Note *note = (const Note*)item;
+    PB_UNUSED(field);
+
+    if (note->text == NULL || strcmp(note->text, "note") != 0)
+        return false;
+
+    /* Every element takes the same arena space as the first one */
+    if (state->count == 0)
+        state->first_used = state->arena->used;
+    else if (state->arena->used != state->first_used)
+        return false;
+
+    state->count++;
+    return true;
+}
+
+int main()
+{
+    int status = 0;
+    pb_byte_t buffer[64];
+    size_t i;
+    static uint64_t storage[16];
+    pb_arena_t arena;
+
+    for (i = 0; i < 64; i += 8)
+    {
+        memcpy(buffer + i, "\x0A\x06\x0A\x04note", 8);
+    }
+
+    {
+        Notes msg = Notes_init_zero;
+        notes_state_t state = {0, 0, NULL};
+        pb_istream_t istream = pb_istream_from_buffer(buffer, sizeof(buffer));
+
+        COMMENT("Test that arena space is reused between elements");
+        pb_arena_init(&arena, storage, sizeof(storage));
+        state.arena = &arena;
+        istream.arena = &arena;
+        msg.notes.funcs.decode = check_note;
+        msg.notes.arg = &state;
+
+        TEST(pb_decode(&istream, Notes_fields, &msg));
+        TEST(state.count == 8);
+        TEST(arena.used == 0);
+        TEST(msg.notes_item.text == NULL);
+        TEST(get_alloc_count() == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
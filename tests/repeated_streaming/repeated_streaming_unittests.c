@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "repeated_streaming.pb.h"
+
+typedef struct {
+    int count;
+    int fail_at;
+    Record records[4];
+} collected_t;
+
+static bool collect_record(const pb_field_t *field, void *item, void **arg)
+{
+    collected_t *collected = (collected_t*)*arg;
+
+    if (field->tag != Import_records_tag || collected->count == collected->fail_at)
+        return false;
+
+    collected->records[collected->count++] = *(const Record*)item;
+    return true;
+}
+
+static bool write_records(pb_ostream_t *stream, const pb_field_t *field, void * const *arg)
+{
+    const StaticImport *source = (const StaticImport*)*arg;
+    pb_size_t i;
+
+    for (i = 0; i < source->records_count; i++)
+    {
+        if (!pb_encode_tag_for_field(stream, field) ||
+            !pb_encode_submessage(stream, Record_fields, &source->records[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main()
+{
+    int status = 0;
+    pb_byte_t buffer[256];
+    size_t message_length;
+    StaticImport source = StaticImport_init_zero;
+
+    {
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+        source.has_source = true;
+        strcpy(source.source, "bulk");
+        source.records_count = 3;
+        source.records[0].id = 1;
+        source.records[0].has_name = true;
+        strcpy(source.records[0].name, "first");
+        source.records[0].has_score = true;
+        source.records[0].score = 100;
+        source.records[1].id = 2;
+        source.records[2].id = 3;
+        source.records[2].has_name = true;
+        strcpy(source.records[2].name, "third");
+        source.has_checksum = true;
+        source.checksum = 1234;
+
+        TEST(pb_encode(&ostream, StaticImport_fields, &source));
+        message_length = ostream.bytes_written;
+    }
+
+    {
+        Import msg = Import_init_zero;
+        collected_t collected;
+        pb_istream_t istream = pb_istream_from_buffer(buffer, message_length);
+
+        COMMENT("Test decoding elements into the element buffer");
+        memset(&collected, 0, sizeof(collected));
+        collected.fail_at = -1;
+        msg.records.funcs.decode = collect_record;
+        msg.records.arg = &collected;
+
+        TEST(pb_decode(&istream, Import_fields, &msg));
+        TEST(msg.has_source && strcmp(msg.source, "bulk") == 0);
+        TEST(msg.has_checksum && msg.checksum == 1234);
+        TEST(collected.count == 3);
+        TEST(collected.records[0].id == 1 && strcmp(collected.records[0].name, "first") == 0);
+        TEST(collected.records[0].has_score && collected.records[0].score == 100);
+
+        COMMENT("Test that each element starts from the default values");
+        TEST(collected.records[1].id == 2 && !collected.records[1].has_name);
+        TEST(collected.records[1].name[0] == '\0');
+        TEST(!collected.records[1].has_score && collected.records[1].score == 7);
+        TEST(collected.records[2].id == 3 && strcmp(collected.records[2].name, "third") == 0);
+    }
+
+    {
+        Import msg = Import_init_zero;
+        pb_istream_t istream = pb_istream_from_buffer(buffer, message_length);
+
+        COMMENT("Test skipping the field when there is no callback");
+        TEST(pb_decode(&istream, Import_fields, &msg));
+        TEST(msg.has_checksum && msg.checksum == 1234);
+        TEST(msg.records_item.id == 0);
+    }
+
+    {
+        Import msg = Import_init_zero;
+        collected_t collected;
+        pb_istream_t istream = pb_istream_from_buffer(buffer, message_length);
+
+        COMMENT("Test error from the callback");
+        memset(&collected, 0, sizeof(collected));
+        collected.fail_at = 1;
+        msg.records.funcs.decode = collect_record;
+        msg.records.arg = &collected;
+
+        TEST(!pb_decode(&istream, Import_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&istream), "callback failed") == 0);
+        TEST(collected.count == 1);
+    }
+
+    {
+        Import msg = Import_init_zero;
+        collected_t collected;
+        pb_byte_t invalid[] = {0x12, 0x02, 0x18, 0x01};
+        pb_istream_t istream = pb_istream_from_buffer(invalid, sizeof(invalid));
+
+        COMMENT("Test error from decoding an element");
+        memset(&collected, 0, sizeof(collected));
+        collected.fail_at = -1;
+        msg.records.funcs.decode = collect_record;
+        msg.records.arg = &collected;
+
+        TEST(!pb_decode(&istream, Import_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&istream), "missing required field") == 0);
+        TEST(collected.count == 0);
+    }
+
+    {
+        Import msg = Import_init_zero;
+        pb_byte_t buffer2[256];
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer2, sizeof(buffer2));
+
+        COMMENT("Test encoding through the encode callback");
+        msg.has_source = true;
+        strcpy(msg.source, "bulk");
+        msg.records.funcs.encode = write_records;
+        msg.records.arg = &source;
+        msg.has_checksum = true;
+        msg.checksum = 1234;
+
+        TEST(pb_encode(&ostream, Import_fields, &msg));
+        TEST(ostream.bytes_written == message_length);
+        TEST(memcmp(buffer, buffer2, message_length) == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,72 @@
+/* Check that the specialized functions match pb_encode() and pb_decode()
+ * when compiled with PB_WITHOUT_64BIT and PB_VALIDATE_UTF8. */
+
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "specialize_options.pb.h"
+#include "unittests.h"
+
+int main()
+{
+    int status = 0;
+
+    {
+        Small msg = Small_init_zero;
+        Small generic, specialized;
+        pb_byte_t buf1[Small_size], buf2[Small_size];
+        pb_ostream_t s1 = pb_ostream_from_buffer(buf1, sizeof(buf1));
+        pb_ostream_t s2 = pb_ostream_from_buffer(buf2, sizeof(buf2));
+        pb_istream_t i1, i2;
+
+        COMMENT("Test negative values are sign extended to 64 bits");
+        msg.value = -5;
+        msg.has_level = true;
+        msg.level = Level_LEVEL_LOW;
+        TEST(pb_encode(&s1, Small_fields, &msg));
+        TEST(Small_encode(&s2, &msg));
+        TEST(s1.bytes_written == 22);
+        TEST(s2.bytes_written == s1.bytes_written);
+        TEST(memcmp(buf1, buf2, s1.bytes_written) == 0);
+
+        memset(&generic, 0, sizeof(generic));
+        memset(&specialized, 0, sizeof(specialized));
+        i1 = pb_istream_from_buffer(buf1, s1.bytes_written);
+        i2 = pb_istream_from_buffer(buf1, s1.bytes_written);
+        TEST(pb_decode(&i1, Small_fields, &generic));
+        TEST(Small_decode(&i2, &specialized));
+        TEST(specialized.value == -5 && specialized.level == Level_LEVEL_LOW);
+        TEST(memcmp(&generic, &specialized, sizeof(generic)) == 0);
+    }
+
+    {
+        Small msg = Small_init_zero;
+        pb_byte_t buf[Small_size];
+        pb_ostream_t stream = pb_ostream_from_buffer(buf, sizeof(buf));
+
+        COMMENT("Test encoding invalid UTF-8");
+        msg.has_text = true;
+        strcpy(msg.text, "\xC3\x28");
+        TEST(!Small_encode(&stream, &msg));
+        TEST(strcmp(PB_GET_ERROR(&stream), "invalid utf8") == 0);
+    }
+
+    {
+        const pb_byte_t input[] = {0x08, 0x01, 0x1A, 0x02, 0xC3, 0x28};
+        Small msg;
+        pb_istream_t i1 = pb_istream_from_buffer(input, sizeof(input));
+        pb_istream_t i2 = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test decoding invalid UTF-8");
+        TEST(!pb_decode(&i1, Small_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&i1), "invalid utf8") == 0);
+        TEST(!Small_decode(&i2, &msg));
+        TEST(strcmp(PB_GET_ERROR(&i2), "invalid utf8") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
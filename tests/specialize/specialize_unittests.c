@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_encode.h>
+#include <pb_decode.h>
+#include "specialize.pb.h"
+#include "specialize_proto3.pb.h"
+#include "unittests.h"
+
+static void fill_outer(Outer *msg)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->req_int32 = -5;
+    msg->has_opt_int64 = true;
+    msg->opt_int64 = -1234567890123LL;
+    msg->has_opt_uint32 = true;
+    msg->opt_uint32 = 4000000000u;
+    msg->has_opt_uint64 = true;
+    msg->opt_uint64 = 12345678901234ULL;
+    msg->has_opt_sint32 = true;
+    msg->opt_sint32 = -77;
+    msg->has_opt_sint64 = true;
+    msg->opt_sint64 = -88888888888LL;
+    msg->has_opt_bool = true;
+    msg->opt_bool = true;
+    msg->has_opt_fixed32 = true;
+    msg->opt_fixed32 = 0xDEADBEEF;
+    msg->has_opt_sfixed32 = true;
+    msg->opt_sfixed32 = -1000;
+    msg->has_opt_float = true;
+    msg->opt_float = 1.5f;
+    msg->has_opt_fixed64 = true;
+    msg->opt_fixed64 = 0x0123456789ABCDEFULL;
+    msg->has_opt_sfixed64 = true;
+    msg->opt_sfixed64 = -2000;
+    msg->has_opt_double = true;
+    msg->opt_double = -2.25;
+    msg->has_opt_enum = true;
+    msg->opt_enum = Color_NEGATIVE;
+    msg->has_opt_string = true;
+    strcpy(msg->opt_string, "hello");
+    msg->has_opt_bytes = true;
+    msg->opt_bytes.size = 3;
+    memcpy(msg->opt_bytes.bytes, "\x00\x01\x02", 3);
+    msg->has_fixed_bytes = true;
+    memcpy(msg->fixed_bytes, "abcd", 4);
+    msg->has_opt_inner = true;
+    msg->opt_inner.a = 1;
+    msg->opt_inner.has_s = true;
+    strcpy(msg->opt_inner.s, "inner");
+    msg->req_inner.a = 2;
+    msg->has_plain = true;
+    msg->plain.has_value = true;
+    msg->plain.value = 300;
+    msg->has_empty = true;
+
+    msg->rep_int32_count = 3;
+    msg->rep_int32[0] = 1;
+    msg->rep_int32[1] = -1;
+    msg->rep_int32[2] = 100000;
+    msg->rep_fixed32_count = 2;
+    msg->rep_fixed32[0] = 7;
+    msg->rep_fixed32[1] = 8;
+    msg->rep_double_count = 1;
+    msg->rep_double[0] = 3.5;
+    msg->rep_sint64_count = 2;
+    msg->rep_sint64[0] = -3;
+    msg->rep_sint64[1] = 3;
+    msg->rep_string_count = 2;
+    strcpy(msg->rep_string[0], "a");
+    strcpy(msg->rep_string[1], "");
+    msg->rep_bytes_count = 1;
+    msg->rep_bytes[0].size = 2;
+    memcpy(msg->rep_bytes[0].bytes, "xy", 2);
+    msg->rep_inner_count = 2;
+    msg->rep_inner[0].a = 10;
+    msg->rep_inner[1].a = 11;
+    msg->rep_inner[1].has_s = true;
+    strcpy(msg->rep_inner[1].s, "r");
+
+    msg->which_choice = Outer_choice_inner_tag;
+    msg->choice.choice_inner.a = 3;
+
+    msg->has_small_int = true;
+    msg->small_int = -100;
+    msg->has_small_uint = true;
+    msg->small_uint = 60000;
+    msg->has_small_enum = true;
+    msg->small_enum = Color_NEGATIVE;
+    msg->has_with_default = true;
+    msg->with_default = 42;
+    msg->req_enum = Color_BLUE;
+}
+
+/* Decode with both pb_decode() and Outer_decode(), check that the status,
+ * error message and decoded structure are the same. */
+static bool decode_both(const pb_byte_t *buf, size_t len, bool expect_ok, const char *expect_err)
+{
+    Outer generic, specialized;
+    pb_istream_t s1 = pb_istream_from_buffer(buf, len);
+    pb_istream_t s2 = pb_istream_from_buffer(buf, len);
+    bool r1, r2;
+
+    memset(&generic, 0, sizeof(generic));
+    memset(&specialized, 0, sizeof(specialized));
+    r1 = pb_decode(&s1, Outer_fields, &generic);
+    r2 = Outer_decode(&s2, &specialized);
+
+    if (r1 != expect_ok || r2 != expect_ok)
+        return false;
+
+    if (!expect_ok)
+        return strcmp(PB_GET_ERROR(&s1), expect_err) == 0 &&
+               strcmp(PB_GET_ERROR(&s2), expect_err) == 0;
+
+    return s1.bytes_left == s2.bytes_left &&
+           memcmp(&generic, &specialized, sizeof(generic)) == 0;
+}
+
+int main()
+{
+    int status = 0;
+    Outer msg;
+    pb_byte_t buf1[Outer_size], buf2[Outer_size];
+    size_t len1, len2;
+
+    fill_outer(&msg);
+
+    {
+        pb_ostream_t s1 = pb_ostream_from_buffer(buf1, sizeof(buf1));
+        pb_ostream_t s2 = pb_ostream_from_buffer(buf2, sizeof(buf2));
+
+        COMMENT("Test that encoded data is identical");
+        TEST(pb_encode(&s1, Outer_fields, &msg));
+        TEST(Outer_encode(&s2, &msg));
+        len1 = s1.bytes_written;
+        len2 = s2.bytes_written;
+        TEST(len1 == len2 && memcmp(buf1, buf2, len1) == 0);
+    }
+
+    {
+        pb_ostream_t sizing = PB_OSTREAM_SIZING;
+
+        COMMENT("Test sizing stream");
+        TEST(Outer_encode(&sizing, &msg));
+        TEST(sizing.bytes_written == len1);
+    }
+
+    {
+        Outer decoded;
+        pb_istream_t stream = pb_istream_from_buffer(buf1, len1);
+
+        COMMENT("Test decoding");
+        TEST(decode_both(buf1, len1, true, NULL));
+        TEST(Outer_decode(&stream, &decoded));
+        TEST(decoded.opt_int64 == msg.opt_int64 && decoded.opt_sint64 == msg.opt_sint64);
+        TEST(decoded.opt_enum == Color_NEGATIVE && decoded.small_enum == Color_NEGATIVE);
+        TEST(decoded.small_int == -100 && decoded.small_uint == 60000);
+        TEST(strcmp(decoded.opt_inner.s, "inner") == 0 && decoded.plain.value == 300);
+        TEST(decoded.rep_int32_count == 3 && decoded.rep_int32[1] == -1);
+        TEST(decoded.rep_inner_count == 2 && strcmp(decoded.rep_inner[1].s, "r") == 0);
+        TEST(decoded.which_choice == Outer_choice_inner_tag && decoded.choice.choice_inner.a == 3);
+        TEST(decoded.always_encoded == 0 && decoded.with_default == 42);
+    }
+
+    {
+        Outer decoded;
+        const pb_byte_t input[] = {0x08, 0x01, 0x9A, 0x01, 0x02, 0x08, 0x01, 0xA0, 0x06, 0x01};
+        pb_istream_t stream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test default values");
+        TEST(decode_both(input, sizeof(input), true, NULL));
+        TEST(Outer_decode(&stream, &decoded));
+        TEST(!decoded.has_opt_int64 && decoded.with_default == 42 && decoded.rep_int32_count == 0);
+    }
+
+    {
+        /* req_int32, req_inner, unknown fields 99 and 1000, req_enum */
+        const pb_byte_t input[] = {0x08, 0x01, 0x9A, 0x01, 0x02, 0x08, 0x01,
+                                   0x98, 0x06, 0x05, 0xC2, 0x3E, 0x01, 0xFF,
+                                   0xA0, 0x06, 0x01};
+
+        COMMENT("Test skipping unknown fields");
+        TEST(decode_both(input, sizeof(input), true, NULL));
+    }
+
+    {
+        /* Unpacked rep_int32, choice_int followed by choice_inner twice */
+        const pb_byte_t input[] = {0x08, 0x01, 0x9A, 0x01, 0x02, 0x08, 0x01, 0xA0, 0x06, 0x01,
+                                   0xB0, 0x01, 0x05, 0xB0, 0x01, 0x06, 0xB2, 0x01, 0x01, 0x07,
+                                   0xE8, 0x01, 0x09,
+                                   0xFA, 0x01, 0x05, 0x08, 0x04, 0x12, 0x01, 'z',
+                                   0xFA, 0x01, 0x02, 0x08, 0x05};
+        Outer decoded;
+        pb_istream_t stream = pb_istream_from_buffer(input, sizeof(input));
+
+        COMMENT("Test unpacked arrays and oneof merging");
+        TEST(decode_both(input, sizeof(input), true, NULL));
+        TEST(Outer_decode(&stream, &decoded));
+        TEST(decoded.rep_int32_count == 3 && decoded.rep_int32[2] == 7);
+        TEST(decoded.choice.choice_inner.a == 5 && strcmp(decoded.choice.choice_inner.s, "z") == 0);
+    }
+
+    {
+        const pb_byte_t input[] = {0x08, 0x01, 0xA0, 0x06, 0x01};
+
+        COMMENT("Test missing required field");
+        TEST(decode_both(input, sizeof(input), false, "missing required field"));
+    }
+
+    {
+        const pb_byte_t input[] = {0x80, 0x02, 0xAC, 0x02};
+
+        COMMENT("Test integer overflow");
+        TEST(decode_both(input, sizeof(input), false, "integer too large"));
+    }
+
+    {
+        const pb_byte_t input[] = {0xB2, 0x01, 0x06, 1, 2, 3, 4, 5, 6};
+
+        COMMENT("Test array overflow");
+        TEST(decode_both(input, sizeof(input), false, "array overflow"));
+    }
+
+    {
+        const pb_byte_t input[] = {0x7A, 0x10, 'a','b','c','d','e','f','g','h',
+                                   'a','b','c','d','e','f','g','h'};
+
+        COMMENT("Test string overflow");
+        TEST(decode_both(input, sizeof(input), false, "string overflow"));
+    }
+
+    {
+        const pb_byte_t input[] = {0x8A, 0x01, 0x03, 'a', 'b', 'c'};
+
+        COMMENT("Test fixed length bytes with wrong size");
+        TEST(decode_both(input, sizeof(input), false, "incorrect fixed length bytes size"));
+    }
+
+    {
+        const pb_byte_t input[] = {0x0D, 0x01, 0x00, 0x00, 0x00};
+
+        COMMENT("Test wrong wire type");
+        TEST(decode_both(input, sizeof(input), false, "wrong wire type"));
+    }
+
+    {
+        const pb_byte_t input[] = {0x00};
+
+        COMMENT("Test zero tag");
+        TEST(decode_both(input, sizeof(input), false, "zero tag"));
+    }
+
+    {
+        Outer bad;
+        pb_byte_t buf[Outer_size];
+        pb_ostream_t stream = pb_ostream_from_buffer(buf, sizeof(buf));
+
+        COMMENT("Test encoding errors");
+        fill_outer(&bad);
+        memset(bad.opt_string, 'x', sizeof(bad.opt_string));
+        TEST(!Outer_encode(&stream, &bad));
+        TEST(strcmp(PB_GET_ERROR(&stream), "unterminated string") == 0);
+
+        fill_outer(&bad);
+        bad.rep_int32_count = 6;
+        stream = pb_ostream_from_buffer(buf, sizeof(buf));
+        TEST(!Outer_encode(&stream, &bad));
+        TEST(strcmp(PB_GET_ERROR(&stream), "array max size exceeded") == 0);
+
+        fill_outer(&bad);
+        stream = pb_ostream_from_buffer(buf, 10);
+        TEST(!Outer_encode(&stream, &bad));
+        TEST(strcmp(PB_GET_ERROR(&stream), "stream full") == 0);
+    }
+
+    {
+        Proto3Msg p3 = Proto3Msg_init_zero;
+        Proto3Msg generic, specialized;
+        pb_byte_t p3buf1[Proto3Msg_size], p3buf2[Proto3Msg_size];
+        pb_ostream_t s1, s2;
+        pb_istream_t i1, i2;
+
+        COMMENT("Test proto3 message with zero values");
+        s1 = pb_ostream_from_buffer(p3buf1, sizeof(p3buf1));
+        s2 = pb_ostream_from_buffer(p3buf2, sizeof(p3buf2));
+        TEST(Proto3Msg_encode(&s2, &p3));
+        TEST(s2.bytes_written == 0);
+
+        COMMENT("Test proto3 message with non-zero values");
+        p3.int_value = 5;
+        p3.float_value = -0.0f;
+        p3.double_value = 1.0;
+        strcpy(p3.str_value, "s");
+        p3.bytes_value.size = 1;
+        p3.bool_value = true;
+        p3.enum_value = Mode_MODE_ONE;
+        p3.has_submsg = true;
+        p3.submsg.a = 1;
+        p3.values_count = 2;
+        p3.values[0] = 1;
+        p3.values[1] = 1000;
+        s2 = pb_ostream_from_buffer(p3buf2, sizeof(p3buf2));
+        TEST(pb_encode(&s1, Proto3Msg_fields, &p3));
+        TEST(Proto3Msg_encode(&s2, &p3));
+        TEST(s1.bytes_written == s2.bytes_written);
+        TEST(memcmp(p3buf1, p3buf2, s1.bytes_written) == 0);
+
+        memset(&generic, 0, sizeof(generic));
+        memset(&specialized, 0, sizeof(specialized));
+        i1 = pb_istream_from_buffer(p3buf1, s1.bytes_written);
+        i2 = pb_istream_from_buffer(p3buf1, s1.bytes_written);
+        TEST(pb_decode(&i1, Proto3Msg_fields, &generic));
+        TEST(Proto3Msg_decode(&i2, &specialized));
+        TEST(memcmp(&generic, &specialized, sizeof(generic)) == 0);
+    }
+
+    {
+        Empty empty = Empty_init_zero;
+        pb_byte_t buf[4];
+        pb_ostream_t stream = pb_ostream_from_buffer(buf, sizeof(buf));
+        pb_istream_t istream;
+
+        COMMENT("Test empty message");
+        TEST(Empty_encode(&stream, &empty) && stream.bytes_written == 0);
+        istream = pb_istream_from_buffer((const pb_byte_t*)"\x08\x01", 2);
+        TEST(Empty_decode(&istream, &empty));
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}
@@ -0,0 +1,69 @@
+/* Check that pb_field_iter_find() gives the same results with and
+ * without the tag lookup table. */
+
+#include <string.h>
+#include <pb_common.h>
+#include "tag_lookup.pb.h"
+#include "unittests.h"
+
+static bool compare_find(const pb_msgdesc_t *desc, uint32_t tag)
+{
+    pb_msgdesc_t linear_desc = *desc;
+    pb_field_iter_t iter1, iter2;
+    bool found1, found2;
+
+    linear_desc.field_lookup = NULL;
+    linear_desc.field_lookup_count = 0;
+
+    pb_field_iter_begin(&iter1, desc, NULL);
+    pb_field_iter_begin(&iter2, &linear_desc, NULL);
+    found1 = pb_field_iter_find(&iter1, tag);
+    found2 = pb_field_iter_find(&iter2, tag);
+
+#ifndef PB_DESCRIPTOR_UNPACKED
+    if (iter1.field_info_index != iter2.field_info_index)
+        return false;
+#endif
+
+    return found1 == found2 &&
+           iter1.index == iter2.index &&
+           iter1.required_field_index == iter2.required_field_index &&
+           iter1.submessage_index == iter2.submessage_index &&
+           iter1.tag == iter2.tag &&
+           iter1.type == iter2.type &&
+           iter1.submsg_desc == iter2.submsg_desc;
+}
+
+static bool check_message(const pb_msgdesc_t *desc)
+{
+    uint32_t tag;
+
+    if (desc->field_lookup == NULL)
+        return false;
+
+    for (tag = 0; tag <= (uint32_t)desc->largest_tag + 1; tag++)
+    {
+        if (!compare_find(desc, tag))
+        {
+            fprintf(stderr, "Mismatch for tag %d\n", (int)tag);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main()
+{
+    int status = 0;
+
+    COMMENT("Compare lookup table with linear search");
+    TEST(check_message(SubMsg_fields));
+    TEST(check_message(Mixed_fields));
+    TEST(check_message(Wide_fields));
+
+    COMMENT("Sparse tag numbers fall back to linear search");
+    TEST(Sparse_msg.field_lookup == NULL);
+
+    return status;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "unittests.h"
+#include "view_fields.pb.h"
+
+#define VIEW_EQUALS(v, s) ((v).size == strlen(s) && memcmp((v).bytes, s, strlen(s)) == 0)
+
+static bool read_callback(pb_istream_t *stream, uint8_t *buf, size_t count)
+{
+    const pb_byte_t *source = (const pb_byte_t*)stream->state;
+    memcpy(buf, source, count);
+    stream->state = (void*)(source + count);
+    return true;
+}
+
+int main()
+{
+    int status = 0;
+    pb_byte_t buffer[256];
+    size_t message_length;
+
+    {
+        ViewMessage msg = ViewMessage_init_zero;
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+        COMMENT("Test encoding of view fields");
+        msg.name.bytes = (const pb_byte_t*)"name";
+        msg.name.size = 4;
+        msg.has_data = true;
+        msg.data.bytes = (const pb_byte_t*)"\x00\x01\x02";
+        msg.data.size = 3;
+        msg.tags_count = 2;
+        msg.tags[0].bytes = (const pb_byte_t*)"first";
+        msg.tags[0].size = 5;
+        msg.tags[1].bytes = (const pb_byte_t*)"";
+        msg.tags[1].size = 0;
+        msg.which_choice = ViewMessage_text_tag;
+        msg.choice.text.bytes = (const pb_byte_t*)"oneof text";
+        msg.choice.text.size = 10;
+
+        TEST(pb_encode(&ostream, ViewMessage_fields, &msg));
+        message_length = ostream.bytes_written;
+    }
+
+    {
+        CopyMessage msg = CopyMessage_init_zero;
+        pb_istream_t istream = pb_istream_from_buffer(buffer, message_length);
+
+        COMMENT("Test decoding as normal static fields");
+        TEST(pb_decode(&istream, CopyMessage_fields, &msg));
+        TEST(strcmp(msg.name, "name") == 0);
+        TEST(msg.has_data && msg.data.size == 3 && memcmp(msg.data.bytes, "\x00\x01\x02", 3) == 0);
+        TEST(msg.tags_count == 2 && strcmp(msg.tags[0], "first") == 0 && msg.tags[1][0] == '\0');
+        TEST(msg.implicit.size == 0);
+        TEST(msg.which_choice == CopyMessage_text_tag && strcmp(msg.choice.text, "oneof text") == 0);
+    }
+
+    {
+        ViewMessage msg = ViewMessage_init_zero;
+        pb_istream_t istream = pb_istream_from_buffer(buffer, message_length);
+
+        COMMENT("Test decoding to views");
+        TEST(pb_decode(&istream, ViewMessage_fields, &msg));
+        TEST(VIEW_EQUALS(msg.name, "name"));
+        TEST(msg.has_data && msg.data.size == 3 && memcmp(msg.data.bytes, "\x00\x01\x02", 3) == 0);
+        TEST(msg.tags_count == 2 && VIEW_EQUALS(msg.tags[0], "first") && msg.tags[1].size == 0);
+        TEST(msg.implicit.bytes == NULL && msg.implicit.size == 0);
+        TEST(msg.which_choice == ViewMessage_text_tag && VIEW_EQUALS(msg.choice.text, "oneof text"));
+
+        /* Data must not be copied */
+        TEST(msg.name.bytes > buffer && msg.name.bytes < buffer + message_length);
+        TEST(msg.tags[0].bytes > buffer && msg.tags[0].bytes < buffer + message_length);
+        TEST(msg.choice.text.bytes > buffer && msg.choice.text.bytes < buffer + message_length);
+    }
+
+    {
+        ViewMessage msg = ViewMessage_init_zero;
+        pb_istream_t istream = pb_istream_from_buffer(buffer, message_length - 1);
+
+        COMMENT("Test truncated message");
+        TEST(!pb_decode(&istream, ViewMessage_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&istream), "end-of-stream") == 0);
+    }
+
+    {
+        ViewMessage msg = ViewMessage_init_zero;
+        pb_istream_t istream = PB_ISTREAM_EMPTY;
+        istream.callback = &read_callback;
+        istream.state = buffer;
+        istream.bytes_left = message_length;
+
+        COMMENT("Test that views are refused for callback streams");
+        TEST(!pb_decode(&istream, ViewMessage_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&istream), "view needs buffer stream") == 0);
+    }
+
+    {
+        ViewMessage msg = ViewMessage_init_zero;
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+
+        COMMENT("Test invalid view");
+        msg.name.size = 5;
+        TEST(!pb_encode(&ostream, ViewMessage_fields, &msg));
+        TEST(strcmp(PB_GET_ERROR(&ostream), "invalid view") == 0);
+    }
+
+    if (status != 0)
+        fprintf(stdout, "\n\nSome tests FAILED!\n");
+
+    return status;
+}